@@ -80,6 +80,8 @@ int main(int argc, char **argv)
     MimirContext<int64_t,int64_t,char*,void> *graph_loader
         = new MimirContext<int64_t,int64_t,char*,void>(input);
     graph_loader->map(fileread);
+    // The edge list stays where it is; only active edges are shuffled
+    bool persisted = graph_loader->persist();
 
     //MimirContext<int64_t,int64_t> *edge_list = new MimirContext<int64_t,int64_t>();
 
@@ -99,18 +101,20 @@ int main(int argc, char **argv)
     do {
         // Join with edge list
         //if (level == 0) {
-        active_edge->insert_data_handle(graph_loader->get_data_handle());
+        if (persisted)
+            active_edge->attach_data_handle(graph_loader->get_data_handle());
+        else
+            active_edge->insert_data_handle(graph_loader->get_data_handle());
         //} else {
         //    active_edge->insert_data_handle(edge_list->get_data_handle());
         //}
         active_edge->map(map_copy);
-        nactives[level] = active_edge->reduce(join_edge_list_reduce);
+        // Join with span tree; the joined edges are shuffled directly
+        active_edge->insert_data_handle(span_tree->get_data_handle());
+        nactives[level] = active_edge->reduce_into(active_edge, join_edge_list_reduce);
         if (rank == 0) {
             fprintf(stdout, "level=%d, nactives=%ld\n", level, nactives[level]);
         }
-        // Join with span tree
-        active_edge->insert_data_handle(span_tree->get_data_handle());
-        active_edge->map(map_copy);
         nactives[level] = active_edge->reduce(deduplicate);
         // Add active edges to span tree
         span_tree->insert_data_handle(active_edge->get_data_handle());
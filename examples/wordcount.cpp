@@ -54,7 +54,13 @@ int main (int argc, char *argv[])
                                            NULL
 #endif
                                            );
+#ifdef SPLIT_KEYS
+    // Hot words may be split among processes, their counts are merged
+    ctx->set_split_merge(true);
+    ctx->map(map, NULL, true, false, "binary", true);
+#else
     ctx->map(map);
+#endif
     nunique = ctx->reduce(countword, NULL, true, "text");
     delete ctx;
 
@@ -0,0 +1,66 @@
+#! /bin/bash
+#
+# Run wc_split on words where one word is 30% of all records, check that
+# the hot word is split and merged, and compare the counts with sort|uniq.
+# A key is split when it holds more than 0.8/<processes> of the records,
+# so at least 3 processes are needed.
+#
+# MPIRUN can be set to the launcher command (default: mpirun)
+
+if [ $# -lt 1 ]; then
+    echo "./check-split-keys.sh <path of wc_split> [number of processes] [work dir]"
+    exit 1
+fi
+
+WC_SPLIT=$1
+NPROCS=${2:-4}
+WORKDIR=${3:-/tmp/mimir-split-keys}
+MPIRUN=${MPIRUN:-mpirun}
+
+if [ $NPROCS -lt 3 ]; then
+    echo "The hot word is not split with less than 3 processes"
+    exit 1
+fi
+
+rm -rf $WORKDIR
+mkdir -p $WORKDIR/input $WORKDIR/output
+
+for f in 0 1 2 3; do
+    awk -v seed=$f 'BEGIN {
+        srand(seed + 1);
+        for (i = 0; i < 100000; i++) {
+            if (rand() < 0.3) w = "jbe"; else w = "w" int(rand() * 20000);
+            printf "%s%s", w, (i % 10 == 9) ? "\n" : " ";
+        }
+    }' > $WORKDIR/input/words.$f
+done
+
+cat $WORKDIR/input/* | tr ' ' '\n' | grep -v '^$' | sort | uniq -c \
+    | awk '{print $2" "$1}' | sort > $WORKDIR/expected.txt
+
+# Balancing runs between shuffle rounds, so the buffer is kept small
+MIMIR_BALANCE_LOAD=1 MIMIR_COMM_SIZE=64K MIMIR_DBG_GEN=1 \
+    $MPIRUN -np $NPROCS $WC_SPLIT $WORKDIR/output/wc $WORKDIR/input \
+    > $WORKDIR/run.log 2>&1
+if [ $? -ne 0 ]; then
+    tail -20 $WORKDIR/run.log
+    echo "FAILED: wc_split did not finish"
+    exit 1
+fi
+
+MERGED=$(grep -o "partial results=[0-9]*, total=[0-9]*" $WORKDIR/run.log \
+         | head -1 | sed 's/.*total=//')
+if [ -z "$MERGED" ] || [ $MERGED -eq 0 ]; then
+    echo "FAILED: no key was split"
+    exit 1
+fi
+
+cat $WORKDIR/output/* | sort > $WORKDIR/result.txt
+if ! cmp -s $WORKDIR/result.txt $WORKDIR/expected.txt; then
+    diff $WORKDIR/result.txt $WORKDIR/expected.txt | head
+    echo "FAILED: the counts differ"
+    exit 1
+fi
+
+echo "OK: $MERGED partial results of split keys merged"
+exit 0
@@ -22,7 +22,7 @@ export MIMIR_WRITE_TYPE=mpiio
 
 jobstr=mimir-lb-proc-fq1-f1.5-b1000-split
 #jobstr=mimir
-exe=join_split
+exe=join
 
 #alpha=1.0
 
@@ -0,0 +1,252 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/aio_abi.h>
+
+#include "log.h"
+#include "config.h"
+#include "globals.h"
+#include "asyncio.h"
+
+using namespace MIMIR_NS;
+
+AsyncIO::AsyncIO() {
+    io_type = AIO_NONE;
+    inflight = 0;
+    ring_fd = -1;
+    sq_ptr = cq_ptr = sqes = cqes = NULL;
+    sq_size = cq_size = sqes_size = 0;
+    sq_tail = sq_mask = sq_array = NULL;
+    cq_head = cq_tail = cq_mask = NULL;
+    aio_ctx = 0;
+}
+
+AsyncIO::~AsyncIO() {
+    uninit();
+}
+
+bool AsyncIO::init(int depth) {
+    if (uring_init(depth)) {
+        io_type = AIO_URING;
+    } else if (aio_init(depth)) {
+        io_type = AIO_LINUX;
+    } else {
+        return false;
+    }
+    inflight = 0;
+    LOG_PRINT(DBG_IO, "Async I/O init: type=%s, depth=%d\n",
+              io_type == AIO_URING ? "io_uring" : "aio", depth);
+    return true;
+}
+
+void AsyncIO::uninit() {
+    if (io_type == AIO_URING) uring_uninit();
+    else if (io_type == AIO_LINUX) aio_uninit();
+    io_type = AIO_NONE;
+    inflight = 0;
+}
+
+bool AsyncIO::submit_read(int fd, char *buf, uint64_t size, uint64_t offset, void *tag) {
+    bool ret = false;
+    if (io_type == AIO_URING) ret = uring_submit(fd, buf, size, offset, tag);
+    else if (io_type == AIO_LINUX) ret = aio_submit(fd, buf, size, offset, tag);
+    if (ret) inflight ++;
+    return ret;
+}
+
+int AsyncIO::get_events(AsyncIOEvent *events, int max_events, bool wait) {
+    int count = 0;
+    if (inflight == 0) return 0;
+    if (io_type == AIO_URING) count = uring_get_events(events, max_events, wait);
+    else if (io_type == AIO_LINUX) count = aio_get_events(events, max_events, wait);
+    inflight -= count;
+    return count;
+}
+
+// io_uring: IORING_OP_READ needs Linux 5.6. IORING_FEAT_FAST_POLL came with
+// 5.7, so it is used to tell an old kernel and fall back to AIO.
+bool AsyncIO::uring_init(int depth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)depth, &p);
+    if (ring_fd < 0) {
+        ring_fd = -1;
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        ::close(ring_fd);
+        ring_fd = -1;
+        return false;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = NULL;
+        uring_uninit();
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = NULL;
+            uring_uninit();
+            return false;
+        }
+    }
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = NULL;
+        uring_uninit();
+        return false;
+    }
+
+    sq_tail = (unsigned*)((char*)sq_ptr + p.sq_off.tail);
+    sq_mask = (unsigned*)((char*)sq_ptr + p.sq_off.ring_mask);
+    sq_array = (unsigned*)((char*)sq_ptr + p.sq_off.array);
+    cq_head = (unsigned*)((char*)cq_ptr + p.cq_off.head);
+    cq_tail = (unsigned*)((char*)cq_ptr + p.cq_off.tail);
+    cq_mask = (unsigned*)((char*)cq_ptr + p.cq_off.ring_mask);
+    cqes = (char*)cq_ptr + p.cq_off.cqes;
+
+    return true;
+}
+
+void AsyncIO::uring_uninit() {
+    if (sqes != NULL) munmap(sqes, sqes_size);
+    if (cq_ptr != NULL && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr != NULL) munmap(sq_ptr, sq_size);
+    if (ring_fd != -1) ::close(ring_fd);
+    ring_fd = -1;
+    sq_ptr = cq_ptr = sqes = cqes = NULL;
+}
+
+bool AsyncIO::uring_submit(int fd, char *buf, uint64_t size, uint64_t offset, void *tag) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe*)sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = (uint32_t)size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)tag;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret = 0;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        LOG_WARNING("io_uring submit error (%s)!\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int AsyncIO::uring_get_events(AsyncIOEvent *events, int max_events, bool wait) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail && wait) {
+        int ret = 0;
+        do {
+            ret = (int)syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (ret < 0 && errno == EINTR);
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    int count = 0;
+    while (head != tail && count < max_events) {
+        struct io_uring_cqe *cqe = (struct io_uring_cqe*)cqes + (head & *cq_mask);
+        events[count].tag = (void*)cqe->user_data;
+        events[count].res = cqe->res;
+        count ++;
+        head ++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+// Linux AIO: only O_DIRECT reads are really asynchronous, buffered reads
+// are completed inside io_submit.
+bool AsyncIO::aio_init(int depth) {
+    aio_context_t ctx = 0;
+    if (syscall(__NR_io_setup, depth, &ctx) < 0)
+        return false;
+    aio_ctx = (unsigned long)ctx;
+    return true;
+}
+
+void AsyncIO::aio_uninit() {
+    if (aio_ctx != 0) syscall(__NR_io_destroy, (aio_context_t)aio_ctx);
+    aio_ctx = 0;
+}
+
+bool AsyncIO::aio_submit(int fd, char *buf, uint64_t size, uint64_t offset, void *tag) {
+    struct iocb cb;
+    struct iocb *cbs[1];
+
+    memset(&cb, 0, sizeof(cb));
+    cb.aio_fildes = (uint32_t)fd;
+    cb.aio_lio_opcode = IOCB_CMD_PREAD;
+    cb.aio_buf = (uint64_t)buf;
+    cb.aio_nbytes = size;
+    cb.aio_offset = (int64_t)offset;
+    cb.aio_data = (uint64_t)tag;
+    cbs[0] = &cb;
+
+    long ret = 0;
+    do {
+        ret = syscall(__NR_io_submit, (aio_context_t)aio_ctx, 1, cbs);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        LOG_WARNING("AIO submit error (%s)!\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int AsyncIO::aio_get_events(AsyncIOEvent *events, int max_events, bool wait) {
+    struct io_event ev[max_events];
+    struct timespec zero = {0, 0};
+
+    long ret = 0;
+    do {
+        ret = syscall(__NR_io_getevents, (aio_context_t)aio_ctx,
+                      wait ? 1 : 0, max_events, ev, wait ? NULL : &zero);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) return 0;
+
+    for (int i = 0; i < (int)ret; i++) {
+        events[i].tag = (void*)ev[i].data;
+        events[i].res = ev[i].res;
+    }
+    return (int)ret;
+}
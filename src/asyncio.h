@@ -0,0 +1,75 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_ASYNC_IO_H
+#define MIMIR_ASYNC_IO_H
+
+#include <stdint.h>
+
+namespace MIMIR_NS {
+
+enum AsyncIOType { AIO_NONE, AIO_URING, AIO_LINUX };
+
+struct AsyncIOEvent {
+    void    *tag;
+    int64_t  res;      // bytes read or -errno
+};
+
+// Asynchronous reads with several requests in flight. It uses io_uring when
+// the kernel supports it and falls back to Linux native AIO otherwise. Both
+// are driven by raw system calls, so there is no library dependency.
+class AsyncIO {
+  public:
+    AsyncIO();
+    ~AsyncIO();
+
+    bool init(int depth);
+    void uninit();
+
+    bool submit_read(int fd, char *buf, uint64_t size, uint64_t offset, void *tag);
+    int get_events(AsyncIOEvent *events, int max_events, bool wait);
+
+    AsyncIOType get_type() { return io_type; }
+    int get_inflight() { return inflight; }
+
+  private:
+    bool uring_init(int depth);
+    void uring_uninit();
+    bool uring_submit(int fd, char *buf, uint64_t size, uint64_t offset, void *tag);
+    int  uring_get_events(AsyncIOEvent *events, int max_events, bool wait);
+
+    bool aio_init(int depth);
+    void aio_uninit();
+    bool aio_submit(int fd, char *buf, uint64_t size, uint64_t offset, void *tag);
+    int  aio_get_events(AsyncIOEvent *events, int max_events, bool wait);
+
+    AsyncIOType io_type;
+    int         inflight;
+
+    // io_uring
+    int         ring_fd;
+    void       *sq_ptr;
+    void       *cq_ptr;
+    size_t      sq_size;
+    size_t      cq_size;
+    void       *sqes;
+    size_t      sqes_size;
+    unsigned   *sq_tail;
+    unsigned   *sq_mask;
+    unsigned   *sq_array;
+    unsigned   *cq_head;
+    unsigned   *cq_tail;
+    unsigned   *cq_mask;
+    void       *cqes;
+
+    // Linux AIO
+    unsigned long aio_ctx;
+};
+
+}
+
+#endif
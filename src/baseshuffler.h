@@ -18,11 +18,21 @@
 #include "interface.h"
 #include "hashbucket.h"
 #include "serializer.h"
+#include "bloomfilter.h"
+#include "rangepartitioner.h"
+#include "spacesaving.h"
 #include "bincontainer.h"
 #include "kvcontainer.h"
 
 namespace MIMIR_NS {
 
+// Records of a bin held by this process
+struct BinCount {
+    uint32_t bid;
+    uint64_t kv_count;
+    uint64_t unique_count;
+};
+
 template <typename KeyType, typename ValType>
 class BaseShuffler : public Writable<KeyType, ValType> {
 public:
@@ -64,6 +74,11 @@ public:
 
         this->split_hint = split_hint;
         this->h = h;
+        this->key_filter = NULL;
+        this->range = NULL;
+        this->target_table = NULL;
+        this->hot_keys = NULL;
+        this->redirected_bins = 0;
 
         if (BALANCE_LOAD) {
 
@@ -71,6 +86,9 @@ public:
                 std::random_device rd;
                 gen = new std::minstd_rand(rd());
                 d = new std::uniform_int_distribution<>(0, shuffle_size - 1);
+                // A split key holds more than 0.8/size of the records, so
+                // it is tracked by a sketch with more than 1.25*size slots
+                hot_keys = new SpaceSaving(2 * shuffle_size + 64);
             }
 
             // Split communicator on shared-memory node
@@ -158,8 +176,17 @@ public:
             this->global_kv_count = 0;
             this->local_unique_count = 0;
             this->global_unique_count = 0;
+            // Bins are dense in [0, size*BIN_COUNT), so the owner and the
+            // local counters of a bin are found by indexing
+            uint32_t nbins = (uint32_t)shuffle_size * BIN_COUNT;
+            bin_owner.resize(nbins);
+            for (uint32_t bid = 0; bid < nbins; bid++) {
+                bin_owner[bid] = (int)(bid % (uint32_t)shuffle_size);
+            }
+            bin_slot.assign(nbins, -1);
+            bin_split.assign(nbins, 0);
             for (int i = 0; i < BIN_COUNT; i++) {
-                bin_table.insert({shuffle_rank+i*shuffle_size, {0,0}});
+                add_local_bin(shuffle_rank+i*shuffle_size, 0, 0);
             }
         }
     }
@@ -222,6 +249,7 @@ public:
 
                 delete gen;
                 delete d;
+                delete hot_keys;
             }
             MPI_Group_free(&shared_group);
             MPI_Group_free(&shuffle_group);
@@ -238,6 +266,26 @@ public:
 
     virtual int open() = 0;
     virtual int write(KeyType *key, ValType *val) = 0;
+
+    // Drop the records whose key is not in the filter (e.g. the keys of
+    // the other side of a join) before they are sent
+    void set_key_filter(BloomFilter *filter) {
+        key_filter = filter;
+    }
+
+    // Place records by key range instead of hash. The output is not
+    // migrated by the load balancer, which works on hash bins.
+    void set_range_partitioner(RangePartitioner<KeyType> *range) {
+        this->range = range;
+        migratable = false;
+    }
+
+    // Place records by a table of processes indexed by the key hash
+    // modulo the table size. The output is not migrated either.
+    void set_target_table(const std::vector<int> *table) {
+        this->target_table = table;
+        migratable = false;
+    }
     virtual void close() = 0;
     virtual void make_progress(bool issue_new = false) = 0;
   
@@ -297,7 +345,14 @@ protected:
     int get_target_rank(KeyType *key, ValType *val) {
 
         int target = 0;
-        if (user_hash != NULL) {
+        if (range != NULL) {
+            target = range->get_target(key);
+        }
+        else if (target_table != NULL) {
+            uint32_t hid = ser->get_hash_code(key);
+            target = (*target_table)[hid % (uint32_t)target_table->size()];
+        }
+        else if (user_hash != NULL) {
             target = user_hash(key, val, shuffle_size) % shuffle_size;
         }
         else {
@@ -305,8 +360,10 @@ protected:
             if (!BALANCE_LOAD) {
                 target = (int) (hid % (uint32_t) shuffle_size);
             } else {
+                uint32_t bid = hid % (uint32_t) (shuffle_size * BIN_COUNT);
                 // split this key
-                if (split_hint && split_table.find(hid) != split_table.end()) {
+                if (split_hint && bin_split[bid]
+                    && split_table.find(hid) != split_table.end()) {
                     target = (*d)((*gen));
                     int keysize = this->ser->get_key_bytes(key);
                     char *keyptr = this->ser->get_key_ptr(key);
@@ -315,15 +372,7 @@ protected:
                         h->insertEntry(keyptr, keysize, &v);
                     }
                 } else {
-                    // search item in the redirect table
-                    uint32_t bid = hid % (uint32_t) (shuffle_size * BIN_COUNT);
-                    auto iter = redirect_table.find(bid);
-                    // find the item in the redirect table
-                    if (iter != redirect_table.end()) {
-                        target = iter->second;
-                    } else {
-                        target = (int) (bid % (uint32_t) shuffle_size);
-                    }
+                    target = bin_owner[bid];
                 }
             }
         }
@@ -334,16 +383,27 @@ protected:
         return target;
     }
 
+    bool is_filtered(KeyType *key) {
+        if (key_filter == NULL) return false;
+        if (key_filter->contains(ser->get_key_ptr(key), ser->get_key_bytes(key)))
+            return false;
+        PROFILER_RECORD_COUNT(COUNTER_FILTERED_KVS, 1, OPSUM);
+        return true;
+    }
+
     void record_bin_info(KeyType *key, int ret) {
+        // Bins are not tracked when the output is placed otherwise
+        if (!migratable) return;
         uint32_t hid = ser->get_hash_code(key);
         int bidx = (int) (hid % (uint32_t) (shuffle_size * BIN_COUNT));
         if (ret) {
-            auto iter = bin_table.find(bidx);
-            if (iter != bin_table.end()) {
-                iter->second.first += 1;
+            if (split_hint) hot_keys->add(hid);
+            BinCount *bin = find_local_bin(bidx);
+            if (bin != NULL) {
+                bin->kv_count += 1;
                 local_kv_count += 1;
                 if (ret == 2) {
-                    iter->second.second += 1;
+                    bin->unique_count += 1;
                     local_unique_count += 1;
                 }
             } else {
@@ -459,14 +519,42 @@ protected:
     }
 
     int get_bin_target(uint32_t bid) {
-        int target = 0;
-        auto iter = redirect_table.find(bid);
-        if (iter != redirect_table.end()) {
-            target = iter->second;
-        } else {
-            target = (int) (bid % (uint32_t) shuffle_size);
+        return bin_owner[bid];
+    }
+
+    void set_bin_target(uint32_t bid, int rank) {
+        int home = (int) (bid % (uint32_t) shuffle_size);
+        if (bin_owner[bid] == home && rank != home) redirected_bins += 1;
+        if (bin_owner[bid] != home && rank == home) redirected_bins -= 1;
+        bin_owner[bid] = rank;
+    }
+
+    BinCount *find_local_bin(uint32_t bid) {
+        int slot = bin_slot[bid];
+        if (slot < 0) return NULL;
+        return &local_bins[slot];
+    }
+
+    // Add the counts of a bin held here, creating it if needed
+    void add_local_bin(uint32_t bid, uint64_t kv_count, uint64_t unique_count) {
+        BinCount *bin = find_local_bin(bid);
+        if (bin == NULL) {
+            BinCount newbin = {bid, 0, 0};
+            bin_slot[bid] = (int)local_bins.size();
+            local_bins.push_back(newbin);
+            bin = &local_bins.back();
         }
-        return target;
+        bin->kv_count += kv_count;
+        bin->unique_count += unique_count;
+    }
+
+    void remove_local_bin(uint32_t bid) {
+        int slot = bin_slot[bid];
+        if (slot < 0) return;
+        local_bins[slot] = local_bins.back();
+        bin_slot[local_bins[slot].bid] = slot;
+        local_bins.pop_back();
+        bin_slot[bid] = -1;
     }
 
     uint64_t find_bins(std::map<uint32_t,int> &redirect_bins,
@@ -489,8 +577,7 @@ protected:
             //    break;
             //}
             // Ignore some bins
-            if (split_hint
-                && ignore_table.find(iter->second.first) != ignore_table.end()) {
+            if (split_hint && bin_split[iter->second.first]) {
                 iter ++;
                 continue;
             }
@@ -576,23 +663,21 @@ protected:
 
         uint64_t migrate_kv_count = 0;
 
-        auto iter = bin_table.begin();
-        while (iter != bin_table.end()) {
-            if (iter->second.first == 0) {
-                iter++;
+        for (size_t i = 0; i < local_bins.size(); i++) {
+            BinCount &bin = local_bins[i];
+            if (bin.kv_count == 0) {
                 continue;
             }
-            if (iter->second.first < redirect_count) {
+            if (bin.kv_count < redirect_count) {
                 LOG_PRINT(DBG_REPAR, "Find bin %d (%ld, %.6lf)\n",
-                          iter->first, iter->second.first,
-                          (double)iter->second.first/(double)global_kv_count);
-                redirect_bins[iter->first] = iter->second.first;
-                redirect_count -= iter->second.first;
-                migrate_kv_count += iter->second.first;
-                iter->second.first = 0;
+                          bin.bid, bin.kv_count,
+                          (double)bin.kv_count/(double)global_kv_count);
+                redirect_bins[bin.bid] = bin.kv_count;
+                redirect_count -= bin.kv_count;
+                migrate_kv_count += bin.kv_count;
+                bin.kv_count = 0;
             }
             if (redirect_count <= 0) break;
-            iter ++;
         }
 
         return migrate_kv_count;
@@ -602,8 +687,8 @@ protected:
         //gather_counts();
         bin_table_flip.clear();
         count_per_proc.clear();
-        for (auto iter : bin_table) {
-            bin_table_flip[iter.second.first] = {iter.first,iter.second.second};
+        for (auto iter : local_bins) {
+            bin_table_flip[iter.kv_count] = {iter.bid, iter.unique_count};
         }
         if (!out_combiner) {
             for (int i = 0; i < shuffle_size; i++) {
@@ -891,12 +976,14 @@ protected:
     Readable<KeyType,ValType>               *out_reader;
     Removable<KeyType,ValType>              *out_mover;
     Combinable<KeyType,ValType>             *out_combiner;
-    std::unordered_map<uint32_t, int>       redirect_table;
-    std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> bin_table;
+    std::vector<int>                        bin_owner;
+    std::vector<int>                        bin_slot;
+    std::vector<char>                       bin_split;
+    std::vector<BinCount>                   local_bins;
+    int                                     redirected_bins;
     std::map<uint64_t, std::pair<uint32_t, uint64_t>> bin_table_flip;
     std::map<int64_t,int>                   count_per_proc;
     std::unordered_set<uint32_t>            split_table;
-    std::unordered_set<uint32_t>            ignore_table;
     uint64_t                                global_kv_count;
     uint64_t                                local_kv_count;
     uint64_t                                global_unique_count;
@@ -906,6 +993,10 @@ protected:
     std::minstd_rand                       *gen;
     std::uniform_int_distribution<>        *d;
     HashBucket<>                           *h;
+    SpaceSaving                            *hot_keys;
+    BloomFilter                            *key_filter;
+    RangePartitioner<KeyType>              *range;
+    const std::vector<int>                 *target_table;
 };
 
 }
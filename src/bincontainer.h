@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
+#include <unordered_map>
 #include "container.h"
 #include "containeriter.h"
 #include "interface.h"
@@ -12,18 +14,30 @@
 
 namespace MIMIR_NS {
 
+// Size of a bin unit for records of variable length
+#define BIN_UNIT_SIZE (4 * MEMPAGE_SIZE)
+
+// A unit holds records of one bin. The units of a bin are chained from
+// the last one, which takes the new records.
 struct Bin {
     uint32_t  bintag;
     int       datasize;
     int       kvcount;
+    int       capacity;
+    int       prev;
+    char     *buffer;
 };
 
+// Records grouped by the load balancing bin of their key, so that a bin
+// redirected to another process can be shipped and dropped as a whole.
+// Units are cut from data pages; a record larger than a unit gets a
+// unit of its own.
 template <typename KeyType, typename ValType>
 class BinContainer : virtual public BaseDatabase<KeyType, ValType>
 {
   public:
-    BinContainer(uint32_t bincount, int keycount, int valcount) 
-        : BaseDatabase<KeyType, ValType>(true) 
+    BinContainer(uint32_t bincount, int keycount, int valcount)
+        : BaseObject(true), BaseDatabase<KeyType, ValType>()
     {
         this->bincount = bincount;
         this->keycount = keycount;
@@ -33,57 +47,78 @@ class BinContainer : virtual public BaseDatabase<KeyType, ValType>
 
         // Get bin size
         if (std::is_pointer<KeyType>::value || std::is_pointer<ValType>::value) {
-            bin_unit_size = MAX_RECORD_SIZE;
-            bin_per_page = (int)(DATA_PAGE_SIZE / bin_unit_size);
+            bin_unit_size = BIN_UNIT_SIZE;
         } else {
             typename SafeType<KeyType>::type key[keycount];
             typename SafeType<ValType>::type val[valcount];
             int record_size = ser->get_kv_bytes(key, val);
             bin_unit_size = (MEMPAGE_SIZE + record_size - 1) / MEMPAGE_SIZE * MEMPAGE_SIZE;
-            bin_per_page = (int)(DATA_PAGE_SIZE / bin_unit_size);
         }
+        pagesize = DATA_PAGE_SIZE;
+        if (pagesize < bin_unit_size) pagesize = bin_unit_size;
+        bin_per_page = (int)(pagesize / bin_unit_size);
+
+        bin_last.assign(bincount, -1);
 
         cur_bin_idx = 0;
         cur_bin_off = 0;
-
-        isremove = false;
-        pagesize = DATA_PAGE_SIZE;
+        ptr = NULL;
+        kvsize = 0;
 
         kvcount = 0;
+
+        LOG_PRINT(DBG_DATA, "BinContainer create (bin count=%u, unit size=%d).\n",
+                  bincount, bin_unit_size);
     }
 
-    virtual ~BinContainer() 
+    virtual ~BinContainer()
     {
         delete ser;
 
+        for (size_t i = 0; i < bins.size(); i++) {
+            if (bins[i].capacity > bin_unit_size) free_large_unit((int)i);
+        }
         for (size_t i = 0; i < pages.size(); i++) {
             BaseDatabase<KeyType, ValType>::mem_bytes -= pagesize;
             mem_aligned_free(pages[i].buffer);
         }
+
+        LOG_PRINT(DBG_DATA, "BinContainer destory.\n");
     }
 
-    virtual int open() 
+    virtual int open()
     {
         cur_bin_idx = 0;
+        cur_bin_off = 0;
+        ptr = NULL;
+        kvsize = 0;
         LOG_PRINT(DBG_DATA, "BinContainer open.\n");
         return true;
     }
 
     virtual void close()
     {
+        garbage_collection();
         LOG_PRINT(DBG_DATA, "BinContainer close (buffer size=%ld, data size=%ld).\n",
                   pages.size() * pagesize, get_data_size());
     }
 
     virtual int seek(DB_POS pos) {
-        LOG_WARNING("FileReader doesnot support seek methods!\n");
-        return false;
+        if (pos == DB_START) {
+            cur_bin_idx = 0;
+        } else if (pos == DB_END) {
+            cur_bin_idx = (int)bins.size();
+        }
+        cur_bin_off = 0;
+        ptr = NULL;
+        kvsize = 0;
+        return true;
     }
 
-    virtual int read(KeyType* key, ValType* val) 
+    virtual int read(KeyType* key, ValType* val)
     {
         // Find next bin
-        while (cur_bin_idx < (int)bins.size() 
+        while (cur_bin_idx < (int)bins.size()
                && cur_bin_off >= bins[cur_bin_idx].datasize) {
             cur_bin_idx ++;
             cur_bin_off = 0;
@@ -91,125 +126,38 @@ class BinContainer : virtual public BaseDatabase<KeyType, ValType>
 
         // At the end
         if (cur_bin_idx >= (int)bins.size()) {
-            return -1;
+            return false;
         }
 
         // Get the <key,value>
-        char *ptr = get_bin_ptr(cur_bin_idx) + cur_bin_off;
-        int kvsize = this->ser->kv_from_bytes(key, val, ptr, bin_unit_size - cur_bin_off);
-
+        ptr = bins[cur_bin_idx].buffer + cur_bin_off;
+        kvsize = this->ser->kv_from_bytes(key, val, ptr,
+                                          bins[cur_bin_idx].datasize - cur_bin_off);
         cur_bin_off += kvsize;
 
-        return 0;
+        return true;
     }
 
-    virtual int write(KeyType* key, ValType* val) 
+    virtual int write(KeyType* key, ValType* val)
     {
-        // Get bin index
         uint32_t bid = ser->get_hash_code(key) % bincount;
-
-        // Find a bin to insert the KV
-        int bidx = 0;
-        auto iter = bin_insert_idx.find(bid);
-        if (iter == bin_insert_idx.end()) {
-            bidx = get_empty_bin();
-            bins[bidx].bintag = bid;
-            bin_insert_idx[bid] = bidx;
-        } else {
-            bidx = iter->second;
-            if (bid != bins[bidx].bintag) {
-                LOG_ERROR("Bin error bid=%d, bidx=%d, bintag=%d\n",
-                          bid, bidx, bins[bidx].bintag);
-            }
-        }
-
-        // Store the <key,value>
-        char *ptr = get_bin_ptr(bidx) + bins[bidx].datasize;
-        int kvsize = this->ser->kv_to_bytes(key, val, ptr, bin_unit_size - bins[bidx].datasize);
-        if (kvsize == -1) {
-            bidx = get_empty_bin();
-            bins[bidx].bintag = bid;
-            bin_insert_idx[bid] = bidx;
-            ptr = get_bin_ptr(bidx) + bins[bidx].datasize;
-            kvsize = this->ser->kv_to_bytes(key, val, ptr, bin_unit_size - bins[bidx].datasize);
-            if (kvsize == -1)
-                LOG_ERROR("Error: KV size (%d) is larger \
-                          than bin size (%d)\n", kvsize, bin_unit_size);
-        }
-
-        bins[bidx].datasize += kvsize;
-        bins[bidx].kvcount += 1;
+        int size = ser->get_kv_bytes(key, val);
+        char *buf = get_space(bid, size);
+        ser->kv_to_bytes(key, val, buf, size);
 
         kvcount += 1;
 
-        return 1;
+        return true;
     }
 
-#if 0
-    virtual int remove(KeyType *key, ValType *val, std::set<uint32_t>& remove_bins)
-    {
-        // Find the first bin
-        if (!isremove) {
-
-            cur_bin_idx = 0;
-            cur_bin_off = 0;
-
-            // Find next bin
-            while (cur_bin_idx < (int)bins.size() ) {
-                uint32_t bintag = bins[cur_bin_idx].bintag;
-                if (bins[cur_bin_idx].datasize == 0) {
-                    cur_bin_idx ++;
-                    continue;
-                }
-                if (remove_bins.find(bintag) != remove_bins.end()) {
-                    break;
-                }
-                cur_bin_idx ++;
-            }
-
-            // At the end
-            if (cur_bin_idx >= (int)bins.size()) {
-                isremove = false;
-                return -1;
-            }
-
-            isremove = true;
-        }
-
-        if (cur_bin_off >= bins[cur_bin_idx].datasize) {
-
-            bins[cur_bin_idx].datasize = 0;
-            cur_bin_off = 0;
-
-            // Find next bin
-            while (cur_bin_idx < (int)bins.size() ) {
-                uint32_t bintag = bins[cur_bin_idx].bintag;
-                if (bins[cur_bin_idx].datasize == 0) {
-                    cur_bin_idx ++;
-                    continue;
-                }
-                if (remove_bins.find(bintag) != remove_bins.end()) {
-                    break;
-                }
-                cur_bin_idx ++;
-            }
-
-            // At the end
-            if (cur_bin_idx >= (int)bins.size()) {
-                isremove = false;
-                return -1;
-            }
-        }
-
-        char *ptr = get_bin_ptr(cur_bin_idx) + cur_bin_off;
-        int kvsize = this->ser->kv_from_bytes(key, val, ptr, bin_unit_size - cur_bin_off);
-        cur_bin_off += kvsize;
+    virtual int remove() {
+        if (ptr == NULL) return false;
 
+        slices[ptr] = kvsize;
         kvcount -= 1;
 
-        return 0;
+        return true;
     }
-#endif
 
     virtual uint64_t get_record_count() { return kvcount; }
 
@@ -221,141 +169,224 @@ class BinContainer : virtual public BaseDatabase<KeyType, ValType>
         return total_size;
     }
 
-    char *get_bin_ptr(int bin_idx) {
-        return pages[bin_idx / bin_per_page].buffer                            \
-            + (bin_idx % bin_per_page) * bin_unit_size;
-    }
+    int get_unit_size() { return bin_unit_size; }
 
-    uint64_t add_page() {
-        Page page;
-        page.datasize = 0;
-        page.buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, pagesize);
-        BaseDatabase<KeyType, ValType>::mem_bytes  += pagesize;
-        PROFILER_RECORD_COUNT(COUNTER_MAX_KV_PAGES,
-                              this->mem_bytes, OPMAX);
-        pages.push_back(page);
+    uint32_t get_bin_count() { return bincount; }
 
-        printf("%d[%d] add page=%ld\n", mimir_world_rank, mimir_world_size, pages.size());
+    // The last unit of a bin, or -1 if the bin is empty here
+    int get_bin_unit(uint32_t bid) { return bin_last[bid]; }
 
-        return pages.size() - 1;
-    }
+    // The unit written before this one in the same bin, or -1
+    int get_prev_unit(int bidx) { return bins[bidx].prev; }
+
+    // Units may move when the container grows; do not keep the pointer
+    // across writes. The record buffer itself stays in place.
+    Bin *get_unit(int bidx) { return &bins[bidx]; }
 
-    int  get_empty_bin() {
+    // Release all units of a bin, whose records have been sent away
+    void drop_bin(uint32_t bid) {
+        int bidx = bin_last[bid];
+        while (bidx != -1) {
+            int prev = bins[bidx].prev;
+            kvcount -= bins[bidx].kvcount;
+            free_unit(bidx);
+            bidx = prev;
+        }
+        bin_last[bid] = -1;
+    }
 
-        size_t idx = 0;
-        for (idx = 0; idx < bins.size(); idx++) {
-            if (bins[idx].datasize == 0) {
-                return (int)idx;
+    // Remove the records of a bin for which fn(key, val) returns true.
+    // The other records are packed in place. fn may write to this
+    // container, but not to the same bin.
+    template <typename Fn>
+    uint64_t filter_bin(uint32_t bid, Fn fn) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+        uint64_t count = 0;
+
+        std::vector<int> units;
+        for (int bidx = bin_last[bid]; bidx != -1; bidx = bins[bidx].prev)
+            units.push_back(bidx);
+
+        for (auto bidx : units) {
+            char *buf = bins[bidx].buffer;
+            int datasize = bins[bidx].datasize;
+            int src_off = 0, dst_off = 0, nkvs = 0;
+            while (src_off < datasize) {
+                int size = ser->kv_from_bytes(&key, &val, buf + src_off,
+                                              datasize - src_off);
+                if (fn(key, val)) {
+                    count += 1;
+                } else {
+                    if (src_off != dst_off) memmove(buf + dst_off, buf + src_off, size);
+                    dst_off += size;
+                    nkvs += 1;
+                }
+                src_off += size;
+            }
+            bins[bidx].datasize = dst_off;
+            bins[bidx].kvcount = nkvs;
+        }
+        kvcount -= count;
+
+        // Unlink the emptied units
+        bin_last[bid] = -1;
+        for (auto iter = units.rbegin(); iter != units.rend(); ++iter) {
+            if (bins[*iter].datasize == 0) {
+                free_unit(*iter);
+            } else {
+                bins[*iter].prev = bin_last[bid];
+                bin_last[bid] = *iter;
             }
         }
 
-        add_page();
+        return count;
+    }
 
-        Bin bin;
-        bin.bintag = 0;
-        bin.datasize = 0;
-        bin.kvcount = 0;
-        for (int i = 0; i < bin_per_page; i++) {
-            bins.push_back(bin);
+    // Save the units in the page format of KVContainer
+    void dump(const char *filename) {
+        garbage_collection();
+        FILE *fp = fopen(filename, "wb");
+        if (fp == NULL) LOG_ERROR("Open file %s error!\n", filename);
+        uint64_t kvmem = get_data_size(), npages = 0;
+        for (auto bin : bins) {
+            if (bin.datasize > 0) npages++;
         }
-
-        return (int)idx;
+        if (fwrite(&kvcount, sizeof(uint64_t), 1, fp) != 1
+            || fwrite(&kvmem, sizeof(uint64_t), 1, fp) != 1
+            || fwrite(&npages, sizeof(uint64_t), 1, fp) != 1)
+            LOG_ERROR("Write file %s error!\n", filename);
+        for (auto bin : bins) {
+            if (bin.datasize == 0) continue;
+            int64_t datasize = bin.datasize;
+            if (fwrite(&datasize, sizeof(int64_t), 1, fp) != 1
+                || fwrite(bin.buffer, 1, datasize, fp) != (size_t)datasize)
+                LOG_ERROR("Write file %s error!\n", filename);
+        }
+        fclose(fp);
     }
 
-    int get_unit_size() { return bin_unit_size; }
+protected:
 
-    virtual int remove() {
-        LOG_ERROR("This KV container doesnot support remove function!\n");
-        return false;
+    char *get_space(uint32_t bid, int size) {
+        int bidx = bin_last[bid];
+        if (bidx == -1 || bins[bidx].capacity - bins[bidx].datasize < size) {
+            bidx = add_unit(bid, size);
+        }
+        char *buf = bins[bidx].buffer + bins[bidx].datasize;
+        bins[bidx].datasize += size;
+        bins[bidx].kvcount += 1;
+        return buf;
     }
 
-    void set_bin_info(int bidx, uint32_t bintag, int datasize, int kvcount) {
-        bins[bidx].bintag = bintag;
-        bins[bidx].datasize = datasize;
-        if (bins[bidx].kvcount < kvcount) {
-            this->kvcount += (kvcount - bins[bidx].kvcount);
-        } else if (bins[bidx].kvcount > kvcount) {
-            this->kvcount -= (bins[bidx].kvcount - kvcount);
+    int add_unit(uint32_t bid, int size) {
+        int bidx = 0;
+        if (size > bin_unit_size) {
+            Bin bin;
+            bin.capacity = (size + MEMPAGE_SIZE - 1) / MEMPAGE_SIZE * MEMPAGE_SIZE;
+            bin.buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, bin.capacity);
+            BaseDatabase<KeyType, ValType>::mem_bytes += bin.capacity;
+            PROFILER_RECORD_COUNT(COUNTER_MAX_KV_PAGES,
+                                  this->mem_bytes, OPMAX);
+            bidx = (int)bins.size();
+            bins.push_back(bin);
+        } else {
+            if (empty_units.empty()) add_page();
+            bidx = empty_units.back();
+            empty_units.pop_back();
         }
-        bins[bidx].kvcount = kvcount;
+        bins[bidx].bintag = bid;
+        bins[bidx].datasize = 0;
+        bins[bidx].kvcount = 0;
+        bins[bidx].prev = bin_last[bid];
+        bin_last[bid] = bidx;
+        return bidx;
     }
 
-    virtual int get_next_bin(char *&buffer, int &datasize, uint32_t &bintag, int &kvcount)
-    {
-        //printf("cur_bin_idx=%d, size=%ld\n",
-        //       cur_bin_idx, bins.size());
-
-        //if (cur_bin_idx == 0) {
-        //    printf("%d[%d] get next bin cur_bin_idx=%d, cur_bin_off=%d\n",
-        //           mimir_world_rank, mimir_world_size, cur_bin_idx, cur_bin_off);
-        //}
-
-        if (cur_bin_idx == 0) garbage_collection();
-
-        if (cur_bin_idx < (int)bins.size() ) {
-            buffer = get_bin_ptr(cur_bin_idx);
-            bintag = bins[cur_bin_idx].bintag;
-            datasize = bins[cur_bin_idx].datasize;
-            kvcount = bins[cur_bin_idx].kvcount;
-            if (bintag == 2376) {
-                printf("%d[%d] get next bintag=%d, count=%d\n",
-                       mimir_world_rank, mimir_world_size, bintag, kvcount);
-            }
-            //kvcount -= bins[cur_bin_idx].kvcount;
-            return cur_bin_idx++;
-        }
+    void free_unit(int bidx) {
+        bins[bidx].datasize = 0;
+        bins[bidx].kvcount = 0;
+        bins[bidx].prev = -1;
+        if (bins[bidx].capacity > bin_unit_size) free_large_unit(bidx);
+        else if (bins[bidx].capacity == bin_unit_size) empty_units.push_back(bidx);
+    }
 
-        cur_bin_idx = 0;
-        cur_bin_off = 0;
-        return -1;
+    void free_large_unit(int bidx) {
+        mem_aligned_free(bins[bidx].buffer);
+        BaseDatabase<KeyType, ValType>::mem_bytes -= bins[bidx].capacity;
+        bins[bidx].buffer = NULL;
+        bins[bidx].capacity = 0;
     }
 
+    void add_page() {
+        Page page;
+        page.datasize = 0;
+        page.buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, pagesize);
+        BaseDatabase<KeyType, ValType>::mem_bytes  += pagesize;
+        PROFILER_RECORD_COUNT(COUNTER_MAX_KV_PAGES,
+                              this->mem_bytes, OPMAX);
+        pages.push_back(page);
 
-protected:
+        int first = (int)bins.size();
+        for (int i = 0; i < bin_per_page; i++) {
+            Bin bin;
+            bin.bintag = 0;
+            bin.datasize = 0;
+            bin.kvcount = 0;
+            bin.capacity = bin_unit_size;
+            bin.prev = -1;
+            bin.buffer = page.buffer + (int64_t)i * bin_unit_size;
+            bins.push_back(bin);
+        }
+        for (int i = bin_per_page - 1; i >= 0; i--) {
+            empty_units.push_back(first + i);
+        }
+    }
 
+    // Pack the records left after remove() and rebuild the bin chains
     void garbage_collection()
     {
-        if (!(this->slices.empty())) {
-
-            typename SafeType<KeyType>::ptrtype key = NULL;
-            typename SafeType<ValType>::ptrtype val = NULL;
-
-            LOG_PRINT(DBG_GEN, "KVContainer garbage collection: slices=%ld\n",
-                      this->slices.size());
-
-            for (int i = 0; i < (int)bins.size(); i++) {
-
-                int dst_off = 0, src_off = 0;
-                char *dst_buf = NULL, *src_buf = NULL;
-
-                src_buf = get_bin_ptr(i);
-                dst_buf = get_bin_ptr(i);
-
-                dst_off = src_off = 0;
-
-                while (src_off < bins[i].datasize) {
-
-                    char *tmp_buf = src_buf + src_off;
-                    auto iter = slices.find(tmp_buf);
-                    if (iter != slices.end()) {
-                        src_off += iter->second.first;
-                    }
-                    else {
-                        int kvsize = this->ser->kv_from_bytes(&key, &val, tmp_buf, bins[i].datasize - src_off);
-                        if (src_off != dst_off) {
-                            for (int kk = 0; kk < kvsize; kk++)
-                                dst_buf[dst_off + kk] = src_buf[src_off + kk];
-                        }
-                        dst_off += kvsize;
-                        src_off += kvsize;
-                    }
+        if (this->slices.empty()) return;
+
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+
+        LOG_PRINT(DBG_GEN, "BinContainer garbage collection: slices=%ld\n",
+                  this->slices.size());
+
+        for (int i = 0; i < (int)bins.size(); i++) {
+            char *buf = bins[i].buffer;
+            int src_off = 0, dst_off = 0, nkvs = 0;
+            while (src_off < bins[i].datasize) {
+                auto iter = slices.find(buf + src_off);
+                if (iter != slices.end()) {
+                    src_off += iter->second;
+                } else {
+                    int size = this->ser->kv_from_bytes(&key, &val, buf + src_off,
+                                                        bins[i].datasize - src_off);
+                    if (src_off != dst_off) memmove(buf + dst_off, buf + src_off, size);
+                    dst_off += size;
+                    src_off += size;
+                    nkvs += 1;
                 }
-                bins[i].datasize = dst_off;
             }
+            bins[i].datasize = dst_off;
+            bins[i].kvcount = nkvs;
+        }
 
-            this->slices.clear();
+        bin_last.assign(bincount, -1);
+        empty_units.clear();
+        for (int i = (int)bins.size() - 1; i >= 0; i--) {
+            if (bins[i].datasize == 0) free_unit(i);
+        }
+        for (int i = 0; i < (int)bins.size(); i++) {
+            if (bins[i].datasize == 0) continue;
+            bins[i].prev = bin_last[bins[i].bintag];
+            bin_last[bins[i].bintag] = i;
         }
-        bin_insert_idx.clear();
+
+        std::unordered_map<char*,int> empty;
+        this->slices.swap(empty);
     }
 
     int keycount, valcount;
@@ -363,17 +394,19 @@ protected:
 
     std::vector<Page> pages;
     std::vector<Bin>  bins;
+    std::vector<int>  bin_last;
+    std::vector<int>  empty_units;
     int bin_unit_size, bin_per_page;
     int cur_bin_idx, cur_bin_off;
 
-    std::unordered_map<int, uint32_t> bin_insert_idx;
+    char    *ptr;
+    int      kvsize;
 
     int64_t  pagesize;
 
     uint64_t kvcount;
-    bool     isremove;
     Serializer<KeyType, ValType> *ser;
-    std::unordered_map<char*, std::pair<int, uint32_t>> slices;
+    std::unordered_map<char*, int> slices;
 };
 
 }
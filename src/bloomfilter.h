@@ -0,0 +1,85 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_BLOOM_FILTER_H
+#define MIMIR_BLOOM_FILTER_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "log.h"
+#include "hash.h"
+#include "config.h"
+#include "memory.h"
+
+namespace MIMIR_NS {
+
+// Bloom filter of keys. The bit map of every process is merged with
+// MPI_BOR, so a key added on any process is found on all of them.
+class BloomFilter {
+  public:
+    BloomFilter(uint64_t nkeys, int bits_per_key) {
+        nwords = get_word_count(nkeys, bits_per_key);
+        nbits = nwords * 64;
+        nhash = (int)round(bits_per_key * 0.69);
+        if (nhash < 1) nhash = 1;
+        if (nhash > 16) nhash = 16;
+        bits = (uint64_t*)mem_aligned_malloc(MEMPAGE_SIZE, nwords * sizeof(uint64_t));
+        memset(bits, 0, nwords * sizeof(uint64_t));
+    }
+
+    ~BloomFilter() {
+        mem_aligned_free(bits);
+    }
+
+    static uint64_t get_word_count(uint64_t nkeys, int bits_per_key) {
+        uint64_t words = (nkeys * (uint64_t)bits_per_key + 63) / 64;
+        return words == 0 ? 1 : words;
+    }
+
+    void add(const char *key, int keysize) {
+        uint64_t h1 = hashlittle(key, keysize, 0);
+        uint64_t h2 = hashlittle(key, keysize, 0x9e3779b9) | 0x1;
+        for (int i = 0; i < nhash; i++) {
+            uint64_t bit = (h1 + (uint64_t)i * h2) % nbits;
+            bits[bit / 64] |= (0x1ULL << (bit % 64));
+        }
+    }
+
+    bool contains(const char *key, int keysize) {
+        uint64_t h1 = hashlittle(key, keysize, 0);
+        uint64_t h2 = hashlittle(key, keysize, 0x9e3779b9) | 0x1;
+        for (int i = 0; i < nhash; i++) {
+            uint64_t bit = (h1 + (uint64_t)i * h2) % nbits;
+            if (!(bits[bit / 64] & (0x1ULL << (bit % 64)))) return false;
+        }
+        return true;
+    }
+
+    void merge(MPI_Comm comm) {
+        uint64_t off = 0;
+        while (off < nwords) {
+            int count = (int)std::min(nwords - off, (uint64_t)INT32_MAX);
+            MPI_Allreduce(MPI_IN_PLACE, bits + off, count,
+                          MPI_UINT64_T, MPI_BOR, comm);
+            off += count;
+        }
+    }
+
+    uint64_t get_bytes() { return nwords * sizeof(uint64_t); }
+
+  private:
+    uint64_t *bits;
+    uint64_t  nwords, nbits;
+    int       nhash;
+};
+
+}
+
+#endif
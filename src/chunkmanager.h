@@ -12,9 +12,13 @@
 #include <mpi.h>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <random>
+#include <limits.h>
 
 #include "config.h"
 #include "globals.h"
+#include "stat.h"
 #include "inputsplit.h"
 #include "filesplitter.h"
 #include "baseshuffler.h"
@@ -52,22 +56,20 @@ class ChunkManager {
         chunk_mgr_comm = comm;
         MPI_Comm_rank(chunk_mgr_comm, &chunk_mgr_rank);
         MPI_Comm_size(chunk_mgr_comm, &chunk_mgr_size);
-        // get file list
-        InputSplit filelist;
-        if (chunk_mgr_rank == 0) {
-            for (std::vector<std::string>::const_iterator iter = input_dir.begin();
-                 iter != input_dir.end(); iter++) {
-                std::string file = *(iter);
-                filelist.add(file.c_str());
-            }
-        }
-        FileSplitter::getFileSplitter(chunk_mgr_comm)->split(&filelist, file_list, policy);
+        // get file list; only the segments of this rank are loaded
+        file_list.resize(chunk_mgr_size);
+        chunk_offs.resize(chunk_mgr_size);
+        // The splitter singleton keeps the communicator of the first
+        // context, which is freed with that context
+        FileSplitter splitter(chunk_mgr_comm);
+        splitter.split(input_dir, &file_list[chunk_mgr_rank], policy);
         file_list[chunk_mgr_rank].print();
         // get file chunk number
+        int my_chunk_num = get_chunk_num(chunk_mgr_rank);
         this->total_chunk = 0;
         this->chunk_nums = (int*)mem_aligned_malloc(MEMPAGE_SIZE, sizeof(int) * chunk_mgr_size);
+        MPI_Allgather(&my_chunk_num, 1, MPI_INT, this->chunk_nums, 1, MPI_INT, chunk_mgr_comm);
         for (int i = 0; i < chunk_mgr_size; i++) {
-            this->chunk_nums[i] = get_chunk_num(i);
             this->total_chunk += this->chunk_nums[i];
         }
         chunk_id = 0;
@@ -177,7 +179,7 @@ class ChunkManager {
         return recv_count;
     }
 
-    virtual bool acquire_chunk(Chunk& chunk) {
+    virtual bool acquire_chunk(Chunk& chunk, bool steal = true) {
         make_progress();
         if (chunk_id >= this->chunk_nums[chunk_mgr_rank]) return false;
         int my_chunk_id = chunk_id;
@@ -264,42 +266,56 @@ class ChunkManager {
         }
     }
 
+    // The segments of another rank are only needed to steal from it
+    virtual void fetch_file_list(int rank) {
+        LOG_ERROR("File list of rank %d is not available!\n", rank);
+    }
+
     bool get_chunk(Chunk &chunk, int rank, int chunk_id) {
-        int64_t total_chunk = 0;
+        if (rank != chunk_mgr_rank && chunk_offs[rank].empty()) {
+            fetch_file_list(rank);
+            get_chunk_num(rank);
+        }
         std::vector<FileSeg>& filesegs = file_list[rank].get_file_segs();
-        for (size_t i = 0; i < filesegs.size(); i++) {
-            int file_chunk = (int)ROUNDUP(filesegs[i].segsize, INPUT_BUF_SIZE);
-            if (total_chunk + file_chunk > chunk_id) {
-                chunk.fileoff = (chunk_id - total_chunk) * INPUT_BUF_SIZE 
-                    + filesegs[i].startpos;
-                if (filesegs[i].filesize - chunk.fileoff < (uint64_t)INPUT_BUF_SIZE)
-                    chunk.chunksize = filesegs[i].filesize - chunk.fileoff;
-                else
-                    chunk.chunksize = INPUT_BUF_SIZE;
-                chunk.fileseg = &filesegs[i];
-                chunk.procrank = rank;
-                chunk.localid = chunk_id;
-                LocaltoGlobal(rank, chunk_id, chunk.globalid);
-                LOG_PRINT(DBG_CHUNK, "Chunk: get chunk <%d,%d> from %d (fileoff=%ld, chunksize=%ld)\n",
-                          chunk.procrank, chunk.localid, chunk.procrank, chunk.fileoff, chunk.chunksize);
-                return true;
-            }
-            total_chunk += file_chunk;
+        std::vector<int>& offs = chunk_offs[rank];
+        // offs[i] is the first chunk of segment i
+        size_t i = std::upper_bound(offs.begin(), offs.end(), chunk_id) - offs.begin();
+        if (i > 0 && i <= filesegs.size()) {
+            i -= 1;
+            chunk.fileoff = (chunk_id - offs[i]) * INPUT_BUF_SIZE 
+                + filesegs[i].startpos;
+            if (filesegs[i].filesize - chunk.fileoff < (uint64_t)INPUT_BUF_SIZE)
+                chunk.chunksize = filesegs[i].filesize - chunk.fileoff;
+            else
+                chunk.chunksize = INPUT_BUF_SIZE;
+            chunk.fileseg = &filesegs[i];
+            chunk.procrank = rank;
+            chunk.localid = chunk_id;
+            LocaltoGlobal(rank, chunk_id, chunk.globalid);
+            LOG_PRINT(DBG_CHUNK, "Chunk: get chunk <%d,%d> from %d (fileoff=%ld, chunksize=%ld)\n",
+                      chunk.procrank, chunk.localid, chunk.procrank, chunk.fileoff, chunk.chunksize);
+            return true;
         }
-        LOG_ERROR("Cannot find chunk %d, %d, total_chunk=%ld\n", rank, chunk_id, total_chunk);
+        LOG_ERROR("Cannot find chunk %d, %d, total_chunk=%d\n", rank, chunk_id,
+                  offs.empty() ? 0 : offs.back());
         return false;
     }
 
     int get_chunk_num(int rank) {
         int total_chunk = 0;
         std::vector<FileSeg>& filesegs = file_list[rank].get_file_segs();
+        std::vector<int>& offs = chunk_offs[rank];
+        offs.clear();
         for (size_t i = 0; i < filesegs.size(); i++) {
+            offs.push_back(total_chunk);
             total_chunk += (int)ROUNDUP(filesegs[i].segsize, INPUT_BUF_SIZE);
         }
+        offs.push_back(total_chunk);
         return total_chunk;
     }
 
     std::vector<InputSplit>      file_list;
+    std::vector<std::vector<int> > chunk_offs;
     int*                         chunk_nums;
     int                          chunk_id;
     int64_t                      total_chunk;
@@ -310,38 +326,58 @@ class ChunkManager {
     int                          chunk_mgr_size;
 };
 
+// Work stealing. A process first steals from the processes of its node: the
+// progress of the node peers is read from a shared-memory window, so the
+// peer with the most chunks left is found without any RMA. The other
+// processes are then tried in random order. A steal takes up to STEAL_BATCH
+// contiguous chunks, so the borders between them stay in one process.
 template <typename KeyType, typename ValType>
 class StealChunkManager : public ChunkManager<KeyType,ValType> {
   public:
     StealChunkManager(MPI_Comm comm, std::vector<std::string> input_dir, SplitPolicy policy = BYNAME)
         : ChunkManager<KeyType,ValType>(comm, input_dir, policy) {
-        steal_off = 0;
+        steal_rank = last_rank = PROC_RANK_PENDING;
+        steal_next = steal_end = 0;
         chunk_map = (int*)mem_aligned_malloc(MEMPAGE_SIZE,
                                              sizeof(int) * this->chunk_nums[this->chunk_mgr_rank]);
         for (int i = 0; i < this->chunk_nums[this->chunk_mgr_rank]; i++)
             chunk_map[i] = PROC_RANK_PENDING;
         MPI_Win_create(&(this->chunk_id), sizeof(int), sizeof(int),
                        MPI_INFO_NULL, this->chunk_mgr_comm, &chunk_id_win);
-        MPI_Win_create(&steal_off, sizeof(int), sizeof(int),
-                       MPI_INFO_NULL, this->chunk_mgr_comm, &steal_off_win);
         MPI_Win_create(chunk_map, sizeof(int) * this->chunk_nums[this->chunk_mgr_rank], 
                        sizeof(int), MPI_INFO_NULL, this->chunk_mgr_comm, &chunk_map_win);
+        // Expose the packed segments to the ranks stealing from this one
+        this->file_list[this->chunk_mgr_rank].pack(list_buf);
+        list_size = (int64_t)list_buf.size();
+        MPI_Win_create(&list_size, sizeof(int64_t), sizeof(int64_t),
+                       MPI_INFO_NULL, this->chunk_mgr_comm, &list_size_win);
+        MPI_Win_create(&list_buf[0], list_size, 1,
+                       MPI_INFO_NULL, this->chunk_mgr_comm, &list_win);
+        init_victims();
     }
 
     virtual ~StealChunkManager() {
+        MPI_Win_unlock_all(progress_win);
+        MPI_Win_free(&progress_win);
+        MPI_Comm_free(&node_comm);
+        MPI_Win_free(&list_win);
+        MPI_Win_free(&list_size_win);
         MPI_Win_free(&chunk_map_win);
         MPI_Win_free(&chunk_id_win);
-        MPI_Win_free(&steal_off_win);
         mem_aligned_free(chunk_map);
     }
 
-    virtual bool acquire_chunk(Chunk& chunk) {
+    virtual bool acquire_chunk(Chunk& chunk, bool steal = true) {
         int one = 1, my_chunk_id = 0;
 
         this->make_progress();
 
+        // The rest of the last steal
+        if (steal_next < steal_end)
+            return get_stolen_chunk(chunk);
+
         if (this->chunk_id >= this->chunk_nums[this->chunk_mgr_rank])
-            return steal_chunk(chunk);
+            return steal ? steal_chunk(chunk) : false;
 
         MPI_Win_lock(MPI_LOCK_SHARED, this->chunk_mgr_rank, 0, chunk_id_win);
 #ifdef MPI_FETCH_AND_OP
@@ -353,9 +389,10 @@ class StealChunkManager : public ChunkManager<KeyType,ValType> {
                            this->chunk_mgr_rank, 0, 1, MPI_INT, MPI_SUM, chunk_id_win);
 #endif
         MPI_Win_unlock(this->chunk_mgr_rank, chunk_id_win);
+        set_progress(node_rank, my_chunk_id + 1);
 
         if (my_chunk_id >= this->chunk_nums[this->chunk_mgr_rank])
-            return steal_chunk(chunk);
+            return steal ? steal_chunk(chunk) : false;
 
         MPI_Win_lock(MPI_LOCK_SHARED, this->chunk_mgr_rank, 0, chunk_map_win);
         MPI_Accumulate(&(this->chunk_mgr_rank), 1, MPI_INT,
@@ -363,30 +400,39 @@ class StealChunkManager : public ChunkManager<KeyType,ValType> {
                        MPI_REPLACE, chunk_map_win);
         MPI_Win_unlock(this->chunk_mgr_rank, chunk_map_win);
 
+        last_rank = this->chunk_mgr_rank;
         return this->get_chunk(chunk, this->chunk_mgr_rank, my_chunk_id);
     }
 
+    // The chunk following the current one. After a steal it is the next
+    // chunk of the victim, which is claimed if the victim has not taken it.
     virtual bool acquire_local_chunk(Chunk& chunk, int localid) {
 
         this->make_progress();
 
-        if (this->chunk_id >= this->chunk_nums[this->chunk_mgr_rank]) {
+        if (steal_next < steal_end) {
+            if (last_rank == steal_rank && localid == steal_next)
+                return get_stolen_chunk(chunk);
             return false;
         }
 
+        int rank = last_rank;
+        if (rank == PROC_RANK_PENDING || localid >= this->chunk_nums[rank])
+            return false;
+        if (rank == this->chunk_mgr_rank && this->chunk_id >= this->chunk_nums[rank])
+            return false;
+
         int add_idx = localid + 1, ret_idx = 0;
-        MPI_Win_lock(MPI_LOCK_SHARED, this->chunk_mgr_rank, 0, chunk_id_win);
+        MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, chunk_id_win);
         MPI_Compare_and_swap(&add_idx, &localid, &ret_idx, MPI_INT,
-                             this->chunk_mgr_rank, 0, chunk_id_win);
-        MPI_Win_unlock(this->chunk_mgr_rank, chunk_id_win);
+                             rank, 0, chunk_id_win);
+        MPI_Win_unlock(rank, chunk_id_win);
         if (ret_idx == localid) {
 
-            MPI_Win_lock(MPI_LOCK_SHARED, this->chunk_mgr_rank, 0, chunk_map_win);
-            MPI_Accumulate(&(this->chunk_mgr_rank), 1, MPI_INT, this->chunk_mgr_rank,
-                           localid, 1, MPI_INT, MPI_REPLACE, chunk_map_win);
-            MPI_Win_unlock(this->chunk_mgr_rank, chunk_map_win);
+            set_chunk_map(rank, localid, 1);
+            if (node_peer[rank] >= 0) set_progress(node_peer[rank], localid + 1);
 
-            return this->get_chunk(chunk, this->chunk_mgr_rank, localid);
+            return this->get_chunk(chunk, rank, localid);
         }
 
         return false;
@@ -395,62 +441,173 @@ class StealChunkManager : public ChunkManager<KeyType,ValType> {
   protected:
 
     virtual bool steal_chunk(Chunk& chunk) {
-        int one = 1;
-        int local_chunk_id = 0;
-        if (steal_off == 0) steal_off = 1;
-        while (steal_off < this->chunk_mgr_size) {
-
-            int victim_rank = (this->chunk_mgr_rank + steal_off) % this->chunk_mgr_size;
-            int victim_steal_off = 0;
-            MPI_Win_lock(MPI_LOCK_SHARED, victim_rank, 0, steal_off_win);
-            int tmp;
-#ifdef MPI_FETCH_AND_OP
-            MPI_Fetch_and_op(&tmp, &victim_steal_off,
-                             MPI_INT, victim_rank, 0, 
-                             MPI_NO_OP, steal_off_win);
-#else
-            MPI_Get_accumulate(&tmp, 1, MPI_INT, &victim_steal_off, 1, MPI_INT,
-                               victim_rank, 0, 1, MPI_INT, MPI_NO_OP, steal_off_win);
-#endif
-            MPI_Win_unlock(victim_rank, steal_off_win);
-            LOG_PRINT(DBG_CHUNK, "Chunk: try to steal from %d (steal offset=%d)\n",
-                      victim_rank, victim_steal_off);
-            if (victim_steal_off == 0) {
-                MPI_Win_lock(MPI_LOCK_SHARED, victim_rank, 0, chunk_id_win);
-#ifdef MPI_FETCH_AND_OP
-                MPI_Fetch_and_op(&one, &local_chunk_id,
-                                 MPI_INT, victim_rank, 0,
-                                 MPI_SUM, chunk_id_win);
-#else
-                MPI_Get_accumulate(&one, 1, MPI_INT, &local_chunk_id, 1, MPI_INT,
-                                   victim_rank, 0, 1, MPI_INT, MPI_SUM, chunk_id_win);
-#endif
-                MPI_Win_unlock(victim_rank, chunk_id_win);
-
-                LOG_PRINT(DBG_CHUNK, "Chunk: try to steal from %d FOP ret=%d\n",
-                      victim_rank, local_chunk_id);
-
-                // steal success
-                if (local_chunk_id < this->chunk_nums[victim_rank]) {
-                    // write
-                    LOG_PRINT(DBG_CHUNK, "Chunk: steal chunk <%d,%d> from %d\n",
-                              victim_rank, local_chunk_id, victim_rank);
-                    MPI_Win_lock(MPI_LOCK_SHARED, victim_rank, 0, chunk_map_win);
-                    MPI_Accumulate(&(this->chunk_mgr_rank), 1, MPI_INT, victim_rank,
-                                   local_chunk_id, 1, MPI_INT, MPI_REPLACE,
-                                   chunk_map_win);
-                    MPI_Win_unlock(victim_rank, chunk_map_win);
-                    return this->get_chunk(chunk, victim_rank, local_chunk_id);
-                } else {
-                    steal_off += 1;
+        // Node peers, the one with the most chunks left first
+        while (true) {
+            int victim = -1, victim_left = 0;
+            for (int i = 0; i < node_size; i++) {
+                int rank = node_ranks[i];
+                if (rank == this->chunk_mgr_rank || exhausted[rank]) continue;
+                int left = this->chunk_nums[rank] - get_progress(i);
+                if (left <= 0) {
+                    exhausted[rank] = 1;
+                } else if (left > victim_left) {
+                    victim = rank;
+                    victim_left = left;
                 }
-            } else {
-                steal_off += victim_steal_off;
             }
+            if (victim == -1) break;
+            int count = victim_left / 2;
+            if (count > STEAL_BATCH) count = STEAL_BATCH;
+            if (count < 1) count = 1;
+            if (try_steal(victim, count)) {
+                PROFILER_RECORD_COUNT(COUNTER_STEAL_LOCAL, 1, OPSUM);
+                return get_stolen_chunk(chunk);
+            }
+        }
+
+        // Remote processes in random order; a victim is kept while it has chunks
+        while (remote_idx < remote_ranks.size()) {
+            int victim = remote_ranks[remote_idx];
+            if (try_steal(victim, STEAL_BATCH)) {
+                PROFILER_RECORD_COUNT(COUNTER_STEAL_REMOTE, 1, OPSUM);
+                return get_stolen_chunk(chunk);
+            }
+            remote_idx ++;
         }
+
         return false;
     }
 
+    // Claim up to count chunks from the front of the victim's queue
+    bool try_steal(int victim, int count) {
+        int start = 0;
+
+        PROFILER_RECORD_COUNT(COUNTER_STEAL_TRIES, 1, OPSUM);
+
+        MPI_Win_lock(MPI_LOCK_SHARED, victim, 0, chunk_id_win);
+#ifdef MPI_FETCH_AND_OP
+        MPI_Fetch_and_op(&count, &start,
+                         MPI_INT, victim, 0,
+                         MPI_SUM, chunk_id_win);
+#else
+        MPI_Get_accumulate(&count, 1, MPI_INT, &start, 1, MPI_INT,
+                           victim, 0, 1, MPI_INT, MPI_SUM, chunk_id_win);
+#endif
+        MPI_Win_unlock(victim, chunk_id_win);
+        if (node_peer[victim] >= 0) set_progress(node_peer[victim], start + count);
+
+        LOG_PRINT(DBG_CHUNK, "Chunk: try to steal %d chunks from %d FOP ret=%d\n",
+                  count, victim, start);
+
+        if (start >= this->chunk_nums[victim]) {
+            exhausted[victim] = 1;
+            return false;
+        }
+
+        int end = start + count;
+        if (end > this->chunk_nums[victim]) end = this->chunk_nums[victim];
+        set_chunk_map(victim, start, end - start);
+
+        LOG_PRINT(DBG_CHUNK, "Chunk: steal chunk <%d,%d-%d> from %d\n",
+                  victim, start, end - 1, victim);
+        PROFILER_RECORD_COUNT(COUNTER_STEAL_CHUNKS, end - start, OPSUM);
+
+        steal_rank = victim;
+        steal_next = start;
+        steal_end = end;
+        return true;
+    }
+
+    bool get_stolen_chunk(Chunk& chunk) {
+        int localid = steal_next;
+        steal_next ++;
+        last_rank = steal_rank;
+        return this->get_chunk(chunk, steal_rank, localid);
+    }
+
+    void set_chunk_map(int rank, int localid, int count) {
+        std::vector<int> workers(count, this->chunk_mgr_rank);
+        MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, chunk_map_win);
+        MPI_Accumulate(workers.data(), count, MPI_INT, rank,
+                       localid, count, MPI_INT, MPI_REPLACE,
+                       chunk_map_win);
+        MPI_Win_unlock(rank, chunk_map_win);
+    }
+
+    // The progress of a node peer is the number of its chunks claimed; it
+    // only grows and is a hint, the chunks are claimed with RMA.
+    int get_progress(int node_idx) {
+        return __atomic_load_n(progress[node_idx], __ATOMIC_RELAXED);
+    }
+
+    void set_progress(int node_idx, int value) {
+        int cur = __atomic_load_n(progress[node_idx], __ATOMIC_RELAXED);
+        while (cur < value
+               && !__atomic_compare_exchange_n(progress[node_idx], &cur, value, false,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+    }
+
+    void init_victims() {
+        MPI_Comm_split_type(this->chunk_mgr_comm, MPI_COMM_TYPE_SHARED,
+                            this->chunk_mgr_rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_size(node_comm, &node_size);
+
+        MPI_Group node_group, mgr_group;
+        std::vector<int> node_idx(node_size);
+        node_ranks.resize(node_size);
+        for (int i = 0; i < node_size; i++) node_idx[i] = i;
+        MPI_Comm_group(node_comm, &node_group);
+        MPI_Comm_group(this->chunk_mgr_comm, &mgr_group);
+        MPI_Group_translate_ranks(node_group, node_size, node_idx.data(),
+                                  mgr_group, node_ranks.data());
+        MPI_Group_free(&node_group);
+        MPI_Group_free(&mgr_group);
+
+        node_peer.assign(this->chunk_mgr_size, -1);
+        for (int i = 0; i < node_size; i++) node_peer[node_ranks[i]] = i;
+        exhausted.assign(this->chunk_mgr_size, 0);
+
+        int *base = NULL;
+        MPI_Win_allocate_shared(sizeof(int), sizeof(int), MPI_INFO_NULL,
+                                node_comm, &base, &progress_win);
+        *base = 0;
+        progress.resize(node_size);
+        for (int i = 0; i < node_size; i++) {
+            MPI_Aint size;
+            int disp_unit;
+            MPI_Win_shared_query(progress_win, i, &size, &disp_unit, &(progress[i]));
+        }
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, progress_win);
+        MPI_Barrier(node_comm);
+
+        for (int i = 0; i < this->chunk_mgr_size; i++)
+            if (node_peer[i] < 0) remote_ranks.push_back(i);
+        std::mt19937 gen(this->chunk_mgr_rank);
+        std::shuffle(remote_ranks.begin(), remote_ranks.end(), gen);
+        remote_idx = 0;
+    }
+
+    virtual void fetch_file_list(int rank) {
+        int64_t size = 0;
+        MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, list_size_win);
+        MPI_Get(&size, 1, MPI_INT64_T, rank, 0, 1, MPI_INT64_T, list_size_win);
+        MPI_Win_unlock(rank, list_size_win);
+
+        if (size > (int64_t)INT_MAX)
+            LOG_ERROR("File list of rank %d is too large (%ld)!\n", rank, size);
+
+        std::string buf(size, '\0');
+        MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, list_win);
+        MPI_Get(&buf[0], (int)size, MPI_BYTE, rank, 0, (int)size, MPI_BYTE, list_win);
+        MPI_Win_unlock(rank, list_win);
+
+        this->file_list[rank].unpack(buf.data(), size);
+
+        LOG_PRINT(DBG_CHUNK, "Chunk: fetch file list of %d (segments=%ld)\n",
+                  rank, this->file_list[rank].get_file_count());
+    }
+
     virtual int prev_chunk_worker(Chunk &chunk) {
         return get_chunk_worker(chunk.globalid - 1);
     }
@@ -491,11 +648,27 @@ class StealChunkManager : public ChunkManager<KeyType,ValType> {
     }
 
   private:
-    int        steal_off;
+    int        steal_rank;
+    int        steal_next;
+    int        steal_end;
+    int        last_rank;
     int*       chunk_map;
     MPI_Win    chunk_id_win;
-    MPI_Win    steal_off_win;
     MPI_Win    chunk_map_win;
+    MPI_Comm   node_comm;
+    int        node_rank;
+    int        node_size;
+    std::vector<int> node_ranks;
+    std::vector<int> node_peer;
+    std::vector<int*> progress;
+    MPI_Win    progress_win;
+    std::vector<int> remote_ranks;
+    size_t     remote_idx;
+    std::vector<char> exhausted;
+    std::string list_buf;
+    int64_t    list_size;
+    MPI_Win    list_size_win;
+    MPI_Win    list_win;
 };
 
 }
@@ -119,6 +119,8 @@ public:
 
     virtual int write(KeyType *key, ValType *val)
     {
+        if (this->is_filtered(key)) return true;
+
         int target = this->get_target_rank(key, val);
 
         if (target == this->shuffle_rank) {
@@ -241,13 +243,11 @@ public:
         this->compute_redirect_bins(redirect_bins, bin_counts);
 
         for (auto iter : redirect_bins) {
-            auto iter1 = this->bin_table.find(iter.first);
-            if (iter1 != this->bin_table.end()) {
-                this->local_kv_count -= iter1->second.first;
-                this->local_unique_count -= iter1->second.second;
-                this->bin_table.erase(iter1);
-                //iter1->second.first = 0;
-                //iter1->second.second = 0;
+            BinCount *bin = this->find_local_bin(iter.first);
+            if (bin != NULL) {
+                this->local_kv_count -= bin->kv_count;
+                this->local_unique_count -= bin->unique_count;
+                this->remove_local_bin(iter.first);
             } else {
                 LOG_ERROR("Error!\n");
             }
@@ -302,76 +302,36 @@ public:
             if (rankid == this->shuffle_rank) {
                 this->local_kv_count += kvcount;
                 this->local_unique_count += ucount;
-                auto iter = this->bin_table.find(binid);
-                if (iter != this->bin_table.end()) {
-                    iter->second.first += kvcount;
-                    iter->second.second += ucount;
-                } else {
-                    this->bin_table[binid] = {kvcount,ucount};
-                }
+                this->add_local_bin(binid, kvcount, ucount);
             }
-            this->redirect_table[binid] = rankid;
+            this->set_bin_target(binid, rankid);
         }
 
         PROFILER_RECORD_COUNT(COUNTER_REDIRECT_BINS,
-                              this->redirect_table.size(), OPMAX);
+                              (uint64_t)this->redirected_bins, OPMAX);
         PROFILER_RECORD_COUNT(COUNTER_BALANCE_TIMES, 1, OPSUM);
         LOG_PRINT(DBG_GEN, "shuffle index=%d: load balance end\n", this->shuffle_times);
      }
 
+     // The heavy keys come from the sketch of the records written here
      void split_keys() {
 
-        std::unordered_set<uint32_t> suspect_table;
-        auto iter = this->bin_table_flip.rbegin();
-        while (iter != this->bin_table_flip.rend()) {
-            if (iter->second.first == std::numeric_limits<uint32_t>::max()) {
-                iter ++;
-                continue;
-            }
-            if (iter->first * this->shuffle_size > this->global_kv_count) {
-                suspect_table.insert(iter->second.first);
-                LOG_PRINT(DBG_REPAR, "Find split suspect bid=%u (%ld,%lf)\n",
-                          iter->second.first, iter->first,
-                          (double)iter->first / (double)(this->global_kv_count));
-            } else {
-                break;
-            }
-            iter ++;
-        }
-
         std::unordered_set<uint32_t> local_split_table;
-        std::unordered_map<uint32_t, uint64_t> suspect_stat;
-        if (suspect_table.size() != 0) {
-            typename SafeType<KeyType>::type key[this->keycount];
-            typename SafeType<ValType>::type val[this->valcount];
-
-            this->out->seek(DB_START);
-            while(this->out_reader->read(key,val) == true) {
-                uint32_t hid = this->ser->get_hash_code(key);
-                uint32_t bid = hid % (uint32_t) (this->shuffle_size * BIN_COUNT);
-
-                // Gather stat of suspect
-                if (suspect_table.find(bid) != suspect_table.end()) {
-                    if (suspect_stat.find(hid) != suspect_stat.end()) {
-                        suspect_stat[hid] += 1;
-                    } else {
-                        suspect_stat[hid] = 0;
-                    }
+        const std::vector<SpaceSaving::Counter> &counters
+            = this->hot_keys->get_counters();
+        for (size_t i = 0; i < counters.size(); i++) {
+            uint64_t count = counters[i].count - counters[i].error;
+            if ((double)count * this->shuffle_size >
+                (double)(this->global_kv_count) * 0.8) {
+                uint32_t hid = counters[i].item;
+                uint32_t bid = hid % (uint32_t)(this->shuffle_size * BIN_COUNT);
+                if (this->split_table.find(hid) == this->split_table.end())
+                {
+                    LOG_PRINT(DBG_REPAR, "Find split key hid=%u, bid=%u (%ld)\n",
+                              hid, bid, count);
+                    local_split_table.insert(hid);
                 }
             }
-            for (auto iter : suspect_stat) {
-                if ((double)iter.second * this->shuffle_size > 
-                    (double)(this->global_kv_count) * 0.8) {
-                    uint32_t hid = iter.first;
-                    uint32_t bid = hid % (uint32_t)(this->shuffle_size * BIN_COUNT);
-                    if (this->split_table.find(hid) == this->split_table.end())
-                    {
-                        LOG_PRINT(DBG_REPAR, "Find split key hid=%u, bid=%u\n", hid, bid);
-                        local_split_table.insert(hid);
-                    }
-                }
-            }
-
         }
 
         int sendcount, recvcount;
@@ -401,11 +361,9 @@ public:
                 uint32_t hid = recvbuf[idx];
                 uint32_t bid = hid % (uint32_t) (this->shuffle_size * BIN_COUNT);
                 this->split_table.insert(hid);
-                this->ignore_table.insert(bid);
+                this->bin_split[bid] = 1;
                 PROFILER_RECORD_COUNT(COUNTER_SPLIT_KEYS, this->split_table.size(), OPMAX);
-                if (this->bin_table.find(bid) == this->bin_table.end()) {
-                    this->bin_table.insert({bid, {0,0}});
-                }
+                this->add_local_bin(bid, 0, 0);
             }
         }
     }
@@ -417,10 +375,10 @@ public:
     }
 
     virtual void migrate_kvs() {
-        if (this->redirect_table.size() == 0) return;
+        if (this->redirected_bins == 0) return;
 
-        printf("%d[%d] migrate start peakmem=%ld\n",
-               this->shuffle_rank, this->shuffle_size, peakmem);
+        LOG_PRINT(DBG_GEN, "%d[%d] migrate start peakmem=%ld\n",
+                  this->shuffle_rank, this->shuffle_size, peakmem);
 
         PROFILER_RECORD_TIME_START;
 
@@ -429,6 +387,107 @@ public:
 
         LOG_PRINT(DBG_GEN, "migrate kvs start\n");
 
+        BinContainer<KeyType,ValType> *bins
+            = dynamic_cast<BinContainer<KeyType,ValType>*>(this->out);
+        if (bins != NULL) migrate_bins(bins);
+        else migrate_records();
+
+        // The keys of the bins moved out are no longer here
+        if (this->split_hint) {
+            int rank = this->shuffle_rank, size = this->shuffle_size;
+            std::vector<int> &owner = this->bin_owner;
+            this->hot_keys->remove_if([&](uint32_t hid) {
+                uint32_t bid = hid % (uint32_t)(size * BIN_COUNT);
+                return owner[bid] != rank;
+            });
+        }
+        PROFILER_RECORD_TIME_END(TIMER_LB_MIGRATE);
+
+        LOG_PRINT(DBG_GEN, "%d[%d] migrate end peakmem=%ld\n",
+                  this->shuffle_rank, this->shuffle_size, peakmem);
+
+        this->ismigrate = false;
+
+        LOG_PRINT(DBG_GEN, "migrate kvs end\n");
+    }
+
+protected:
+
+    // Ship the bins owned by other processes unit by unit and release
+    // them in place. The records received are written to their bins
+    // directly.
+    void migrate_bins(BinContainer<KeyType,ValType> *bins) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+        uint32_t bincount = (uint32_t)(this->shuffle_size * BIN_COUNT);
+
+        if (bins->get_bin_count() != bincount)
+            LOG_ERROR("Error: bin count of the container (%u) is not %u!\n",
+                      bins->get_bin_count(), bincount);
+
+        // Pack the records removed before
+        bins->close();
+        bins->open();
+
+        for (uint32_t bid = 0; bid < bincount; bid++) {
+            int target = this->bin_owner[bid];
+            if (target == this->shuffle_rank || bins->get_bin_unit(bid) == -1)
+                continue;
+            // The split keys of the bin stay here
+            if (this->split_hint && this->bin_split[bid]) {
+                uint64_t count = bins->filter_bin(bid, [&](KeyType *k, ValType *v) {
+                    if (this->split_table.find(this->ser->get_hash_code(k))
+                        != this->split_table.end())
+                        return false;
+                    this->write(k, v);
+                    return true;
+                });
+                PROFILER_RECORD_COUNT(COUNTER_MIGRATE_KVS, count, OPSUM);
+                continue;
+            }
+            for (int bidx = bins->get_bin_unit(bid); bidx != -1;
+                 bidx = bins->get_prev_unit(bidx)) {
+                Bin *unit = bins->get_unit(bidx);
+                char *buf = unit->buffer;
+                int datasize = unit->datasize, kvcount = unit->kvcount;
+                // A record that does not fit the send buffer is cut at
+                // the last whole record
+                int off = 0;
+                while (off < datasize) {
+                    int room = (int)buf_size - send_offset[target];
+                    int len = datasize - off;
+                    if (len > room) {
+                        len = 0;
+                        while (off + len < datasize) {
+                            int kvsize = this->ser->kv_from_bytes(&key, &val,
+                                            buf + off + len, datasize - off - len);
+                            if (len + kvsize > room) break;
+                            len += kvsize;
+                        }
+                    }
+                    if (len == 0) {
+                        if (send_offset[target] == 0)
+                            LOG_ERROR("Error: KV is larger than buf_size (%ld)\n",
+                                      buf_size);
+                        exchange_kv();
+                        continue;
+                    }
+                    memcpy(send_buffer + target * (int64_t)buf_size + send_offset[target],
+                           buf + off, len);
+                    send_offset[target] += len;
+                    off += len;
+                }
+                this->kvcount += kvcount;
+                PROFILER_RECORD_COUNT(COUNTER_MIGRATE_KVS, kvcount, OPSUM);
+            }
+            bins->drop_bin(bid);
+        }
+        this->wait();
+    }
+
+    // Send the redirected records through a temporary container and
+    // copy the rest back
+    void migrate_records() {
         BaseDatabase<KeyType,ValType> *kv = get_tmp_db();
         // Change output DB
         Writable<KeyType,ValType>* tmp_out = this->out;
@@ -443,9 +502,7 @@ public:
             while(this->out_reader->read(key,val) == true) {
                 uint32_t hid = this->ser->get_hash_code(key);
                 uint32_t bid = hid % (uint32_t) (this->shuffle_size * BIN_COUNT);
-                auto iter = this->redirect_table.find(bid);
-                if (iter != this->redirect_table.end()
-                    && iter->second != this->shuffle_rank) {
+                if (this->bin_owner[bid] != this->shuffle_rank) {
                     PROFILER_RECORD_COUNT(COUNTER_MIGRATE_KVS, 1, OPSUM);
                     this->write(key, val);
                     this->out_mover->remove();
@@ -455,9 +512,7 @@ public:
             while(this->out_reader->read(key,val) == true) {
                 uint32_t hid = this->ser->get_hash_code(key);
                 uint32_t bid = hid % (uint32_t) (this->shuffle_size * BIN_COUNT);
-                auto iter = this->redirect_table.find(bid);
-                if (iter != this->redirect_table.end()
-                    && iter->second != this->shuffle_rank) {
+                if (this->bin_owner[bid] != this->shuffle_rank) {
                     if (this->split_table.find(hid) == this->split_table.end()) {
                         PROFILER_RECORD_COUNT(COUNTER_MIGRATE_KVS, 1, OPSUM);
                         this->write(key, val);
@@ -478,18 +533,8 @@ public:
         }
         kv->close();
         delete kv;
-        PROFILER_RECORD_TIME_END(TIMER_LB_MIGRATE);
-
-        printf("%d[%d] migrate end peakmem=%ld\n",
-               this->shuffle_rank, this->shuffle_size, peakmem);
-
-        this->ismigrate = false;
-
-        LOG_PRINT(DBG_GEN, "migrate kvs end\n");
     }
 
-protected:
-
     void wait()
     {
         LOG_PRINT(DBG_COMM, "Comm: start wait.\n");
@@ -514,10 +559,8 @@ protected:
             exchange_kv();
         } while (this->done_count < this->shuffle_size);
 
-        auto iter = this->bin_table.begin();
-        while (iter != this->bin_table.end()) {
-            PROFILER_RECORD_COUNT(COUNTER_MAX_BIN_SIZE, iter->second.first, OPMAX);
-            iter ++;
+        for (auto iter : this->local_bins) {
+            PROFILER_RECORD_COUNT(COUNTER_MAX_BIN_SIZE, iter.kv_count, OPMAX);
         }
 
         TRACKER_RECORD_EVENT(EVENT_SYN_COMM);
@@ -541,6 +584,9 @@ protected:
                 if (BALANCE_LOAD && !(this->user_hash) && !(this->ismigrate)) {
                     this->record_bin_info(key, ret);
                 }
+                if (this->ismigrate && this->split_hint) {
+                    this->hot_keys->add(this->ser->get_hash_code(key));
+                }
                 src_buf += kvsize;
                 count += kvsize;
             }
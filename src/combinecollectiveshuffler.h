@@ -13,6 +13,11 @@
 #include "container.h"
 #include "collectiveshuffler.h"
 
+// While the combiner is bypassed, keys whose hash has the top
+// COMBINE_SAMPLE_BITS bits clear still go through it to sample the hit ratio
+#define COMBINE_SAMPLE_BITS   4
+#define COMBINE_MIN_PROBES 1024
+
 namespace MIMIR_NS {
 
 template <typename KeyType, typename ValType>
@@ -37,6 +42,8 @@ public:
         this->user_combine = user_combine;
         this->user_ptr = user_ptr;
         bucket = NULL;
+        bypass = false;
+        probe_count = hit_count = 0;
     }
 
     virtual ~CombineCollectiveShuffler () {
@@ -47,6 +54,8 @@ public:
 
         CollectiveShuffler<KeyType,ValType>::open();
         bucket = new HashBucket<CombinerVal>();
+        bypass = false;
+        probe_count = hit_count = 0;
 
         LOG_PRINT(DBG_GEN, "CombineCollectiveShuffler open!\n");
         return 0;
@@ -65,6 +74,8 @@ public:
 
     virtual int write(KeyType *key, ValType *val)
     {
+        if (this->is_filtered(key)) return true;
+
         int target = this->get_target_rank(key, val);
 
         if (target == this->shuffle_rank) {
@@ -89,10 +100,28 @@ public:
             LOG_ERROR("Error: KV size (%d) is larger than buf_size (%ld)\n", 
                       kvsize, this->buf_size);
 
+        // Few keys combine, append the KV as CollectiveShuffler does
+        if (bypass && (this->ser->get_hash_code(key) >> (32 - COMBINE_SAMPLE_BITS)) != 0) {
+            if ((int64_t)this->send_offset[target] + (int64_t) kvsize > this->buf_size) {
+                end_round();
+                this->exchange_kv();
+                target = this->get_target_rank(key, val);
+            }
+            char *gbuf = this->send_buffer + target * (int64_t)this->buf_size + this->send_offset[target];
+            this->ser->kv_to_bytes(key, val, gbuf, kvsize);
+            this->send_offset[target] += kvsize;
+            this->kvcount ++;
+            PROFILER_RECORD_COUNT(COUNTER_BYPASS_KVS, 1, OPSUM);
+            return 0;
+        }
+
         int keysize = this->ser->get_key_bytes(key);
         char *keyptr = this->ser->get_key_ptr(key);
         u = bucket->findEntry(keyptr, keysize);
 
+        probe_count ++;
+        if (u != NULL) hit_count ++;
+
         if (u == NULL) {
             CombinerVal tmp;
 
@@ -119,7 +148,7 @@ public:
 
             if (iter == slices.end()) {
                 if ((int64_t)this->send_offset[target] + (int64_t) kvsize > this->buf_size) {
-                    garbage_collection();
+                    end_round();
                     this->exchange_kv();
                     target = this->get_target_rank(key, val);
                 }
@@ -155,7 +184,7 @@ public:
             else {
                 slices.insert(std::make_pair(u->kv, ukvsize));
                 if ((int64_t)this->send_offset[target] + (int64_t) (ukeysize + rvalsize) > this->buf_size) {
-                    garbage_collection();
+                    end_round();
                     this->exchange_kv();
                     target = this->get_target_rank(key, val);
                 }
@@ -221,11 +250,31 @@ public:
 #endif
 
     virtual void make_progress(bool issue_new = false) {
-        garbage_collection();
+        end_round();
         this->exchange_kv(); 
     }
 
 private:
+    // Collect the send buffer before an exchange, and decide from the hit
+    // ratio of the round whether the next one bypasses the combiner
+    void end_round()
+    {
+        garbage_collection();
+
+        if (COMBINE_BYPASS <= 0.0 || probe_count < COMBINE_MIN_PROBES) return;
+
+        double ratio = (double) hit_count / (double) probe_count;
+        // Resume at twice the threshold so that the mode does not flap
+        bool flag = bypass ? (ratio < 2 * COMBINE_BYPASS) : (ratio < COMBINE_BYPASS);
+        if (flag != bypass) {
+            LOG_PRINT(DBG_GEN, "CombineCollectiveShuffler %s the combiner (hit ratio=%.3lf)\n",
+                      flag ? "bypass" : "resume", ratio);
+            PROFILER_RECORD_COUNT(COUNTER_COMBINE_SWITCHES, 1, OPSUM);
+            bypass = flag;
+        }
+        probe_count = hit_count = 0;
+    }
+
     void garbage_collection()
     {
         if (!slices.empty()) {
@@ -274,6 +323,8 @@ private:
     std::unordered_map<char*, int> slices;
     HashBucket<CombinerVal> *bucket;
     CombinerVal *u;
+    bool bypass;
+    uint64_t probe_count, hit_count;
 };
 
 }
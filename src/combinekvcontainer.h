@@ -44,6 +44,11 @@ public:
 
         bucket = new HashBucket<CombinerVal>(hashscale, false, true);
 
+        // The records already here are not indexed by the new bucket
+        unindexed_size.resize(this->pages.size());
+        for (size_t i = 0; i < this->pages.size(); i++)
+            unindexed_size[i] = this->pages[i].datasize;
+
         KVContainer<KeyType,ValType>::open();
 
         LOG_PRINT(DBG_GEN, "CombineKVContainer open!\n");
@@ -57,6 +62,7 @@ public:
         bucket->clear();
 
         delete bucket;
+        unindexed_size.clear();
 
         KVContainer<KeyType,ValType>::close();
 
@@ -78,7 +84,8 @@ public:
         if (u == NULL) {
             CombinerVal tmp;
 
-            if (!(this->ispointer)) {
+            // Slices may lie among the records that are not indexed
+            if (!(this->ispointer) && unindexed_size.empty()) {
                 std::unordered_map < char *, int >::iterator iter;
                 for (iter = this->slices.begin(); iter != this->slices.end(); iter++) {
                     char *sbuf = iter->first;
@@ -191,8 +198,9 @@ public:
 
         this->ser->kv_from_bytes(&key, &val, this->ptr, this->kvsize);
 
+        bool indexed = is_indexed(this->pageid, this->ptr - this->pages[this->pageid].buffer);
         int ret = KVContainer<KeyType, ValType>::remove();
-        if (ret) {
+        if (ret && indexed) {
             int keysize = this->ser->get_key_bytes(key);
             char *keyptr = this->ser->get_key_ptr(key);
             bucket->removeEntry(keyptr, keysize);
@@ -246,10 +254,12 @@ public:
                                 dst_off = 0;
                             }
                             // Update key entry
-                            int keysize = this->ser->get_key_bytes(key);
-                            char *keyptr = this->ser->get_key_ptr(key);
-                            u = bucket->updateEntry(keyptr, keysize, dst_page->buffer + dst_off);
-                            u->kv = dst_page->buffer + dst_off;
+                            if (is_indexed(src_pid - 1, src_off)) {
+                                int keysize = this->ser->get_key_bytes(key);
+                                char *keyptr = this->ser->get_key_ptr(key);
+                                u = bucket->updateEntry(keyptr, keysize, dst_page->buffer + dst_off);
+                                u->kv = dst_page->buffer + dst_off;
+                            }
                             for (int kk = 0; kk < kvsize; kk++) {
                                 dst_page->buffer[dst_off + kk] = src_page->buffer[src_off + kk];
                             }
@@ -279,12 +289,18 @@ public:
     }
 
 private:
+    bool is_indexed(size_t pid, int64_t off) {
+        return pid >= unindexed_size.size() || off >= unindexed_size[pid];
+    }
+
     void (*user_combine)(Combinable<KeyType,ValType> *output,
                          KeyType *key, ValType *val1, ValType *val2, ValType *val3, void *ptr);
     void *user_ptr;
     HashBucket<CombinerVal> *bucket;
     int hashscale;
     CombinerVal *u;
+    // Bytes of each page written before the last open()
+    std::vector<int64_t> unindexed_size;
 };
 
 }
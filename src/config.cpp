@@ -13,6 +13,8 @@ int64_t DATA_PAGE_SIZE = 64 * 1024 * 1024;
 int64_t INPUT_BUF_SIZE = 64 * 1024 * 1024;
 int BUCKET_COUNT = 1024 * 1024;
 int MAX_RECORD_SIZE = 1024 * 1024;
+int64_t OUTPUT_BLOCK_SIZE = 4 * 1024 * 1024;
+int64_t WRITE_STRIPE_SIZE = 1024 * 1024;
 
 // Settings
 int SHUFFLE_TYPE = 0;
@@ -23,15 +25,30 @@ int READ_TYPE = 0;
 int WRITE_TYPE = 0;
 int DIRECT_READ = 0;
 int DIRECT_WRITE = 0;
+int READ_PREFETCH = 0;
+int WRITE_BEHIND = 0;
+int WRITE_AGGREGATORS = 1;
+int BLOCK_CHECKSUM = 0;
+int GROUP_TYPE = 0;
+int64_t GROUP_RUN_SIZE = 512 * 1024 * 1024;
 
 // Features
 int WORK_STEAL = 0;
 int MAKE_PROGRESS = 0;
+int STEAL_BATCH = 4;
 int BIN_COUNT = 1000;
 int BALANCE_LOAD = 0;
 double BALANCE_FACTOR = 1.5;
 int BALANCE_FREQ = 1;
+int REDUCE_BALANCE = 0;
+double COMBINE_BYPASS = 0.05;
 int USE_MCDRAM = 0;
+int INPUT_CACHE = 0;
+const char *CACHE_DIR = "/tmp";
+int64_t JOIN_BCAST_SIZE = 16 * 1024 * 1024;
+double JOIN_SPLIT_RATIO = 0.5;
+int JOIN_BLOOM_BITS = 8;
+int SORT_SAMPLES = 1024;
 
 // Profile & Debug
 int DBG_LEVEL = 0;
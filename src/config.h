@@ -20,6 +20,8 @@ extern int64_t DATA_PAGE_SIZE;
 extern int64_t INPUT_BUF_SIZE;
 extern int BUCKET_COUNT;
 extern int MAX_RECORD_SIZE;
+extern int64_t OUTPUT_BLOCK_SIZE;
+extern int64_t WRITE_STRIPE_SIZE;
 
 // Settings
 extern int SHUFFLE_TYPE;
@@ -30,15 +32,30 @@ extern int READ_TYPE;
 extern int WRITE_TYPE;
 extern int DIRECT_READ;
 extern int DIRECT_WRITE;
+extern int READ_PREFETCH;
+extern int WRITE_BEHIND;
+extern int WRITE_AGGREGATORS;
+extern int BLOCK_CHECKSUM;
+extern int GROUP_TYPE;
+extern int64_t GROUP_RUN_SIZE;
 
 // Features
 extern int WORK_STEAL;
 extern int MAKE_PROGRESS;
+extern int STEAL_BATCH;
 extern int BALANCE_LOAD;
 extern int BIN_COUNT;
 extern double BALANCE_FACTOR;
 extern int BALANCE_FREQ;
+extern int REDUCE_BALANCE;
+extern double COMBINE_BYPASS;
 extern int USE_MCDRAM;
+extern int INPUT_CACHE;
+extern const char *CACHE_DIR;
+extern int64_t JOIN_BCAST_SIZE;
+extern double JOIN_SPLIT_RATIO;
+extern int JOIN_BLOOM_BITS;
+extern int SORT_SAMPLES;
 
 // Profile & Debug
 extern int OUTPUT_STAT;
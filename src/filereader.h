@@ -13,7 +13,18 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <errno.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
 #include "log.h"
 #include "stat.h"
 #include "config.h"
@@ -24,17 +35,50 @@
 #include "baseshuffler.h"
 //#include "dataformat.h"
 #include "fileparser.h"
+#include "asyncio.h"
+#include "indexfile.h"
+#include "hash.h"
 
 namespace MIMIR_NS {
 
 class InputSplit;
 
-enum InputFileFormat {TextFileFormat};
+enum InputFileFormat {TextFileFormat, BinaryFileFormat, IndexedFileFormat};
+
+enum PrefetchState {SlotFree, SlotIssued, SlotReady, SlotError};
+
+#define MAX_AIO_EVENTS  64
 
+// Input buffer of the prefetch ring. The chunk is read to buffer + head room,
+// so the partial record of the previous chunk can be copied in front of it.
+struct PrefetchSlot {
+    Chunk             chunk;
+    char             *buffer;
+    uint64_t          read_bytes;
+    int               error;
+    std::atomic<int>  state;
+    std::string       filename;
+    int               posix_fd;
+    MPI_File          mpi_fp;
+    MPI_Request       mpi_req;
+};
+
+// Interface of the readers of all file formats
+template <typename KeyType, typename ValType,
+         typename InKeyType = char*, typename InValType = void>
+class BaseFileReader : public Readable<InKeyType, InValType> {
+  public:
+    virtual ~BaseFileReader() {}
+    virtual void set_shuffler(BaseShuffler<KeyType,ValType> *shuffler) = 0;
+};
+
+// TextFileFormat: one line per record, the key is the line.
+// BinaryFileFormat: records serialized by FileWriter (BINARY_FORMAT); a file
+// is read by one process only, so no record crosses a process border.
 template <InputFileFormat FileFormat,
          typename KeyType, typename ValType,
          typename InKeyType = char*, typename InValType = void>
-class FileReader : public Readable<InKeyType, InValType> {
+class FileReader : public BaseFileReader<KeyType, ValType, InKeyType, InValType> {
   public:
 
     static FileReader<FileFormat,KeyType,ValType,InKeyType,InValType> 
@@ -67,6 +111,14 @@ class FileReader : public Readable<InKeyType, InValType> {
 
         record_count = 0;
 
+        prefetch_depth = READ_PREFETCH;
+        prefetch_slots = NULL;
+        prefetch_head = 0;
+        prefetch_local_done = false;
+        prefetch_stop = false;
+        prefetch_time = 0.0;
+        cur_slot = NULL;
+
         ser = new Serializer<InKeyType, InValType>(inkeycount, invalcount);
     }
 
@@ -96,14 +148,34 @@ class FileReader : public Readable<InKeyType, InValType> {
 
         PROFILER_RECORD_COUNT(COUNTER_MAX_FILE, (uint64_t) bufsize, OPMAX);
 
-        buffer =  (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize + MAX_RECORD_SIZE + 1, MCDRAM_ALLOCATE);
-
         state.cur_chunk.fileseg = NULL;
         state.start_pos = 0;
         state.win_size = 0;
         state.has_tail = false;
 
         file_init();
+
+        if (prefetch_depth > 0) {
+            prefetch_head = ROUNDUP(MAX_RECORD_SIZE, MEMPAGE_SIZE) * MEMPAGE_SIZE;
+            prefetch_slots = new PrefetchSlot[prefetch_depth + 1];
+            for (int i = 0; i < prefetch_depth + 1; i++) {
+                prefetch_slots[i].buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE,
+                    prefetch_head + bufsize + MAX_RECORD_SIZE + 1, MCDRAM_ALLOCATE);
+                prefetch_slots[i].state = SlotFree;
+                prefetch_slots[i].posix_fd = -1;
+                prefetch_slots[i].mpi_fp = MPI_FILE_NULL;
+                prefetch_slots[i].mpi_req = MPI_REQUEST_NULL;
+            }
+            buffer = NULL;
+            cur_slot = NULL;
+            prefetch_local_done = false;
+            prefetch_time = 0.0;
+            prefetch_init();
+            prefetch_fill();
+        } else {
+            buffer =  (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize + MAX_RECORD_SIZE + 1, MCDRAM_ALLOCATE);
+        }
+
         read_next_chunk();
 
         record_count = 0;
@@ -114,7 +186,18 @@ class FileReader : public Readable<InKeyType, InValType> {
         file_close();
         file_uninit();
 
-        mem_aligned_free(buffer);
+        if (prefetch_depth > 0) {
+            prefetch_uninit();
+            for (int i = 0; i < prefetch_depth + 1; i++)
+                mem_aligned_free(prefetch_slots[i].buffer);
+            delete [] prefetch_slots;
+            prefetch_slots = NULL;
+            prefetch_queue.clear();
+            cur_slot = NULL;
+        } else {
+            mem_aligned_free(buffer);
+        }
+        buffer = NULL;
 
         LOG_PRINT(DBG_IO, "Filereader close.\n");
     }
@@ -142,12 +225,12 @@ class FileReader : public Readable<InKeyType, InValType> {
             //ptr = buffer + state.start_pos;
             //record->set_buffer(ptr);
             bool islast = is_last_block();
-            if (state.win_size > 0
-                && parser.to_line(ptr, (int)state.win_size, islast) != -1) {
-                //&& record->get_next_record_size(ptr, state.win_size, islast) != -1) {
+            int move_count = -1;
+            if (state.win_size > 0)
+                move_count = next_record(ptr, islast, key, val);
+            if (move_count != -1) {
                 //int move_count = record->get_record_size();
                 //*key = (InKeyType)ptr;
-                int move_count = ser->key_from_bytes(key, ptr, (int)state.win_size);
                 //int move_count = strlen((const char*)(*key)) + 1;
                 //int move_count = ser->get_key_bytes(key);
                 if ((uint64_t)move_count >= state.win_size) {
@@ -176,6 +259,27 @@ class FileReader : public Readable<InKeyType, InValType> {
 
   protected:
 
+    // Decode the record at the window start, return its size or -1 if the
+    // window does not hold a complete record.
+    int next_record(char *ptr, bool islast, InKeyType *key, InValType *val) {
+        if (FileFormat == BinaryFileFormat) {
+            int kvsize = ser->get_record_bytes(ptr, (int)state.win_size);
+            if (kvsize == -1) {
+                if (islast)
+                    LOG_ERROR("Incomplete record (%ld bytes) at the end of file %s!\n",
+                              state.win_size, state.cur_chunk.fileseg->filename.c_str());
+                return -1;
+            }
+            ser->kv_from_bytes(key, val, ptr, kvsize);
+            return kvsize;
+        }
+
+        int linelen = 0;
+        if (parser.to_line(ptr, (int)state.win_size, islast, &linelen) == -1)
+            return -1;
+        return ser->key_from_line(key, ptr, linelen);
+    }
+
     bool is_last_block() {
         if (state.cur_chunk.fileoff + INPUT_BUF_SIZE >= state.cur_chunk.fileseg->filesize
             || !state.has_tail)
@@ -189,6 +293,9 @@ class FileReader : public Readable<InKeyType, InValType> {
         if (MAKE_PROGRESS && this->shuffler && state.cur_chunk.fileseg)
             this->shuffler->make_progress(true);
 
+        if (prefetch_depth > 0)
+            return read_next_prefetch_chunk();
+
         //print_state();
 
         bool cont_chunk = false;
@@ -259,6 +366,235 @@ class FileReader : public Readable<InKeyType, InValType> {
         return true;
     }
 
+    // The chunks are consumed in the order they are acquired. Only own chunks
+    // are acquired ahead; a chunk is stolen only when nothing else is held, so
+    // two processes never wait for the head of a chunk queued by each other.
+    // The next chunk of a tail is acquired as read_next_chunk does before the
+    // tail is waited for, since it may be held by this process.
+    bool read_next_prefetch_chunk() {
+
+        PrefetchSlot *slot = NULL;
+        bool cont_chunk = false;
+
+        if (state.cur_chunk.fileseg && chunk_mgr->has_tail(state.cur_chunk) && !is_last_block()) {
+            if (!prefetch_queue.empty()
+                && prefetch_queue.front()->chunk.procrank == state.cur_chunk.procrank
+                && prefetch_queue.front()->chunk.localid == state.cur_chunk.localid + 1) {
+                slot = prefetch_queue.front();
+                prefetch_queue.pop_front();
+                cont_chunk = true;
+            } else if ((slot = get_free_slot()) != NULL
+                       && chunk_mgr->acquire_local_chunk(slot->chunk,
+                                                         state.cur_chunk.localid + 1)) {
+                // The rest of a stolen batch is not queued
+                prefetch_start(slot);
+                cont_chunk = true;
+            } else {
+                int count = chunk_mgr->recv_tail(state.cur_chunk,
+                                                 buffer + state.start_pos + state.win_size,
+                                                 MAX_RECORD_SIZE);
+                state.win_size += count;
+                state.has_tail = false;
+                return true;
+            }
+        } else {
+            state.start_pos = 0;
+            state.win_size = 0;
+            if (!prefetch_queue.empty()) {
+                slot = prefetch_queue.front();
+                prefetch_queue.pop_front();
+            } else {
+                slot = get_free_slot();
+                if (slot == NULL || chunk_mgr->acquire_chunk(slot->chunk) == false)
+                    return false;
+                prefetch_start(slot);
+            }
+        }
+
+        prefetch_wait(slot);
+
+        if (!state.cur_chunk.fileseg
+            || slot->chunk.fileseg->filename != state.cur_chunk.fileseg->filename) {
+            PROFILER_RECORD_COUNT(COUNTER_FILE_COUNT, 1, OPSUM);
+        }
+
+        uint64_t start_pos = prefetch_head, win_size = 0;
+        if (cont_chunk) {
+            if (state.win_size > prefetch_head)
+                LOG_ERROR("Record size (%ld) is larger than max value (%d)!\n",
+                          state.win_size, MAX_RECORD_SIZE);
+            start_pos = prefetch_head - state.win_size;
+            win_size = state.win_size;
+            memcpy(slot->buffer + start_pos, buffer + state.start_pos, win_size);
+        }
+        if (cur_slot) cur_slot->state = SlotFree;
+        cur_slot = slot;
+        buffer = slot->buffer;
+
+        state.cur_chunk = slot->chunk;
+        state.start_pos = start_pos;
+        state.win_size = win_size + state.cur_chunk.chunksize;
+        PROFILER_RECORD_COUNT(COUNTER_FILE_SIZE, state.cur_chunk.chunksize, OPSUM);
+
+        if (chunk_mgr->has_head(state.cur_chunk) && cont_chunk == false) {
+            int count = padding_fn(buffer + state.start_pos,
+                                   (int)state.win_size,
+                                   chunk_mgr->is_file_end(state.cur_chunk));
+            chunk_mgr->send_head(state.cur_chunk, buffer + state.start_pos, count);
+            state.start_pos += count;
+            state.win_size -= count;
+        }
+
+        if (!chunk_mgr->is_file_end(state.cur_chunk)) {
+            state.has_tail = true;
+        } else {
+            state.has_tail = false;
+        }
+
+        prefetch_fill();
+
+        return true;
+    }
+
+    PrefetchSlot *get_free_slot() {
+        for (int i = 0; i < prefetch_depth + 1; i++)
+            if (prefetch_slots[i].state == SlotFree)
+                return &prefetch_slots[i];
+        return NULL;
+    }
+
+    void prefetch_fill() {
+        while (!prefetch_local_done && (int)prefetch_queue.size() < prefetch_depth) {
+            PrefetchSlot *slot = get_free_slot();
+            if (slot == NULL) break;
+            if (chunk_mgr->acquire_chunk(slot->chunk, false) == false) {
+                prefetch_local_done = true;
+                break;
+            }
+            prefetch_start(slot);
+            prefetch_queue.push_back(slot);
+        }
+    }
+
+    void prefetch_start(PrefetchSlot *slot) {
+        if (DIRECT_READ && slot->chunk.fileoff % DISKPAGE_SIZE != 0)
+            LOG_ERROR("Read offset (%ld) should be sector alignment!\n", slot->chunk.fileoff);
+        slot->read_bytes = 0;
+        slot->error = 0;
+        slot->state = SlotIssued;
+        prefetch_issue(slot);
+        LOG_PRINT(DBG_IO, "Prefetch input file=%s:%ld+%ld\n",
+                  slot->chunk.fileseg->filename.c_str(),
+                  slot->chunk.fileoff, slot->chunk.chunksize);
+    }
+
+    void prefetch_wait(PrefetchSlot *slot) {
+        if (!prefetch_test(slot)) {
+            TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+            double t_start = MR_GET_WTIME();
+            while (!prefetch_test(slot)) {
+                chunk_mgr->make_progress();
+                if (MAKE_PROGRESS && this->shuffler) this->shuffler->make_progress(true);
+                std::this_thread::yield();
+            }
+            PROFILER_RECORD_TIME(TIMER_PFS_INPUT, MR_GET_WTIME() - t_start);
+            TRACKER_RECORD_EVENT(EVENT_DISK_FREADAT);
+        }
+        if (slot->state == SlotError)
+            LOG_ERROR("Read input file %s:%ld+%ld error (%s)!\n",
+                      slot->chunk.fileseg->filename.c_str(),
+                      slot->chunk.fileoff, slot->chunk.chunksize,
+                      strerror(slot->error));
+    }
+
+    // I/O stage: a background thread reads the issued slots with pread.
+    virtual void prefetch_init() {
+        prefetch_stop = false;
+        prefetch_thread = std::thread(&FileReader::prefetch_loop, this);
+    }
+
+    virtual void prefetch_uninit() {
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            prefetch_stop = true;
+            prefetch_reqs.clear();
+        }
+        prefetch_cond.notify_one();
+        prefetch_thread.join();
+        PROFILER_RECORD_TIME(TIMER_PFS_PREFETCH, prefetch_time);
+    }
+
+    virtual void prefetch_issue(PrefetchSlot *slot) {
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            prefetch_reqs.push_back(slot);
+        }
+        prefetch_cond.notify_one();
+    }
+
+    virtual bool prefetch_test(PrefetchSlot *slot) {
+        return slot->state.load(std::memory_order_acquire) != SlotIssued;
+    }
+
+    void prefetch_loop() {
+        int fd = -1;
+        std::string filename;
+        while (true) {
+            PrefetchSlot *slot = NULL;
+            {
+                std::unique_lock<std::mutex> lock(prefetch_mutex);
+                while (!prefetch_stop && prefetch_reqs.empty())
+                    prefetch_cond.wait(lock);
+                if (prefetch_stop) break;
+                slot = prefetch_reqs.front();
+                prefetch_reqs.pop_front();
+            }
+            std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+            if (slot->chunk.fileseg->filename != filename) {
+                if (fd != -1) ::close(fd);
+                filename = slot->chunk.fileseg->filename;
+                int flags = O_RDONLY | O_LARGEFILE;
+                if (DIRECT_READ) flags |= O_DIRECT;
+                fd = ::open(filename.c_str(), flags);
+            }
+            int ret = SlotReady;
+            if (fd == -1) {
+                slot->error = errno;
+                filename.clear();
+                ret = SlotError;
+            } else {
+                ret = prefetch_read(fd, slot);
+            }
+            prefetch_time += std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - t_start).count();
+            slot->state.store(ret, std::memory_order_release);
+        }
+        if (fd != -1) ::close(fd);
+    }
+
+    int prefetch_read(int fd, PrefetchSlot *slot) {
+        char *buf = slot->buffer + prefetch_head;
+        uint64_t size = slot->chunk.chunksize;
+        if (DIRECT_READ) size = ROUNDUP(size, DISKPAGE_SIZE) * DISKPAGE_SIZE;
+        while (slot->read_bytes < size) {
+            ssize_t count = ::pread64(fd, buf + slot->read_bytes,
+                                      size - slot->read_bytes,
+                                      (off64_t)(slot->chunk.fileoff + slot->read_bytes));
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                slot->error = errno;
+                return SlotError;
+            }
+            if (count == 0) break;
+            slot->read_bytes += count;
+        }
+        if (slot->read_bytes < slot->chunk.chunksize) {
+            slot->error = EIO;
+            return SlotError;
+        }
+        return SlotReady;
+    }
+
     virtual void file_init(){
         union_fp.c_fp = NULL;
     }
@@ -355,6 +691,19 @@ class FileReader : public Readable<InKeyType, InValType> {
     Serializer<InKeyType, InValType> *ser;
     int            keycount, valcount;
 
+    int             prefetch_depth;
+    PrefetchSlot   *prefetch_slots;
+    PrefetchSlot   *cur_slot;
+    std::deque<PrefetchSlot*> prefetch_queue;
+    uint64_t        prefetch_head;
+    bool            prefetch_local_done;
+    std::thread     prefetch_thread;
+    std::mutex      prefetch_mutex;
+    std::condition_variable prefetch_cond;
+    std::deque<PrefetchSlot*> prefetch_reqs;
+    bool            prefetch_stop;
+    double          prefetch_time;
+
     MPI_Comm        reader_comm;
     int             reader_rank;
     int             reader_size;
@@ -561,6 +910,723 @@ class MPIFileReader : public FileReader<FileFormat, KeyType, ValType, InKeyType,
         }
     }
 
+
+    // Each slot keeps its own file handle and one MPI_File_iread_at in flight.
+    virtual void prefetch_init() {
+    }
+
+    virtual void prefetch_uninit() {
+        for (int i = 0; i < this->prefetch_depth + 1; i++) {
+            PrefetchSlot *slot = &(this->prefetch_slots[i]);
+            if (slot->mpi_req != MPI_REQUEST_NULL)
+                MPI_Wait(&(slot->mpi_req), MPI_STATUS_IGNORE);
+            if (slot->mpi_fp != MPI_FILE_NULL)
+                MPI_CHECK(MPI_File_close(&(slot->mpi_fp)));
+        }
+    }
+
+    virtual void prefetch_issue(PrefetchSlot *slot) {
+        if (slot->filename != slot->chunk.fileseg->filename) {
+            if (slot->mpi_fp != MPI_FILE_NULL)
+                MPI_CHECK(MPI_File_close(&(slot->mpi_fp)));
+            slot->filename = slot->chunk.fileseg->filename;
+            MPI_Info file_info;
+            MPI_Info_create(&file_info);
+            if (DIRECT_READ) MPI_Info_set(file_info, "direct_read", "true");
+            MPI_CHECK(MPI_File_open(MPI_COMM_SELF, slot->filename.c_str(), MPI_MODE_RDONLY,
+                                    file_info, &(slot->mpi_fp)));
+            MPI_Info_free(&file_info);
+        }
+        MPI_CHECK(MPI_File_iread_at(slot->mpi_fp, slot->chunk.fileoff + slot->read_bytes,
+                                    slot->buffer + this->prefetch_head + slot->read_bytes,
+                                    (int)(slot->chunk.chunksize - slot->read_bytes),
+                                    MPI_BYTE, &(slot->mpi_req)));
+    }
+
+    virtual bool prefetch_test(PrefetchSlot *slot) {
+        if (slot->state != SlotIssued) return true;
+        int flag = 0, count = 0;
+        MPI_Status st;
+        MPI_Test(&(slot->mpi_req), &flag, &st);
+        if (!flag) return false;
+        MPI_Get_count(&st, MPI_BYTE, &count);
+        slot->read_bytes += count;
+        if (slot->read_bytes < slot->chunk.chunksize) {
+            if (count == 0) {
+                slot->error = EIO;
+                slot->state = SlotError;
+                return true;
+            }
+            prefetch_issue(slot);
+            return false;
+        }
+        slot->state = SlotReady;
+        return true;
+    }
+
+};
+
+template <InputFileFormat FileFormat,
+         typename KeyType, typename ValType,
+         typename InKeyType = char*, typename InValType = void>
+class AsyncFileReader
+    : public FileReader<FileFormat, KeyType, ValType,
+                        InKeyType, InValType> {
+
+  public:
+    AsyncFileReader(MPI_Comm comm,
+                    ChunkManager<KeyType, ValType> *chunk_mgr,
+                    int (*padding_fn)(const char* buf, int buflen, bool islast),
+                    int keycount = 1, int valcount = 1,
+                    int inkeycount = 1, int invalcount = 1)
+        : FileReader<FileFormat, KeyType, ValType, InKeyType, InValType>
+        (comm, chunk_mgr, padding_fn, keycount, valcount, inkeycount, invalcount) {
+        // The reader always works on the prefetch ring; without
+        // MIMIR_READ_PREFETCH, keep 4 reads in flight.
+        if (this->prefetch_depth <= 0) this->prefetch_depth = 4;
+    }
+
+    ~AsyncFileReader() {
+    }
+
+  protected:
+
+    // Every slot holds the descriptor of its chunk's file, so the reads in
+    // flight may cross file boundaries.
+    virtual void prefetch_init() {
+        if (!aio.init(this->prefetch_depth + 1))
+            LOG_ERROR("Cannot initialize io_uring or Linux AIO!\n");
+    }
+
+    virtual void prefetch_uninit() {
+        while (aio.get_inflight() > 0)
+            reap_events(true);
+        aio.uninit();
+        for (int i = 0; i < this->prefetch_depth + 1; i++) {
+            PrefetchSlot *slot = &(this->prefetch_slots[i]);
+            if (slot->posix_fd != -1) ::close(slot->posix_fd);
+            slot->posix_fd = -1;
+        }
+    }
+
+    virtual void prefetch_issue(PrefetchSlot *slot) {
+        if (slot->filename != slot->chunk.fileseg->filename) {
+            if (slot->posix_fd != -1) ::close(slot->posix_fd);
+            slot->filename = slot->chunk.fileseg->filename;
+            int flags = O_RDONLY | O_LARGEFILE;
+            if (DIRECT_READ) flags |= O_DIRECT;
+            slot->posix_fd = ::open(slot->filename.c_str(), flags);
+            if (slot->posix_fd == -1) {
+                slot->filename.clear();
+                slot->error = errno;
+                slot->state = SlotError;
+                return;
+            }
+        }
+        submit_read(slot);
+    }
+
+    virtual bool prefetch_test(PrefetchSlot *slot) {
+        if (slot->state == SlotIssued)
+            reap_events(false);
+        return slot->state != SlotIssued;
+    }
+
+    void submit_read(PrefetchSlot *slot) {
+        uint64_t size = slot->chunk.chunksize;
+        if (DIRECT_READ) size = ROUNDUP(size, DISKPAGE_SIZE) * DISKPAGE_SIZE;
+        if (!aio.submit_read(slot->posix_fd,
+                             slot->buffer + this->prefetch_head + slot->read_bytes,
+                             size - slot->read_bytes,
+                             slot->chunk.fileoff + slot->read_bytes, slot)) {
+            slot->error = EIO;
+            slot->state = SlotError;
+        }
+    }
+
+    void reap_events(bool wait) {
+        AsyncIOEvent events[MAX_AIO_EVENTS];
+        int count = aio.get_events(events, MAX_AIO_EVENTS, wait);
+        for (int i = 0; i < count; i++) {
+            PrefetchSlot *slot = (PrefetchSlot*)events[i].tag;
+            if (events[i].res < 0) {
+                slot->error = (int)(-events[i].res);
+                slot->state = SlotError;
+                continue;
+            }
+            slot->read_bytes += events[i].res;
+            if (slot->read_bytes >= slot->chunk.chunksize) {
+                slot->state = SlotReady;
+            } else if (events[i].res == 0) {
+                slot->error = EIO;
+                slot->state = SlotError;
+            } else {
+                submit_read(slot);
+            }
+        }
+    }
+
+    AsyncIO aio;
+};
+
+template <InputFileFormat FileFormat,
+         typename KeyType, typename ValType,
+         typename InKeyType = char*, typename InValType = void>
+class MMapFileReader
+    : public FileReader<FileFormat, KeyType, ValType,
+                        InKeyType, InValType> {
+
+  public:
+    MMapFileReader(MPI_Comm comm,
+                   ChunkManager<KeyType, ValType> *chunk_mgr,
+                   int (*padding_fn)(const char* buf, int buflen, bool islast),
+                   int keycount = 1, int valcount = 1,
+                   int inkeycount = 1, int invalcount = 1)
+        : FileReader<FileFormat, KeyType, ValType, InKeyType, InValType>
+        (comm, chunk_mgr, padding_fn, keycount, valcount, inkeycount, invalcount) {
+        map_base = NULL;
+        map_size = 0;
+        line_buf = NULL;
+        tail_buf = NULL;
+    }
+
+    ~MMapFileReader() {
+    }
+
+    // The window points into a read-only mapping of the whole file. Lines
+    // are copied to line_buf to be terminated; only a chunk whose tail comes
+    // from another process is assembled in tail_buf.
+    virtual int open() {
+
+        LOG_PRINT(DBG_IO, "Filereader (MMAP) open.\n");
+
+        this->bufsize = (int)INPUT_BUF_SIZE;
+        if (this->bufsize % DISKPAGE_SIZE != 0)
+            LOG_ERROR("The chunck size should be multiple times of disk sector size!\n");
+
+        PROFILER_RECORD_COUNT(COUNTER_MAX_FILE, (uint64_t) this->bufsize, OPMAX);
+
+        line_buf = (char*)mem_aligned_malloc(MEMPAGE_SIZE, MAX_RECORD_SIZE + 1);
+        tail_buf = (char*)mem_aligned_malloc(MEMPAGE_SIZE, 2 * (int64_t)MAX_RECORD_SIZE + 1);
+
+        this->state.cur_chunk.fileseg = NULL;
+        this->state.start_pos = 0;
+        this->state.win_size = 0;
+        this->state.has_tail = false;
+
+        file_init();
+        read_next_mmap_chunk();
+
+        this->record_count = 0;
+        return true;
+    }
+
+    virtual void close() {
+        file_close();
+        file_uninit();
+
+        mem_aligned_free(line_buf);
+        mem_aligned_free(tail_buf);
+        line_buf = tail_buf = NULL;
+        this->buffer = NULL;
+
+        LOG_PRINT(DBG_IO, "Filereader (MMAP) close.\n");
+    }
+
+    virtual int read(InKeyType *key, InValType *val) {
+
+        if (this->state.cur_chunk.fileseg == NULL)
+            return false;
+
+        while (true) {
+            char *ptr = this->buffer + this->state.start_pos;
+            bool islast = this->is_last_block();
+            int linelen = 0, move_count = -1;
+            // Binary records need no terminator, decode them in the mapping
+            if (FileFormat == BinaryFileFormat && this->state.win_size > 0) {
+                move_count = this->next_record(ptr, islast, key, val);
+            } else if (this->state.win_size > 0) {
+                move_count = this->parser.find_line(ptr, (int)this->state.win_size,
+                                                    islast, &linelen);
+                if (move_count != -1) {
+                    if (linelen > MAX_RECORD_SIZE)
+                        LOG_ERROR("Record size (%d) is larger than max value (%d)!\n",
+                                  linelen, MAX_RECORD_SIZE);
+                    memcpy(line_buf, ptr, linelen);
+                    line_buf[linelen] = '\0';
+                    this->ser->key_from_line(key, line_buf, linelen);
+                }
+            }
+            if (move_count != -1) {
+                if ((uint64_t)move_count >= this->state.win_size) {
+                    this->state.win_size = 0;
+                    this->state.start_pos = 0;
+                }
+                else {
+                    this->state.start_pos += move_count;
+                    this->state.win_size -= move_count;
+                }
+                this->record_count ++;
+                return true;
+            }
+            if (!read_next_mmap_chunk())
+                break;
+        }
+
+        this->chunk_mgr->wait();
+        return false;
+    }
+
+  protected:
+
+    bool read_next_mmap_chunk() {
+
+        this->chunk_mgr->make_progress();
+        if (MAKE_PROGRESS && this->shuffler && this->state.cur_chunk.fileseg)
+            this->shuffler->make_progress(true);
+
+        bool cont_chunk = false;
+        Chunk new_chunk;
+        if (this->state.cur_chunk.fileseg
+            && this->chunk_mgr->has_tail(this->state.cur_chunk)
+            && !this->is_last_block()) {
+            if (this->chunk_mgr->acquire_local_chunk(new_chunk,
+                                                     this->state.cur_chunk.localid + 1) == false) {
+                if (this->state.win_size > (uint64_t)MAX_RECORD_SIZE)
+                    LOG_ERROR("Record size (%ld) is larger than max value (%d)!\n",
+                              this->state.win_size, MAX_RECORD_SIZE);
+                memcpy(tail_buf, this->buffer + this->state.start_pos, this->state.win_size);
+                int count = this->chunk_mgr->recv_tail(this->state.cur_chunk,
+                                                       tail_buf + this->state.win_size,
+                                                       MAX_RECORD_SIZE);
+                this->buffer = tail_buf;
+                this->state.start_pos = 0;
+                this->state.win_size += count;
+                this->state.has_tail = false;
+                return true;
+            } else {
+                cont_chunk = true;
+            }
+        } else {
+            this->state.start_pos = 0;
+            this->state.win_size = 0;
+            if (this->chunk_mgr->acquire_chunk(new_chunk) == false) {
+                return false;
+            }
+        }
+
+        if (!this->state.cur_chunk.fileseg
+            || new_chunk.fileseg->filename != this->state.cur_chunk.fileseg->filename) {
+            file_close();
+            if (!file_open(new_chunk.fileseg->filename.c_str())) {
+                LOG_ERROR("Open file %s error!\n", new_chunk.fileseg->filename.c_str());
+                return false;
+            }
+            this->state.win_size = 0;
+            cont_chunk = false;
+            PROFILER_RECORD_COUNT(COUNTER_FILE_COUNT, 1, OPSUM);
+        }
+
+        // The previous partial record is right before the continuous chunk
+        // in the mapping, so the window only grows.
+        this->state.cur_chunk = new_chunk;
+        this->buffer = map_base;
+        this->state.start_pos = new_chunk.fileoff - this->state.win_size;
+        file_read_at(NULL, new_chunk.fileoff, new_chunk.chunksize);
+        this->state.win_size += new_chunk.chunksize;
+        PROFILER_RECORD_COUNT(COUNTER_FILE_SIZE, new_chunk.chunksize, OPSUM);
+
+        if (this->chunk_mgr->has_head(this->state.cur_chunk) && cont_chunk == false) {
+            int count = this->padding_fn(this->buffer + this->state.start_pos,
+                                         (int)this->state.win_size,
+                                         this->chunk_mgr->is_file_end(this->state.cur_chunk));
+            this->chunk_mgr->send_head(this->state.cur_chunk,
+                                       this->buffer + this->state.start_pos, count);
+            this->state.start_pos += count;
+            this->state.win_size -= count;
+        }
+
+        if (!this->chunk_mgr->is_file_end(this->state.cur_chunk)) {
+            this->state.has_tail = true;
+        } else {
+            this->state.has_tail = false;
+        }
+
+        return true;
+    }
+
+    virtual void file_init(){
+        this->union_fp.posix_fd = -1;
+        map_base = NULL;
+        map_size = 0;
+    }
+
+    virtual void file_uninit(){
+    }
+
+    virtual bool file_open(const char *filename){
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+        PROFILER_RECORD_TIME_START;
+
+        this->union_fp.posix_fd = ::open(filename, O_RDONLY | O_LARGEFILE);
+        if (this->union_fp.posix_fd == -1)
+            return false;
+
+        struct stat64 st;
+        if (::fstat64(this->union_fp.posix_fd, &st) == -1)
+            return false;
+        map_size = (uint64_t)st.st_size;
+        if (map_size > 0) {
+            void *addr = ::mmap(NULL, map_size, PROT_READ, MAP_SHARED,
+                                this->union_fp.posix_fd, 0);
+            if (addr == MAP_FAILED)
+                LOG_ERROR("Map input file %s error (%s)!\n", filename, strerror(errno));
+            map_base = (char*)addr;
+            ::madvise(map_base, map_size, MADV_SEQUENTIAL);
+        }
+
+        PROFILER_RECORD_TIME_END(TIMER_PFS_INPUT);
+        TRACKER_RECORD_EVENT(EVENT_DISK_FOPEN);
+
+        LOG_PRINT(DBG_IO, "Open (MMAP) input file=%s\n", filename);
+
+        return true;
+    }
+
+    // The pages are faulted in by the map itself; only ask the kernel to
+    // start reading the chunk ahead of the parser.
+    virtual void file_read_at(char *buf, uint64_t offset, uint64_t size){
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+        PROFILER_RECORD_TIME_START;
+
+        uint64_t start = ROUNDDOWN(offset, MEMPAGE_SIZE) * MEMPAGE_SIZE;
+        ::madvise(map_base + start, size + (offset - start), MADV_WILLNEED);
+
+        PROFILER_RECORD_TIME_END(TIMER_PFS_INPUT);
+        TRACKER_RECORD_EVENT(EVENT_DISK_FREADAT);
+
+        LOG_PRINT(DBG_IO, "Read (MMAP) input file=%s:%ld+%ld\n",
+                  this->state.cur_chunk.fileseg->filename.c_str(), offset, size);
+    }
+
+    virtual void file_close(){
+        if (this->union_fp.posix_fd != -1) {
+
+            TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+            PROFILER_RECORD_TIME_START;
+
+            if (map_base != NULL) ::munmap(map_base, map_size);
+            ::close(this->union_fp.posix_fd);
+
+            PROFILER_RECORD_TIME_END(TIMER_PFS_INPUT);
+            TRACKER_RECORD_EVENT(EVENT_DISK_FCLOSE);
+
+            this->union_fp.posix_fd = -1;
+            map_base = NULL;
+            map_size = 0;
+
+            LOG_PRINT(DBG_IO, "Close (MMAP) input file=%s\n",
+                      this->state.cur_chunk.fileseg->filename.c_str());
+        }
+    }
+
+    char       *map_base;
+    uint64_t    map_size;
+    char       *line_buf;
+    char       *tail_buf;
+};
+
+// Reader of indexed files (FileWriter INDEXED_FORMAT). A chunk owns the
+// blocks that start in it, and a block holds whole records, so the chunks
+// are read without exchanging heads and tails. Blocks rejected by the block
+// filter are not read.
+template <typename KeyType, typename ValType,
+         typename InKeyType = char*, typename InValType = void>
+class IndexedFileReader
+    : public BaseFileReader<KeyType, ValType, InKeyType, InValType> {
+
+  public:
+    IndexedFileReader(MPI_Comm comm,
+                      ChunkManager<KeyType, ValType> *chunk_mgr,
+                      int keycount = 1, int valcount = 1,
+                      int inkeycount = 1, int invalcount = 1) {
+        this->reader_comm = comm;
+        this->chunk_mgr = chunk_mgr;
+        this->inkeycount = inkeycount;
+        this->invalcount = invalcount;
+        shuffler = NULL;
+        block_filter = NULL;
+        filter_ptr = NULL;
+        buffer = NULL;
+        bufsize = 0;
+        fd = -1;
+        record_count = 0;
+        ser = new Serializer<InKeyType, InValType>(inkeycount, invalcount);
+    }
+
+    virtual ~IndexedFileReader() {
+        delete ser;
+    }
+
+    std::string get_object_name() { return "IndexedFileReader"; }
+
+    void set_shuffler(BaseShuffler<KeyType,ValType> *shuffler) {
+        this->shuffler = shuffler;
+        chunk_mgr->set_shuffler(shuffler);
+    }
+
+    // filter(first key of the block, first key of the next block or NULL, ptr)
+    void set_block_filter(bool (*filter)(InKeyType *first, InKeyType *next, void *ptr),
+                          void *ptr) {
+        block_filter = filter;
+        filter_ptr = ptr;
+    }
+
+    virtual int open() {
+
+        LOG_PRINT(DBG_IO, "Filereader (Indexed) open.\n");
+
+        filename.clear();
+        blocks.clear();
+        block_idx = block_end = 0;
+        start_pos = win_size = 0;
+        skip_count = 0;
+
+        read_next_block();
+
+        record_count = 0;
+        return true;
+    }
+
+    virtual void close() {
+        file_close();
+        if (buffer != NULL) mem_aligned_free(buffer);
+        buffer = NULL;
+        bufsize = 0;
+
+        PROFILER_RECORD_COUNT(COUNTER_SKIP_BLOCKS, skip_count, OPSUM);
+
+        LOG_PRINT(DBG_IO, "Filereader (Indexed) close.\n");
+    }
+
+    virtual int seek(DB_POS pos) {
+        LOG_WARNING("IndexedFileReader doesnot support seek methods!\n");
+        return false;
+    }
+
+    virtual uint64_t get_record_count() { return record_count; }
+
+    virtual int read(InKeyType *key, InValType *val) {
+
+        while (true) {
+            if (win_size > 0) {
+                char *ptr = buffer + start_pos;
+                int kvsize = ser->get_record_bytes(ptr, (int)win_size);
+                if (kvsize == -1)
+                    LOG_ERROR("Broken record in block of file %s!\n", filename.c_str());
+                ser->kv_from_bytes(key, val, ptr, kvsize);
+                start_pos += kvsize;
+                win_size -= kvsize;
+                record_count ++;
+                return true;
+            }
+            if (!read_next_block())
+                break;
+        }
+
+        chunk_mgr->wait();
+        return false;
+    }
+
+  protected:
+
+    bool read_next_block() {
+
+        while (true) {
+            if (block_idx >= block_end) {
+                chunk_mgr->make_progress();
+                if (MAKE_PROGRESS && this->shuffler && filename.size() > 0)
+                    this->shuffler->make_progress(true);
+
+                Chunk chunk;
+                if (chunk_mgr->acquire_chunk(chunk) == false)
+                    return false;
+                if (chunk.fileseg->filename != filename)
+                    file_open(chunk.fileseg->filename.c_str());
+
+                // Blocks that start in [fileoff, fileoff + chunksize)
+                block_idx = first_block(chunk.fileoff);
+                block_end = first_block(chunk.fileoff + chunk.chunksize);
+                continue;
+            }
+
+            BlockInfo &block = blocks[block_idx];
+            if (block_filter != NULL && !filter_block(block_idx)) {
+                block_idx ++;
+                skip_count ++;
+                continue;
+            }
+
+            file_read_at(buffer, block.offset, block.size);
+            if (checksum && crc32_update(0, buffer, block.size) != block.checksum)
+                LOG_ERROR("Checksum error in block %ld of file %s!\n",
+                          block_idx, filename.c_str());
+            start_pos = 0;
+            win_size = block.size;
+            block_idx ++;
+            PROFILER_RECORD_COUNT(COUNTER_FILE_SIZE, block.size, OPSUM);
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t first_block(uint64_t offset) {
+        size_t low = 0, high = blocks.size();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (blocks[mid].offset < offset) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+    bool filter_block(size_t idx) {
+        typename SafeType<InKeyType>::type first[inkeycount];
+        typename SafeType<InKeyType>::type next[inkeycount];
+        InKeyType *next_ptr = NULL;
+
+        ser->key_from_bytes(first, index_buf.data() + key_offs[idx], blocks[idx].keysize);
+        if (idx + 1 < blocks.size()) {
+            ser->key_from_bytes(next, index_buf.data() + key_offs[idx + 1],
+                                blocks[idx + 1].keysize);
+            next_ptr = next;
+        }
+        return block_filter(first, next_ptr, filter_ptr);
+    }
+
+    // Open the file and load its block index
+    void file_open(const char *name) {
+
+        file_close();
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+        PROFILER_RECORD_TIME_START;
+
+        fd = ::open(name, O_RDONLY | O_LARGEFILE);
+        if (fd == -1)
+            LOG_ERROR("Open file %s error (%s)!\n", name, strerror(errno));
+
+        struct stat64 st;
+        if (::fstat64(fd, &st) == -1)
+            LOG_ERROR("Stat file %s error (%s)!\n", name, strerror(errno));
+        uint64_t filesize = (uint64_t)st.st_size;
+
+        IndexFileHeader header;
+        IndexFileTrailer trailer;
+        if (filesize < sizeof(header) + sizeof(trailer))
+            LOG_ERROR("File %s is not an indexed file!\n", name);
+        pread_all((char*)&header, 0, sizeof(header), name);
+        pread_all((char*)&trailer, filesize - sizeof(trailer), sizeof(trailer), name);
+        if (header.magic != INDEX_FILE_MAGIC || trailer.magic != INDEX_TRAILER_MAGIC)
+            LOG_ERROR("File %s is not an indexed file!\n", name);
+        if (header.version != INDEX_FILE_VERSION)
+            LOG_ERROR("Indexed file %s has unknown version %d!\n", name, header.version);
+        if (header.keytype != IndexType<InKeyType>::code()
+            || header.valtype != IndexType<InValType>::code()
+            || header.keysize != IndexType<InKeyType>::size()
+            || header.valsize != IndexType<InValType>::size()
+            || header.keycount != (uint32_t)inkeycount
+            || header.valcount != (uint32_t)invalcount)
+            LOG_ERROR("Key/value types of file %s do not match the input types!\n", name);
+        checksum = (header.flags & INDEX_FLAG_CHECKSUM) != 0;
+
+        index_buf.resize(trailer.indexsize);
+        if (trailer.indexsize > 0)
+            pread_all(&index_buf[0], trailer.indexoff, trailer.indexsize, name);
+        blocks.resize(trailer.blockcount);
+        key_offs.resize(trailer.blockcount);
+        uint64_t off = 0;
+        for (uint64_t i = 0; i < trailer.blockcount; i++) {
+            memcpy(&blocks[i], &index_buf[off], sizeof(BlockInfo));
+            key_offs[i] = off + sizeof(BlockInfo);
+            off += sizeof(BlockInfo) + blocks[i].keysize;
+        }
+
+        if (trailer.maxblocksize > bufsize) {
+            if (buffer != NULL) mem_aligned_free(buffer);
+            bufsize = trailer.maxblocksize;
+            buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize, MCDRAM_ALLOCATE);
+        }
+        filename = name;
+
+        PROFILER_RECORD_TIME_END(TIMER_PFS_INPUT);
+        TRACKER_RECORD_EVENT(EVENT_DISK_FOPEN);
+        PROFILER_RECORD_COUNT(COUNTER_FILE_COUNT, 1, OPSUM);
+
+        LOG_PRINT(DBG_IO, "Open (Indexed) input file=%s, blocks=%ld\n",
+                  name, trailer.blockcount);
+    }
+
+    void file_read_at(char *buf, uint64_t offset, uint64_t size) {
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+        PROFILER_RECORD_TIME_START;
+
+        pread_all(buf, offset, size, filename.c_str());
+
+        PROFILER_RECORD_TIME_END(TIMER_PFS_INPUT);
+        TRACKER_RECORD_EVENT(EVENT_DISK_FREADAT);
+
+        LOG_PRINT(DBG_IO, "Read (Indexed) input file=%s:%ld+%ld\n",
+                  filename.c_str(), offset, size);
+    }
+
+    void pread_all(char *buf, uint64_t offset, uint64_t size, const char *name) {
+        uint64_t count = 0;
+        while (count < size) {
+            ssize_t ret = ::pread64(fd, buf + count, size - count,
+                                    (off64_t)(offset + count));
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret <= 0)
+                LOG_ERROR("Read file %s error (%s)!\n", name,
+                          ret < 0 ? strerror(errno) : "end of file");
+            count += ret;
+        }
+    }
+
+    void file_close() {
+        if (fd != -1) {
+            ::close(fd);
+            fd = -1;
+            LOG_PRINT(DBG_IO, "Close (Indexed) input file=%s\n", filename.c_str());
+        }
+        filename.clear();
+    }
+
+    ChunkManager<KeyType,ValType> *chunk_mgr;
+    BaseShuffler<KeyType,ValType> *shuffler;
+    Serializer<InKeyType, InValType> *ser;
+    bool          (*block_filter)(InKeyType *first, InKeyType *next, void *ptr);
+    void           *filter_ptr;
+
+    std::string     filename;
+    int             fd;
+    bool            checksum;
+    std::vector<char>     index_buf;
+    std::vector<BlockInfo> blocks;
+    std::vector<uint64_t>  key_offs;
+    size_t          block_idx, block_end;
+    uint64_t        skip_count;
+
+    char           *buffer;
+    uint64_t        bufsize;
+    uint64_t        start_pos;
+    uint64_t        win_size;
+    uint64_t        record_count;
+    int             inkeycount, invalcount;
+
+    MPI_Comm        reader_comm;
 };
 
 #if 0
@@ -817,6 +1883,12 @@ FileReader<FileFormat, KeyType, ValType, InKeyType, InValType>*
     } else if (READ_TYPE == 1) {
         reader = new MPIFileReader<FileFormat, KeyType, ValType, InKeyType, InValType>(comm, mgr, padding_fn,
                                                                                        keycount, valcount, inkeycount, invalcount);
+    } else if (READ_TYPE == 2) {
+        reader = new MMapFileReader<FileFormat, KeyType, ValType, InKeyType, InValType>(comm, mgr, padding_fn,
+                                                                                        keycount, valcount, inkeycount, invalcount);
+    } else if (READ_TYPE == 3) {
+        reader = new AsyncFileReader<FileFormat, KeyType, ValType, InKeyType, InValType>(comm, mgr, padding_fn,
+                                                                                         keycount, valcount, inkeycount, invalcount);
     } else {
         LOG_ERROR("Error reader type %d\n", READ_TYPE);
     }
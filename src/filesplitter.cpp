@@ -5,6 +5,9 @@
  *
  *     See COPYRIGHT in top-level directory.
  */
+#include <limits.h>
+#include <string.h>
+
 #include "log.h"
 #include "config.h"
 #include "globals.h"
@@ -14,200 +17,203 @@ using namespace MIMIR_NS;
 
 FileSplitter* FileSplitter::splitter = NULL;
 
-void FileSplitter::bcast_file_list(InputSplit *input){
-    int   total_count = 0;
-    char *tmp_buf = NULL;
-    FileSeg *fileseg = NULL;
+void FileSplitter::scan_files(const std::vector<std::string>& input_dir,
+                              InputSplit *localfiles){
+    std::string send_buf;
+    int   sendcounts[split_size], displs[split_size];
+    int   recv_count = 0;
+    char *recv_buf = NULL;
 
     if(split_rank == 0){
-        while((fileseg = input->get_next_file()) != NULL){
-            total_count += (int)(fileseg->filename.size() + 1);
-            total_count += (int)sizeof(uint64_t);
+        std::vector<std::string> entries;
+        for(size_t i = 0; i < input_dir.size(); i++)
+            InputSplit::get_entries(input_dir[i].c_str(), entries);
+
+        // contiguous blocks of entries keep the global file order
+        size_t idx = 0;
+        for(int i = 0; i < split_size; i++){
+            displs[i] = (int)send_buf.size();
+            uint64_t count = get_proc_count(i, entries.size());
+            for(uint64_t j = 0; j < count; j++, idx++)
+                send_buf.append(entries[idx].c_str(), entries[idx].size() + 1);
+            if(send_buf.size() > (size_t)INT_MAX)
+                LOG_ERROR("Error: the input entry list is too large!\n");
+            sendcounts[i] = (int)send_buf.size() - displs[i];
         }
-    }else{
-        input->clear();
+        LOG_PRINT(DBG_IO, "Scatter input entries (count=%ld)\n", entries.size());
     }
 
-    MPI_Bcast( &total_count, 1, MPI_INT, 0, split_comm);
-
-    tmp_buf = new char[total_count];
+    MPI_Scatter(sendcounts, 1, MPI_INT, &recv_count, 1, MPI_INT, 0, split_comm);
+    recv_buf = new char[recv_count + 1];
+    MPI_Scatterv((void*)send_buf.data(), sendcounts, displs, MPI_BYTE,
+                 recv_buf, recv_count, MPI_BYTE, 0, split_comm);
 
     int off = 0;
-    if (split_rank == 0) {
-        while((fileseg = input->get_next_file()) != NULL){
-            memcpy(tmp_buf + off, fileseg->filename.c_str(),
-                   (int)(fileseg->filename.size() + 1));
-            off += (int)(fileseg->filename.size() + 1);
-            memcpy(tmp_buf + off, &(fileseg->filesize), sizeof(uint64_t));
-            off += (int)sizeof(uint64_t);
-        }
-        if(off != total_count) LOG_ERROR("Error: broadcast file list!\n");
-        MPI_Bcast( tmp_buf, total_count, MPI_BYTE, 0, split_comm );
-    }else{
-        MPI_Bcast( tmp_buf, total_count, MPI_BYTE, 0, split_comm );
-        while (off < total_count){
-            FileSeg tmp;
-
-            tmp.filename = tmp_buf + off;
-            off += (int)strlen(tmp_buf + off) + 1;
-            tmp.filesize = *(uint64_t*)(tmp_buf + off);
-            off += (int)sizeof(uint64_t);
-
-            tmp.startpos = 0;
-            tmp.segsize = tmp.filesize;
-            tmp.maxsegsize = tmp.filesize;
-            tmp.startrank = split_rank;
-            tmp.endrank = split_rank;
-            tmp.readorder = -1;
-
-            input->add_seg_file(&tmp);
-        }
-        if(off != total_count) LOG_ERROR("Error: broadcast file list!\n");
+    while(off < recv_count){
+        localfiles->add(recv_buf + off);
+        off += (int)strlen(recv_buf + off) + 1;
     }
 
-    delete [] tmp_buf;
+    delete [] recv_buf;
 
-    LOG_PRINT(DBG_IO, "Broadcast file list (count=%d)\n", total_count);
+    LOG_PRINT(DBG_IO, "Scan file list (local count=%ld)\n", localfiles->get_file_count());
 }
 
-void FileSplitter::split_files(InputSplit* input,
-                               std::vector<InputSplit>& files,
+void FileSplitter::split_files(InputSplit *localfiles,
+                               InputSplit *mysplit,
                                SplitPolicy policy){
-    switch(policy){
-    case BYSIZE: split_by_size(input, files); break;
-    case BYNAME: split_by_name(input, files); break;
-    }
-}
-
-void FileSplitter::split_by_size(InputSplit* input, std::vector<InputSplit>& files){
-
-    FileSeg *fileseg = NULL;
-    uint64_t totalblocks = 0;
-    // compute total number of blocks
-    while((fileseg = input->get_next_file()) != NULL)
-        totalblocks += ROUNDUP(fileseg->filesize, INPUT_BUF_SIZE);
-
-    InputSplit tmpsplit;
-    int max_rank = -1, proc_rank = 0;
-    uint64_t proc_off = 0;
-    uint64_t proc_blocks = get_proc_count(proc_rank, totalblocks);
-    uint64_t offsets[split_size + 1];
-
-    while ( (fileseg = input->get_next_file()) != NULL){
-
-        uint64_t maxsegsize = 0;
-        uint64_t file_off = 0, file_blocks = 0;
-        int start_rank = proc_rank, end_rank = proc_rank;
-
-        file_blocks = ROUNDUP(fileseg->filesize, INPUT_BUF_SIZE);
-
-        offsets[0] = 0;
-        while(file_blocks > 0){
-            if(proc_off + file_blocks <= proc_blocks){
-                proc_off += file_blocks;
-                file_off = fileseg->filesize;
-                file_blocks = 0;
-                end_rank = proc_rank;
-                offsets[proc_rank - start_rank + 1] = file_off;
-                uint64_t segsize = file_off - offsets[proc_rank - start_rank];
-                if(segsize > maxsegsize) maxsegsize = segsize;
-            }else{
-                file_blocks -= (proc_blocks - proc_off);
-                file_off += (proc_blocks - proc_off) * INPUT_BUF_SIZE;
-                proc_off = proc_blocks;
-                offsets[proc_rank - start_rank + 1] = file_off;
-                uint64_t segsize = file_off - offsets[proc_rank - start_rank];
-                if(segsize > maxsegsize) maxsegsize = segsize;
-            }
-            if( proc_off == proc_blocks){
-                proc_rank += 1;
-                proc_off = 0;
-                proc_blocks = get_proc_count(proc_rank, totalblocks);
+    std::vector<FileSeg>& files = localfiles->get_file_segs();
+    std::vector<uint64_t> file_block(files.size()), file_nblocks(files.size());
+    uint64_t local_blocks = 0, pack_bytes = 0;
+
+    // Weight of the files in blocks. By name every file is one block; by
+    // size files smaller than a chunk are packed into virtual blocks of
+    // INPUT_BUF_SIZE bytes, so a rank gets the same bytes, not the same
+    // number of files. Empty files are dropped by size.
+    for(size_t i = 0; i < files.size(); i++){
+        uint64_t fsize = files[i].filesize;
+        if(policy == BYNAME){
+            file_block[i] = local_blocks;
+            file_nblocks[i] = 1;
+            local_blocks += 1;
+        }else if(fsize == 0){
+            file_block[i] = local_blocks;
+            file_nblocks[i] = 0;
+        }else if(fsize < (uint64_t)INPUT_BUF_SIZE){
+            if(pack_bytes == 0 || pack_bytes + fsize > (uint64_t)INPUT_BUF_SIZE){
+                local_blocks += 1;
+                pack_bytes = 0;
             }
+            pack_bytes += fsize;
+            file_block[i] = local_blocks - 1;
+            file_nblocks[i] = 1;
+        }else{
+            pack_bytes = 0;
+            file_block[i] = local_blocks;
+            file_nblocks[i] = ROUNDUP(fsize, INPUT_BUF_SIZE);
+            local_blocks += file_nblocks[i];
         }
+    }
 
-        // this is a share file
+    uint64_t block_off = 0, total_blocks = 0;
+    MPI_Exscan(&local_blocks, &block_off, 1, MPI_UINT64_T, MPI_SUM, split_comm);
+    if(split_rank == 0) block_off = 0;
+    MPI_Allreduce(&local_blocks, &total_blocks, 1, MPI_UINT64_T, MPI_SUM, split_comm);
+
+    // Files split over several ranks
+    std::vector<int> shared_ranks, read_order;
+    for(size_t i = 0; i < files.size(); i++){
+        if(file_nblocks[i] <= 1) continue;
+        uint64_t first = block_off + file_block[i];
+        int start_rank = get_proc_rank(first, total_blocks);
+        int end_rank = get_proc_rank(first + file_nblocks[i] - 1, total_blocks);
         if(end_rank > start_rank){
-            for(int i = start_rank; i <= end_rank; i++){
-                if (fileseg->filesize > 0) {
-                    FileSeg    tmpseg;
-                    tmpseg.filename = fileseg->filename;
-                    tmpseg.filesize = fileseg->filesize;
-                    tmpseg.startpos = offsets[i - start_rank];
-                    tmpseg.segsize = offsets[i - start_rank + 1] 
-                        - offsets[i - start_rank];
-                    tmpseg.maxsegsize = maxsegsize;
-                    tmpseg.startrank = start_rank;
-                    tmpseg.endrank = end_rank;
-                    if(start_rank > max_rank) tmpseg.readorder = 0;
-                    else tmpseg.readorder = 1;
-                    tmpsplit.add_seg_file(&tmpseg);
-                    if(i < proc_rank){
-                        files.push_back(tmpsplit);
-                        tmpsplit.clear();
-                    }
-                }
-            }
-            if(start_rank > max_rank) max_rank = end_rank;
-        }else{
-            if (fileseg->filesize > 0) {
-                FileSeg    tmpseg;
-                tmpseg.filename = fileseg->filename;
-                tmpseg.filesize = fileseg->filesize;
-                tmpseg.startpos = 0;
-                tmpseg.segsize = fileseg->filesize;
-                tmpseg.maxsegsize = fileseg->filesize;
-                tmpseg.startrank = start_rank;
-                tmpseg.endrank = end_rank;
-                tmpseg.readorder = -1;
-                tmpsplit.add_seg_file(&tmpseg);
-                if(proc_rank > end_rank){
-                    files.push_back(tmpsplit);
-                    tmpsplit.clear();
-                }
-            }
+            shared_ranks.push_back(start_rank);
+            shared_ranks.push_back(end_rank);
         }
-
     }
+    get_read_order(shared_ranks, read_order);
+
+    // Segments grouped by the owner rank
+    std::vector<std::string> send_segs(split_size);
+    size_t shared_idx = 0;
+    for(size_t i = 0; i < files.size(); i++){
+        if(file_nblocks[i] == 0) continue;
+        uint64_t first = block_off + file_block[i];
+        uint64_t last = first + file_nblocks[i];
+        int start_rank = get_proc_rank(first, total_blocks);
+        int end_rank = get_proc_rank(last - 1, total_blocks);
+
+        FileSeg seg = files[i];
+        seg.startrank = start_rank;
+        seg.endrank = end_rank;
+        seg.readorder = -1;
+        if(end_rank == start_rank){
+            seg.startpos = 0;
+            seg.segsize = seg.filesize;
+            seg.maxsegsize = seg.filesize;
+            InputSplit::pack_seg(send_segs[start_rank], seg);
+            continue;
+        }
 
-    if(tmpsplit.get_file_count() > 0)
-        LOG_ERROR("Split state error!\n");
-
-    for (int i = (int)files.size() ; i < split_size; i++) {
-        tmpsplit.clear();
-        files.push_back(tmpsplit);
+        uint64_t offsets[end_rank - start_rank + 2];
+        seg.maxsegsize = 0;
+        for(int r = start_rank; r <= end_rank + 1; r++){
+            uint64_t block = (r <= end_rank) ? get_proc_start(r, total_blocks) : last;
+            if(block < first) block = first;
+            offsets[r - start_rank] = (block - first) * INPUT_BUF_SIZE;
+            if(offsets[r - start_rank] > seg.filesize)
+                offsets[r - start_rank] = seg.filesize;
+            if(r > start_rank){
+                uint64_t segsize = offsets[r - start_rank] - offsets[r - start_rank - 1];
+                if(segsize > seg.maxsegsize) seg.maxsegsize = segsize;
+            }
+        }
+        seg.readorder = read_order[shared_idx++];
+        for(int r = start_rank; r <= end_rank; r++){
+            seg.startpos = offsets[r - start_rank];
+            seg.segsize = offsets[r - start_rank + 1] - offsets[r - start_rank];
+            InputSplit::pack_seg(send_segs[r], seg);
+        }
     }
-     //if((int)files.size() != mimir_world_size)
-     //    LOG_ERROR("The split file count %ld is error!\n", files.size());
-}
 
-void FileSplitter::split_by_name(InputSplit* input, std::vector<InputSplit>& files){
+    int sendcounts[split_size], sdispls[split_size];
+    int recvcounts[split_size], rdispls[split_size];
+    std::string send_buf;
+    for(int i = 0; i < split_size; i++){
+        if(send_buf.size() + send_segs[i].size() > (size_t)INT_MAX)
+            LOG_ERROR("Error: the file list is too large!\n");
+        sdispls[i] = (int)send_buf.size();
+        sendcounts[i] = (int)send_segs[i].size();
+        send_buf.append(send_segs[i]);
+        std::string().swap(send_segs[i]);
+    }
+    localfiles->clear();
+
+    MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, split_comm);
+    int64_t recv_count = 0;
+    for(int i = 0; i < split_size; i++){
+        if(recv_count + recvcounts[i] > (int64_t)INT_MAX)
+            LOG_ERROR("Error: the file list is too large!\n");
+        rdispls[i] = (int)recv_count;
+        recv_count += recvcounts[i];
+    }
+    char *recv_buf = new char[recv_count + 1];
+    MPI_Alltoallv((void*)send_buf.data(), sendcounts, sdispls, MPI_BYTE,
+                  recv_buf, recvcounts, rdispls, MPI_BYTE, split_comm);
 
-    uint64_t totalcount = input->get_file_count();
+    // The sources are in rank order, so the segments stay in file order
+    mysplit->unpack(recv_buf, recv_count);
+    delete [] recv_buf;
 
-    int proc_rank = 0;
-    uint64_t file_count = 0;
+    LOG_PRINT(DBG_IO, "Split file list (segments=%ld, total blocks=%ld)\n",
+              mysplit->get_file_count(), total_blocks);
+}
 
-    FileSeg *fileseg = NULL;
-    InputSplit tmpsplit;
-    while((fileseg = input->get_next_file()) != NULL){
-        if(file_count < get_proc_count(proc_rank, totalcount)){
-	    fileseg->startrank = proc_rank;
-	    fileseg->endrank = proc_rank;
-    	    tmpsplit.add_seg_file(fileseg);
-            file_count++;
-        }
-        if(file_count == get_proc_count(proc_rank, totalcount)){
-            files.push_back(tmpsplit);
-            tmpsplit.clear();
-            proc_rank++;
-            file_count = 0;
-        }
+// Two shared files of one rank must be read in different groups. The
+// shared files are few (less than the number of ranks), so the order is
+// computed on all ranks from the gathered (start, end) ranks.
+void FileSplitter::get_read_order(std::vector<int>& shared_ranks,
+                                  std::vector<int>& read_order){
+    int local_count = (int)shared_ranks.size();
+    int counts[split_size], displs[split_size];
+    MPI_Allgather(&local_count, 1, MPI_INT, counts, 1, MPI_INT, split_comm);
+    int total_count = 0;
+    for(int i = 0; i < split_size; i++){
+        displs[i] = total_count;
+        total_count += counts[i];
+    }
+    std::vector<int> all_ranks(total_count + 1);
+    MPI_Allgatherv(shared_ranks.data(), local_count, MPI_INT,
+                   all_ranks.data(), counts, displs, MPI_INT, split_comm);
+
+    int max_rank = -1;
+    for(int i = 0; i < total_count; i += 2){
+        int order = (all_ranks[i] > max_rank) ? 0 : 1;
+        if(all_ranks[i] > max_rank) max_rank = all_ranks[i + 1];
+        if(i >= displs[split_rank] && i < displs[split_rank] + local_count)
+            read_order.push_back(order);
     }
-
-    tmpsplit.clear();
-    for (int i = (int)files.size(); i < split_size; i++)
-        files.push_back(tmpsplit);
 }
 
 //InputSplit *FileSplitter::get_my_split(){
@@ -221,4 +227,21 @@ uint64_t FileSplitter::get_proc_count(int rank, uint64_t totalcount){
     return localcount;
 }
 
+uint64_t FileSplitter::get_proc_start(int rank, uint64_t totalcount){
+    uint64_t remain = totalcount % split_size;
+    uint64_t start = (totalcount / split_size) * rank;
+    start += ((uint64_t)rank < remain) ? rank : remain;
+
+    return start;
+}
+
+int FileSplitter::get_proc_rank(uint64_t idx, uint64_t totalcount){
+    uint64_t localcount = totalcount / split_size;
+    uint64_t remain = totalcount % split_size;
+    if(idx < (localcount + 1) * remain)
+        return (int)(idx / (localcount + 1));
+
+    return (int)(remain + (idx - (localcount + 1) * remain) / localcount);
+}
+
 
@@ -8,6 +8,9 @@
 #ifndef MIMIR_FILE_SPLITER_H
 #define MIMIR_FILE_SPLITER_H
 
+#include <string>
+#include <vector>
+
 #include "inputsplit.h"
 
 namespace MIMIR_NS{
@@ -40,40 +43,29 @@ class FileSplitter{
     ~FileSplitter(){
     }
 
-    void split(InputSplit* input, 
-                      std::vector<InputSplit>& files,
-                      SplitPolicy policy = BYNAME){
-
-        LOG_PRINT(DBG_IO, "Start bcast file list\n");
-        bcast_file_list(input);
+    // Find the input files and return the segments of this rank. Rank 0
+    // only lists the input directories; the entries are scattered and each
+    // rank stats (and walks) its share. The segments are then sent to their
+    // owners, so no rank holds the whole file list.
+    void split(const std::vector<std::string>& input_dir,
+               InputSplit *mysplit,
+               SplitPolicy policy = BYNAME){
+
+        InputSplit localfiles;
+        LOG_PRINT(DBG_IO, "Start scan file list\n");
+        scan_files(input_dir, &localfiles);
         LOG_PRINT(DBG_IO, "Start split file list\n");
-        split_files(input, files, policy);
+        split_files(&localfiles, mysplit, policy);
         LOG_PRINT(DBG_IO, "End split file list\n");
-
-        //return get_my_split();
-    }
-
-    void split(const char* indir,
-                      std::vector<InputSplit>& files,
-                      SplitPolicy policy = BYNAME){
-
-        InputSplit input(indir);
-        LOG_PRINT(DBG_IO, "Start bcast file list\n");
-        bcast_file_list(&input);
-        LOG_PRINT(DBG_IO, "Start split file list\n");
-        split_files(&input, files, policy);
-        LOG_PRINT(DBG_IO, "End split file list\n");
-
-        //return get_my_split();
     }
 
   private:
-    void bcast_file_list(InputSplit* input);
-    void split_files(InputSplit* input, std::vector<InputSplit>& files, SplitPolicy policy);
-    void split_by_size(InputSplit* input, std::vector<InputSplit>& files);
-    void split_by_name(InputSplit* input, std::vector<InputSplit>& files);
-    //InputSplit *get_my_split();
+    void scan_files(const std::vector<std::string>& input_dir, InputSplit *localfiles);
+    void split_files(InputSplit *localfiles, InputSplit *mysplit, SplitPolicy policy);
+    void get_read_order(std::vector<int>& shared_ranks, std::vector<int>& read_order);
     uint64_t get_proc_count(int, uint64_t);
+    uint64_t get_proc_start(int, uint64_t);
+    int get_proc_rank(uint64_t, uint64_t);
 
     MPI_Comm split_comm;
     int      split_rank;
@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -17,6 +18,12 @@
 #include <errno.h>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 
 #include "log.h"
 #include "stat.h"
@@ -26,10 +33,19 @@
 #include "globals.h"
 #include "baseshuffler.h"
 #include "serializer.h"
+#include "indexfile.h"
+#include "hash.h"
 
 namespace MIMIR_NS {
 
-enum OUTPUT_FORMAT {BINARY_FORMAT, TEXT_FORMAT};
+enum OUTPUT_FORMAT {BINARY_FORMAT, TEXT_FORMAT, INDEXED_FORMAT};
+
+// Output buffer of the write-behind ring
+struct WriteSlot {
+    char       *buffer;
+    uint64_t    size;
+    bool        busy;
+};
 
 template <typename KeyType, typename ValType>
 class FileWriter : public Writable<KeyType, ValType> {
@@ -54,6 +70,16 @@ class FileWriter : public Writable<KeyType, ValType> {
         shuffler = NULL;
         ser = new Serializer<KeyType, ValType>(keycount, valcount);
         output_format = BINARY_FORMAT;
+        stream_off = 0;
+        max_block_size = 0;
+        memset(&cur_block, 0, sizeof(cur_block));
+        write_depth = WRITE_BEHIND;
+        write_slots = NULL;
+        cur_wslot = NULL;
+        write_stop = false;
+        write_active = false;
+        write_error = 0;
+        write_time = 0.0;
     }
 
     virtual ~FileWriter() {
@@ -68,6 +94,8 @@ class FileWriter : public Writable<KeyType, ValType> {
             output_format = BINARY_FORMAT;
         } else if (strcmp(format, "text") == 0) {
             output_format = TEXT_FORMAT;
+        } else if (strcmp(format, "indexed") == 0) {
+            output_format = INDEXED_FORMAT;
         } else {
             LOG_ERROR("Wrong output format (%s)!\n", format);
         }
@@ -84,17 +112,43 @@ class FileWriter : public Writable<KeyType, ValType> {
     virtual int open() {
         bufsize = INPUT_BUF_SIZE;
         this->datasize = 0;
-        buffer =  (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize, MCDRAM_ALLOCATE);
+        if (write_depth > 0) {
+            write_slots = new WriteSlot[write_depth + 1];
+            for (int i = 0; i < write_depth + 1; i++) {
+                write_slots[i].buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize, MCDRAM_ALLOCATE);
+                write_slots[i].size = 0;
+                write_slots[i].busy = false;
+            }
+            cur_wslot = &write_slots[0];
+            cur_wslot->busy = true;
+            buffer = cur_wslot->buffer;
+        } else {
+            buffer =  (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize, MCDRAM_ALLOCATE);
+        }
         record_count = 0;
         this->done_flag = 0;
-        return file_open();
+        int ret = file_open();
+        if (write_depth > 0) write_init();
+        if (output_format == INDEXED_FORMAT) index_begin();
+        return ret;
     }
 
     virtual void close() {
+        if (output_format == INDEXED_FORMAT) index_end();
         this->done_flag = 1;
         if (this->datasize > 0) file_write();
+        if (write_depth > 0) write_uninit();
         file_close();
-        mem_aligned_free(buffer);
+        if (write_depth > 0) {
+            for (int i = 0; i < write_depth + 1; i++)
+                mem_aligned_free(write_slots[i].buffer);
+            delete [] write_slots;
+            write_slots = NULL;
+            cur_wslot = NULL;
+        } else {
+            mem_aligned_free(buffer);
+        }
+        buffer = NULL;
     }
 
     virtual int seek(DB_POS pos) {
@@ -131,6 +185,24 @@ class FileWriter : public Writable<KeyType, ValType> {
             }
             //this->ser->kv_to_txt(key, val, buffer + datasize, bufsize - datasize);
             //*(buffer + datasize + kvsize - 1) = '\n';
+        } else if (output_format == INDEXED_FORMAT) {
+            kvsize = this->ser->get_kv_bytes(key, val);
+            if (cur_block.records > 0 && cur_block.size + kvsize > (uint64_t)OUTPUT_BLOCK_SIZE)
+                end_block();
+            if ((uint64_t)kvsize > bufsize - datasize) file_write();
+            kvsize = this->ser->kv_to_bytes(key, val, buffer + datasize, (int)(bufsize - datasize));
+            if (kvsize == -1)
+                LOG_ERROR("The write record length is larger than the buffer size!\n");
+            if (cur_block.records == 0) {
+                cur_block.offset = stream_off;
+                cur_block.keysize = (uint32_t)this->ser->get_key_bytes(key);
+                first_keys.append(buffer + datasize, cur_block.keysize);
+            }
+            if (BLOCK_CHECKSUM)
+                cur_block.checksum = crc32_update(cur_block.checksum, buffer + datasize, kvsize);
+            cur_block.size += kvsize;
+            cur_block.records += 1;
+            stream_off += kvsize;
         }
         datasize += kvsize;
         record_count++;
@@ -169,14 +241,20 @@ class FileWriter : public Writable<KeyType, ValType> {
                   this->filename.c_str(), (int)(this->datasize));
 
         PROFILER_RECORD_TIME_START;
-        fwrite(this->buffer, this->datasize, 1, this->union_fp.c_fp);
-        PROFILER_RECORD_COUNT(COUNTER_OUTPUT_SIZE, this->datasize, OPSUM);
+        write_buffer(this->datasize);
         PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
 
-        this->datasize = 0;
         TRACKER_RECORD_EVENT(EVENT_DISK_FWRITE);
     }
 
+    // Write size bytes of buf; runs in the background thread in write-behind
+    // mode, so it must not call MPI. Return 0 or errno.
+    virtual int file_write_data(char *buf, uint64_t size) {
+        if (size > 0 && fwrite(buf, size, 1, this->union_fp.c_fp) != 1)
+            return errno ? errno : EIO;
+        return 0;
+    }
+
     virtual void file_close() {
         if (this->union_fp.c_fp) {
             TRACKER_RECORD_EVENT(EVENT_COMPUTE_APP);
@@ -193,6 +271,176 @@ class FileWriter : public Writable<KeyType, ValType> {
     }
 
   protected:
+    // Write the first size bytes of the buffer; the rest is kept at the start
+    // of the next buffer. In write-behind mode the buffer is queued for the
+    // background thread and the map/reduce continues in a free one.
+    void write_buffer(uint64_t size) {
+        if (size == 0) return;
+        uint64_t remain = size < datasize ? datasize - size : 0;
+        if (write_depth > 0) {
+            WriteSlot *slot = get_free_wslot();
+            memcpy(slot->buffer, buffer + size, remain);
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                cur_wslot->size = size;
+                write_reqs.push_back(cur_wslot);
+            }
+            write_cond.notify_one();
+            cur_wslot = slot;
+            buffer = slot->buffer;
+        } else {
+            int err = file_write_data(buffer, size);
+            if (err != 0)
+                LOG_ERROR("Write file %s error (%s)!\n", filename.c_str(), strerror(err));
+            if (remain > 0) memmove(buffer, buffer + size, remain);
+        }
+        PROFILER_RECORD_COUNT(COUNTER_OUTPUT_SIZE, size, OPSUM);
+        datasize = remain;
+    }
+
+    WriteSlot *get_free_wslot() {
+        std::unique_lock<std::mutex> lock(write_mutex);
+        while (true) {
+            if (write_error != 0)
+                LOG_ERROR("Write file %s error (%s)!\n", filename.c_str(), strerror(write_error));
+            for (int i = 0; i < write_depth + 1; i++) {
+                if (!write_slots[i].busy) {
+                    write_slots[i].busy = true;
+                    return &write_slots[i];
+                }
+            }
+            write_done_cond.wait(lock);
+        }
+        return NULL;
+    }
+
+    // Wait until all queued buffers are in the file
+    void write_wait() {
+        if (write_depth <= 0) return;
+        std::unique_lock<std::mutex> lock(write_mutex);
+        while (!write_reqs.empty() || write_active)
+            write_done_cond.wait(lock);
+        if (write_error != 0)
+            LOG_ERROR("Write file %s error (%s)!\n", filename.c_str(), strerror(write_error));
+    }
+
+    void write_init() {
+        write_stop = false;
+        write_active = false;
+        write_error = 0;
+        write_time = 0.0;
+        write_thread = std::thread(&FileWriter::write_loop, this);
+    }
+
+    void write_uninit() {
+        write_wait();
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            write_stop = true;
+        }
+        write_cond.notify_one();
+        write_thread.join();
+        PROFILER_RECORD_TIME(TIMER_PFS_WRITEBEHIND, write_time);
+    }
+
+    void write_loop() {
+        while (true) {
+            WriteSlot *slot = NULL;
+            {
+                std::unique_lock<std::mutex> lock(write_mutex);
+                while (!write_stop && write_reqs.empty())
+                    write_cond.wait(lock);
+                if (write_reqs.empty()) break;
+                slot = write_reqs.front();
+                write_reqs.pop_front();
+                write_active = true;
+            }
+            std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+            int err = file_write_data(slot->buffer, slot->size);
+            write_time += std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - t_start).count();
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                slot->busy = false;
+                write_active = false;
+                if (err != 0 && write_error == 0) write_error = err;
+            }
+            write_done_cond.notify_all();
+        }
+    }
+
+    // Indexed format: the header goes first; the block index and the
+    // trailer are appended when the file is closed.
+    void index_begin() {
+        if (singlefile)
+            LOG_ERROR("Indexed format needs one output file per process!\n");
+
+        IndexFileHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = INDEX_FILE_MAGIC;
+        header.version = INDEX_FILE_VERSION;
+        header.flags = BLOCK_CHECKSUM ? INDEX_FLAG_CHECKSUM : 0;
+        header.keytype = IndexType<KeyType>::code();
+        header.valtype = IndexType<ValType>::code();
+        header.keysize = IndexType<KeyType>::size();
+        header.valsize = IndexType<ValType>::size();
+        header.keycount = (uint32_t)keycount;
+        header.valcount = (uint32_t)valcount;
+        header.blocksize = (uint64_t)OUTPUT_BLOCK_SIZE;
+
+        stream_off = 0;
+        max_block_size = 0;
+        blocks.clear();
+        first_keys.clear();
+        memset(&cur_block, 0, sizeof(cur_block));
+        append_bytes((const char*)&header, sizeof(header));
+    }
+
+    void end_block() {
+        if (cur_block.size > max_block_size) max_block_size = cur_block.size;
+        blocks.push_back(cur_block);
+        memset(&cur_block, 0, sizeof(cur_block));
+    }
+
+    void index_end() {
+        if (cur_block.records > 0) end_block();
+
+        IndexFileTrailer trailer;
+        memset(&trailer, 0, sizeof(trailer));
+        trailer.indexoff = stream_off;
+        size_t keyoff = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            append_bytes((const char*)&blocks[i], sizeof(BlockInfo));
+            append_bytes(first_keys.data() + keyoff, blocks[i].keysize);
+            keyoff += blocks[i].keysize;
+            trailer.recordcount += blocks[i].records;
+        }
+        trailer.indexsize = stream_off - trailer.indexoff;
+        trailer.blockcount = blocks.size();
+        trailer.maxblocksize = max_block_size;
+        trailer.magic = INDEX_TRAILER_MAGIC;
+        append_bytes((const char*)&trailer, sizeof(trailer));
+
+        LOG_PRINT(DBG_IO, "Indexed output file %s: blocks=%ld, records=%ld\n",
+                  filename.c_str(), trailer.blockcount, trailer.recordcount);
+
+        blocks.clear();
+        first_keys.clear();
+    }
+
+    void append_bytes(const char *data, uint64_t size) {
+        while (size > 0) {
+            if (datasize == bufsize) file_write();
+            uint64_t count = bufsize - datasize;
+            if (count > size) count = size;
+            memcpy(buffer + datasize, data, count);
+            datasize += count;
+            stream_off += count;
+            data += count;
+            size -= count;
+        }
+    }
+
     std::string filename;
     uint64_t record_count;
 
@@ -219,6 +467,25 @@ class FileWriter : public Writable<KeyType, ValType> {
     Serializer<KeyType, ValType> *ser;
 
     OUTPUT_FORMAT  output_format;
+
+    uint64_t    stream_off;
+    uint64_t    max_block_size;
+    BlockInfo   cur_block;
+    std::vector<BlockInfo> blocks;
+    std::string first_keys;
+
+    int         write_depth;
+    WriteSlot  *write_slots;
+    WriteSlot  *cur_wslot;
+    std::thread write_thread;
+    std::mutex  write_mutex;
+    std::condition_variable write_cond;
+    std::condition_variable write_done_cond;
+    std::deque<WriteSlot*> write_reqs;
+    bool        write_stop;
+    bool        write_active;
+    int         write_error;
+    double      write_time;
 };
 
 template <typename KeyType, typename ValType>
@@ -258,7 +525,6 @@ class DirectFileWriter : public FileWriter<KeyType, ValType>
         LOG_PRINT(DBG_IO, "Write (POSIX) output file %s:%d\n", 
                   this->filename.c_str(), (int)(this->datasize));
 
-        PROFILER_RECORD_TIME_START;
         //::lseek64(union_fp.posix_fd, 0, SEEK_END);
         uint64_t total_bytes = 0;
         if (this->done_flag) {
@@ -266,38 +532,38 @@ class DirectFileWriter : public FileWriter<KeyType, ValType>
         } else {
             total_bytes = ROUNDDOWN((this->datasize), DISKPAGE_SIZE) * DISKPAGE_SIZE;
         }
-        uint64_t remain_bytes = total_bytes;
-        char *remain_buffer = this->buffer;
-        do {
-            ssize_t write_bytes = ::write(this->union_fp.posix_fd, remain_buffer, remain_bytes);
-            if (write_bytes == -1) {
-                LOG_ERROR("Write error, %d\n", errno);
-            }
-            PROFILER_RECORD_COUNT(COUNTER_OUTPUT_SIZE, (uint64_t)write_bytes, OPSUM);
-            remain_bytes -= write_bytes;
-            remain_buffer += write_bytes;
-        } while (remain_bytes > 0);
+        uint64_t datasize = this->datasize;
+        PROFILER_RECORD_TIME_START;
+        this->write_buffer(total_bytes);
         PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
 
-        if (total_bytes < this->datasize) {
+        if (total_bytes < datasize) {
             filesize += total_bytes;
-            this->datasize = this->datasize - total_bytes;
-            for (size_t i = 0; i < this->datasize; i++) {
-                this->buffer[i] = this->buffer[total_bytes + i];
-            }
-        } else if (total_bytes > this->datasize ) {
-            filesize += this->datasize;
-            this->datasize = 0;
+        } else if (total_bytes > datasize ) {
+            filesize += datasize;
             LOG_PRINT(DBG_IO, "Set (POSIX) output file %s:%ld\n", 
                       this->filename.c_str(), filesize);
+            this->write_wait();
             ::ftruncate64(this->union_fp.posix_fd, filesize);
         } else {
-            filesize += this->datasize;
-            this->datasize = 0;
+            filesize += datasize;
         }
         TRACKER_RECORD_EVENT(EVENT_DISK_FWRITE);
     }
 
+    virtual int file_write_data(char *buf, uint64_t size) {
+        while (size > 0) {
+            ssize_t write_bytes = ::write(this->union_fp.posix_fd, buf, size);
+            if (write_bytes == -1) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            size -= write_bytes;
+            buf += write_bytes;
+        }
+        return 0;
+    }
+
     virtual void file_close() {
         if (this->union_fp.posix_fd != -1) {
             TRACKER_RECORD_EVENT(EVENT_COMPUTE_APP);
@@ -322,6 +588,8 @@ class MPIFileWriter : public FileWriter<KeyType, ValType> {
   public:
     MPIFileWriter(MPI_Comm comm, const char *filename, int keycount = 1, int valcount = 1) : 
         FileWriter<KeyType, ValType>(comm, filename, true, keycount, valcount) {
+        // The collective writes are issued by the caller
+        this->write_depth = 0;
     }
 
     virtual int file_open() {
@@ -479,6 +747,312 @@ class MPIFileWriter : public FileWriter<KeyType, ValType> {
     MPI_Offset filesize;
 };
 
+// Two-phase collective output to a single file. The ranks of a node are
+// split into WRITE_AGGREGATORS groups, and the first rank of a group is its
+// aggregator. In every round a group gathers its buffers on the aggregator.
+// The file offsets come from an exclusive scan over the aggregators. The
+// aggregators then exchange data so that each one writes a contiguous
+// stripe-aligned file domain with MPI_File_iwrite_at, overlapped with the
+// next round. The partial stripe at the end of a round is kept by
+// aggregator 0 and written in a later round.
+template <typename KeyType, typename ValType>
+class AggrFileWriter : public FileWriter<KeyType, ValType> {
+  public:
+    AggrFileWriter(MPI_Comm comm, const char *filename, int keycount = 1, int valcount = 1) : 
+        FileWriter<KeyType, ValType>(comm, filename, true, keycount, valcount) {
+        // The collective writes are issued by the caller
+        this->write_depth = 0;
+        node_comm = group_comm = aggr_comm = MPI_COMM_NULL;
+        gather_buf = NULL;
+        domain_buf[0] = domain_buf[1] = NULL;
+        domain_req[0] = domain_req[1] = MPI_REQUEST_NULL;
+    }
+
+    virtual int file_open() {
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_APP);
+
+        sync_writers();
+
+        int node_rank, node_size;
+        MPI_Comm_split_type(this->writer_comm, MPI_COMM_TYPE_SHARED,
+                            this->writer_rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_size(node_comm, &node_size);
+
+        // The data of a round must fit an int count
+        int64_t max_group = (INT_MAX - 4 * WRITE_STRIPE_SIZE) / this->bufsize;
+        if (max_group < 1)
+            LOG_ERROR("Error: stripe size (%ld) is too large for the aggregator!\n",
+                      WRITE_STRIPE_SIZE);
+        int naggr = WRITE_AGGREGATORS;
+        if (naggr > node_size) naggr = node_size;
+        while ((node_size + naggr - 1) / naggr > max_group) naggr ++;
+
+        MPI_Comm_split(node_comm, node_rank % naggr, node_rank, &group_comm);
+        MPI_Comm_rank(group_comm, &group_rank);
+        MPI_Comm_size(group_comm, &group_size);
+        MPI_Comm_split(this->writer_comm, (group_rank == 0) ? 0 : MPI_UNDEFINED,
+                       this->writer_rank, &aggr_comm);
+
+        done_count = 0;
+        gather_size = 0;
+        written_size = 0;
+        filesize = 0;
+        cur_domain = 0;
+
+        if (group_rank != 0) return true;
+
+        MPI_Comm_rank(aggr_comm, &aggr_rank);
+        MPI_Comm_size(aggr_comm, &aggr_size);
+
+        int max_group_size = 0;
+        MPI_Allreduce(&group_size, &max_group_size, 1, MPI_INT, MPI_MAX, aggr_comm);
+        int64_t gather_bufsize = WRITE_STRIPE_SIZE + group_size * this->bufsize;
+        int64_t domain_bufsize = 4 * WRITE_STRIPE_SIZE + max_group_size * this->bufsize;
+        gather_buf = (char*)mem_aligned_malloc(MEMPAGE_SIZE, gather_bufsize);
+        domain_buf[0] = (char*)mem_aligned_malloc(MEMPAGE_SIZE, domain_bufsize);
+        domain_buf[1] = (char*)mem_aligned_malloc(MEMPAGE_SIZE, domain_bufsize);
+
+        LOG_PRINT(DBG_IO, "Aggregated open output file %s (aggregators=%d, group size=%d).\n",
+                  this->filename.c_str(), aggr_size, group_size);
+        PROFILER_RECORD_TIME_START;
+        MPI_Info file_info;
+        MPI_Info_create(&file_info);
+        if (DIRECT_WRITE) MPI_Info_set(file_info, "direct_write", "true");
+        std::ostringstream oss;
+        oss << WRITE_STRIPE_SIZE;
+        MPI_Info_set(file_info, "striping_unit", oss.str().c_str());
+        MPI_CHECK(MPI_File_open(aggr_comm, this->filename.c_str(), 
+                                MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                                file_info, &(this->union_fp.mpi_fp)));
+        MPI_Info_free(&file_info);
+        if (this->union_fp.mpi_fp == MPI_FILE_NULL) {
+            LOG_ERROR("Open file %s error!\n", this->filename.c_str());
+        }
+        PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
+
+        TRACKER_RECORD_EVENT(EVENT_DISK_MPIOPEN);
+
+        return true;
+    }
+
+    virtual void file_write() {
+        int64_t info[2], group_info[2 * group_size];
+        int recvcounts[group_size], displs[group_size];
+        int64_t group_done = 0, gather_bytes = 0;
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_APP);
+
+        sync_writers();
+
+        info[0] = this->datasize;
+        info[1] = this->done_flag;
+        PROFILER_RECORD_TIME_START;
+        MPI_Gather(info, 2, MPI_INT64_T, group_info, 2, MPI_INT64_T, 0, group_comm);
+        if (group_rank == 0) {
+            for (int i = 0; i < group_size; i++) {
+                recvcounts[i] = (int)group_info[2 * i];
+                displs[i] = (int)(gather_size + gather_bytes);
+                gather_bytes += group_info[2 * i];
+                group_done += group_info[2 * i + 1];
+            }
+        }
+        MPI_Gatherv(this->buffer, (int)(this->datasize), MPI_BYTE,
+                    gather_buf, recvcounts, displs, MPI_BYTE, 0, group_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_ALLGATHER);
+
+        TRACKER_RECORD_EVENT(EVENT_COMM_GATHERV);
+
+        PROFILER_RECORD_COUNT(COUNTER_OUTPUT_SIZE, this->datasize, OPSUM);
+        this->datasize = 0;
+
+        if (group_rank == 0) {
+            done_count = aggr_write(gather_bytes, group_done, false);
+        }
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Bcast(&done_count, 1, MPI_INT, 0, group_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        TRACKER_RECORD_EVENT(EVENT_SYN_COMM);
+    }
+
+    virtual void file_close() {
+        if (group_comm == MPI_COMM_NULL) return;
+
+        while (done_count < this->writer_size) {
+            file_write();
+        }
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_APP);
+
+        sync_writers();
+
+        if (group_rank == 0) {
+            // The partial stripe kept by aggregator 0
+            aggr_write(0, 0, true);
+
+            MPI_Status st;
+            PROFILER_RECORD_TIME_START;
+            MPI_CHECK(MPI_Wait(&domain_req[0], &st));
+            MPI_CHECK(MPI_Wait(&domain_req[1], &st));
+            MPI_CHECK(MPI_File_close(&(this->union_fp.mpi_fp)));
+            this->union_fp.mpi_fp = MPI_FILE_NULL;
+            PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
+
+            TRACKER_RECORD_EVENT(EVENT_DISK_MPICLOSE);
+
+            mem_aligned_free(gather_buf);
+            mem_aligned_free(domain_buf[0]);
+            mem_aligned_free(domain_buf[1]);
+            gather_buf = domain_buf[0] = domain_buf[1] = NULL;
+            MPI_Comm_free(&aggr_comm);
+
+            LOG_PRINT(DBG_IO, "Aggregated close output file %s:%lld\n",
+                      this->filename.c_str(), filesize);
+        }
+        MPI_Comm_free(&group_comm);
+        MPI_Comm_free(&node_comm);
+    }
+
+  private:
+    // Let the shuffler make progress until all writers arrive
+    void sync_writers() {
+        if (this->shuffler) {
+            MPI_Request req;
+            MPI_Status st;
+            MPI_Ibarrier(this->writer_comm, &req);
+            int flag = 0;
+            while (!flag) {
+                MPI_Test(&req, &flag, &st);
+                this->shuffler->make_progress();
+            }
+            TRACKER_RECORD_EVENT(EVENT_SYN_COMM);
+        }
+    }
+
+    // File domain of an aggregator in a round. Domain c holds stripes
+    // [c*n/size, (c+1)*n/size) of [written_size, aligned_end); aggregator r
+    // owns domain r-1, so aggregator 0 owns the last one plus the partial
+    // stripe behind it.
+    void get_domain(int rank, int64_t nstripes, MPI_Offset aligned_end,
+                    MPI_Offset round_end, MPI_Offset *start, MPI_Offset *end) {
+        int c = (rank + aggr_size - 1) % aggr_size;
+        *start = written_size + (c * nstripes / aggr_size) * WRITE_STRIPE_SIZE;
+        *end = written_size + ((c + 1) * nstripes / aggr_size) * WRITE_STRIPE_SIZE;
+        if (*end > aligned_end) *end = aligned_end;
+        if (rank == 0) *end = round_end;
+    }
+
+    // Write the bytes gathered in this round; return the number of
+    // finished ranks. The last round writes the partial stripe as well.
+    int aggr_write(int64_t gather_bytes, int64_t group_done, bool last_round) {
+        int64_t local[2] = {gather_bytes, group_done}, total[2];
+        int64_t off = 0;
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Exscan(&local[0], &off, 1, MPI_INT64_T, MPI_SUM, aggr_comm);
+        MPI_Allreduce(local, total, 2, MPI_INT64_T, MPI_SUM, aggr_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        TRACKER_RECORD_EVENT(EVENT_COMM_ALLREDUCE);
+
+        if (aggr_rank == 0) off = 0;
+
+        MPI_Offset round_end = filesize + total[0];
+        int64_t nstripes = 0;
+        if (last_round) nstripes = ROUNDUP(round_end - written_size, WRITE_STRIPE_SIZE);
+        else nstripes = ROUNDDOWN(round_end - written_size, WRITE_STRIPE_SIZE);
+        MPI_Offset aligned_end = written_size + nstripes * WRITE_STRIPE_SIZE;
+        if (aligned_end > round_end) aligned_end = round_end;
+
+        // Data of this aggregator; aggregator 0 also has the partial stripe
+        MPI_Offset src_start = filesize + off, src_end = filesize + off + gather_bytes;
+        if (aggr_rank == 0) src_start = written_size;
+
+        int sendcounts[aggr_size], sdispls[aggr_size];
+        int recvcounts[aggr_size], rdispls[aggr_size];
+        for (int i = 0; i < aggr_size; i++) {
+            MPI_Offset start, end;
+            get_domain(i, nstripes, aligned_end, round_end, &start, &end);
+            if (start < src_start) start = src_start;
+            if (end > src_end) end = src_end;
+            sendcounts[i] = (end > start) ? (int)(end - start) : 0;
+            sdispls[i] = (end > start) ? (int)(start - src_start) : 0;
+        }
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, aggr_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_A2A);
+
+        TRACKER_RECORD_EVENT(EVENT_COMM_ALLTOALL);
+
+        // Sources are in file order, so the domain is filled in rank order
+        int recv_bytes = 0;
+        for (int i = 0; i < aggr_size; i++) {
+            rdispls[i] = recv_bytes;
+            recv_bytes += recvcounts[i];
+        }
+
+        MPI_Status st;
+        PROFILER_RECORD_TIME_START;
+        MPI_CHECK(MPI_Wait(&domain_req[cur_domain], &st));
+        PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Alltoallv(gather_buf, sendcounts, sdispls, MPI_BYTE,
+                      domain_buf[cur_domain], recvcounts, rdispls, MPI_BYTE, aggr_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_A2AV);
+
+        TRACKER_RECORD_EVENT(EVENT_COMM_ALLTOALLV);
+
+        MPI_Offset domain_start, domain_end;
+        get_domain(aggr_rank, nstripes, aligned_end, round_end, &domain_start, &domain_end);
+        int64_t write_bytes = recv_bytes;
+        if (aggr_rank == 0) write_bytes -= (round_end - aligned_end);
+
+        if (write_bytes > 0) {
+            LOG_PRINT(DBG_IO, "Aggregated write output file %s:%lld+%ld\n", 
+                      this->filename.c_str(), domain_start, write_bytes);
+
+            PROFILER_RECORD_TIME_START;
+            MPI_CHECK(MPI_File_iwrite_at(this->union_fp.mpi_fp, domain_start,
+                                         domain_buf[cur_domain], (int)write_bytes,
+                                         MPI_BYTE, &domain_req[cur_domain]));
+            PROFILER_RECORD_TIME_END(TIMER_PFS_OUTPUT);
+
+            TRACKER_RECORD_EVENT(EVENT_DISK_MPIIWRITEAT);
+        }
+
+        gather_size = 0;
+        if (aggr_rank == 0) {
+            gather_size = round_end - aligned_end;
+            memcpy(gather_buf, domain_buf[cur_domain] + write_bytes, gather_size);
+        }
+        cur_domain = 1 - cur_domain;
+        written_size = aligned_end;
+        filesize = round_end;
+
+        return (int)total[1];
+    }
+
+    MPI_Comm    node_comm;
+    MPI_Comm    group_comm;
+    MPI_Comm    aggr_comm;
+    int         group_rank;
+    int         group_size;
+    int         aggr_rank;
+    int         aggr_size;
+    char       *gather_buf;
+    int64_t     gather_size;
+    char       *domain_buf[2];
+    MPI_Request domain_req[2];
+    int         cur_domain;
+    int         done_count;
+    MPI_Offset  written_size;
+    MPI_Offset  filesize;
+};
+
 template <typename KeyType, typename ValType>
 FileWriter<KeyType, ValType>* FileWriter<KeyType, ValType>::writer = NULL;
 
@@ -493,6 +1067,8 @@ FileWriter<KeyType, ValType>* FileWriter<KeyType, ValType>::getWriter(MPI_Comm c
         }
     } else if (WRITE_TYPE == 1) {
         writer = new MPIFileWriter<KeyType, ValType>(comm, filename, keycount, valcount); 
+    } else if (WRITE_TYPE == 2) {
+        writer = new AggrFileWriter<KeyType, ValType>(comm, filename, keycount, valcount); 
     } else {
         LOG_ERROR("Error writer type %d\n", WRITE_TYPE);
     }
@@ -22,6 +22,7 @@
 #define CHUNK_TAIL_TAG       0xbb
 #define LB_EXCH_TAG          0xcc
 #define LB_MIGRATE_TAG       0xdd
+#define TOPK_MERGE_TAG       0xee
 
 #define NIN(A,B) ((A) < (B)) ? (A) : (B)
 #define MAX(A,B) ((A) > (B)) ? (A) : (B)
@@ -343,3 +343,36 @@ uint32_t hashlittle( const void *key, size_t length, uint32_t initval)
   return h;
 #endif /* PURIFY_HATES_HASHLITTLE */
 }
+
+/*
+-------------------------------------------------------------------------------
+crc32_update() -- CRC-32 with the IEEE 802.3 polynomial (reflected 0xEDB88320),
+table driven. Start with crc = 0 and pass the previous result to extend a
+checksum over several buffers.
+-------------------------------------------------------------------------------
+*/
+static uint32_t crc32_table[256];
+static bool     crc32_table_ready = false;
+
+static void crc32_init_table()
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+    crc32_table[i] = c;
+  }
+  crc32_table_ready = true;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t length)
+{
+  const uint8_t *p = (const uint8_t*)buf;
+
+  if (!crc32_table_ready) crc32_init_table();
+
+  crc = crc ^ 0xFFFFFFFFU;
+  while (length-- > 0)
+    crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFU;
+}
@@ -12,3 +12,6 @@
 #include <stdint.h>
 
 uint32_t hashlittle(const void *key, size_t length, uint32_t);
+
+// CRC-32 (IEEE 802.3), pass the previous value to continue a checksum
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t length);
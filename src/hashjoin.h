@@ -0,0 +1,219 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_HASH_JOIN_H
+#define MIMIR_HASH_JOIN_H
+
+#include <vector>
+#include "log.h"
+#include "config.h"
+#include "memory.h"
+#include "interface.h"
+#include "serializer.h"
+#include "hashbucket.h"
+#include "bloomfilter.h"
+
+namespace MIMIR_NS {
+
+// Maximum number of split key candidates reported by one process
+#define JOIN_MAX_SPLIT_KEYS 1024
+
+struct JoinEntry {
+    int64_t head;              // last record of the key
+};
+
+// Hash table of the build side of a join. The records are copied into
+// pages and chained per key by their index, so probing a key walks its
+// records without building a value list.
+template <typename KeyType, typename ValType>
+class HashJoiner : public Writable<KeyType,ValType> {
+  public:
+    HashJoiner(int keycount, int valcount) {
+        this->keycount = keycount;
+        this->valcount = valcount;
+        ser = new Serializer<KeyType, ValType>(keycount, valcount);
+        h = new HashBucket<JoinEntry>();
+        pagesize = DATA_PAGE_SIZE;
+        pageoff = pagesize;
+        mem_bytes = 0;
+    }
+
+    virtual ~HashJoiner() {
+        for (size_t i = 0; i < pages.size(); i++) {
+            mem_aligned_free(pages[i]);
+        }
+        delete h;
+        delete ser;
+    }
+
+    virtual int open() { return true; }
+    virtual void close() {}
+    virtual int seek(DB_POS pos) { return true; }
+    virtual uint64_t get_record_count() { return records.size(); }
+
+    virtual int write(KeyType *key, ValType *val) {
+        int kvsize = ser->get_kv_bytes(key, val);
+        char *ptr = get_space(kvsize);
+        ser->kv_to_bytes(key, val, ptr, kvsize);
+        insert(ptr, ser->get_key_bytes(key));
+        return true;
+    }
+
+    // Add records serialized back to back
+    void add(const char *buf, int64_t bufsize) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+        int64_t off = 0;
+        while (off < bufsize) {
+            int kvsize = ser->kv_from_bytes(&key, &val, (char*)buf + off,
+                                            (int)(bufsize - off));
+            int keysize = ser->get_key_bytes(key);
+            char *ptr = get_space(kvsize);
+            memcpy(ptr, buf + off, kvsize);
+            insert(ptr, keysize);
+            off += kvsize;
+        }
+    }
+
+    // Index of the last record of a key, or -1
+    int64_t find(KeyType *key) {
+        JoinEntry *entry = h->findEntry(ser->get_key_ptr(key),
+                                        ser->get_key_bytes(key));
+        if (entry == NULL) return -1;
+        return entry->head;
+    }
+
+    // Index of the previous record of the same key, or -1
+    int64_t next(int64_t idx) {
+        return chain[idx];
+    }
+
+    void get(int64_t idx, KeyType *key, ValType *val) {
+        ser->kv_from_bytes(key, val, records[idx], MAX_RECORD_SIZE);
+    }
+
+    uint64_t get_mem_usage() { return mem_bytes; }
+    uint64_t get_key_count() { return h->get_nunique(); }
+
+    void add_keys(BloomFilter *filter) {
+        typename HashBucket<JoinEntry>::HashEntry *entry = NULL;
+        h->open();
+        while ((entry = h->next()) != NULL) {
+            filter->add(entry->key, entry->keysize);
+        }
+        h->close();
+    }
+
+  private:
+    char *get_space(int kvsize) {
+        if (kvsize > pagesize)
+            LOG_ERROR("Error: KV size (%d) is larger than one page (%ld)\n",
+                      kvsize, pagesize);
+        if (pageoff + kvsize > pagesize) {
+            pages.push_back((char*)mem_aligned_malloc(MEMPAGE_SIZE, pagesize));
+            pageoff = 0;
+            mem_bytes += pagesize;
+        }
+        char *ptr = pages.back() + pageoff;
+        pageoff += kvsize;
+        return ptr;
+    }
+
+    // The key bytes lead the record, which stays in place
+    void insert(char *record, int keysize) {
+        int64_t idx = (int64_t)records.size();
+        records.push_back(record);
+        JoinEntry *entry = h->findEntry(record, keysize);
+        if (entry == NULL) {
+            JoinEntry newentry;
+            newentry.head = idx;
+            h->insertEntry(record, keysize, &newentry);
+            chain.push_back(-1);
+        } else {
+            chain.push_back(entry->head);
+            entry->head = idx;
+        }
+    }
+
+    int                           keycount, valcount;
+    Serializer<KeyType, ValType> *ser;
+    HashBucket<JoinEntry>        *h;
+    std::vector<char*>            pages;
+    int64_t                       pagesize, pageoff;
+    std::vector<char*>            records;
+    std::vector<int64_t>          chain;
+    uint64_t                      mem_bytes;
+};
+
+// Call the join callback with the values in the order of the datasets,
+// whichever side the hash table was built from
+template <bool build_first>
+struct JoinOrder {
+    template <typename Fn, typename K, typename BV, typename PV, typename O>
+    static void call(Fn fn, K *key, BV *bval, PV *pval, O *output, void *ptr) {
+        fn(key, bval, pval, output, ptr);
+    }
+};
+
+template <>
+struct JoinOrder<false> {
+    template <typename Fn, typename K, typename BV, typename PV, typename O>
+    static void call(Fn fn, K *key, BV *bval, PV *pval, O *output, void *ptr) {
+        fn(key, pval, bval, output, ptr);
+    }
+};
+
+// Probes the hash table with the records written to it (e.g. by a
+// shuffler) and passes the matches to the join callback
+template <typename KeyType, typename BuildValType, typename ValType,
+          typename OutKeyType, typename OutValType, bool build_first, typename Fn>
+class JoinProber : public Writable<KeyType,ValType> {
+  public:
+    JoinProber(HashJoiner<KeyType,BuildValType> *joiner,
+               Fn user_join, void *ptr, Writable<OutKeyType,OutValType> *out,
+               int keycount, int buildvalcount) {
+        this->joiner = joiner;
+        this->user_join = user_join;
+        this->ptr = ptr;
+        this->out = out;
+        this->keycount = keycount;
+        this->buildvalcount = buildvalcount;
+        record_count = 0;
+    }
+
+    virtual ~JoinProber() {}
+
+    virtual int open() { return true; }
+    virtual void close() {}
+    virtual int seek(DB_POS pos) { return true; }
+    virtual uint64_t get_record_count() { return record_count; }
+
+    virtual int write(KeyType *key, ValType *val) {
+        typename SafeType<KeyType>::type bkey[keycount];
+        typename SafeType<BuildValType>::type bval[buildvalcount];
+        int64_t idx = joiner->find(key);
+        while (idx != -1) {
+            joiner->get(idx, bkey, bval);
+            JoinOrder<build_first>::call(user_join, key, bval, val, out, ptr);
+            idx = joiner->next(idx);
+        }
+        record_count += 1;
+        return true;
+    }
+
+  private:
+    HashJoiner<KeyType,BuildValType>  *joiner;
+    Fn                                 user_join;
+    void                              *ptr;
+    Writable<OutKeyType,OutValType>   *out;
+    int                                keycount, buildvalcount;
+    uint64_t                           record_count;
+};
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_INDEX_FILE_H
+#define MIMIR_INDEX_FILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+namespace MIMIR_NS {
+
+// Indexed binary file:
+//
+//   | header | block 0 | block 1 | ... | block index | trailer |
+//
+// A block holds whole records serialized by Serializer, so any block can be
+// decoded alone. The block index (one BlockInfo and the serialized first key
+// per block) and the trailer are written when the file is closed; a reader
+// finds the index from the trailer at the end of the file.
+
+#define INDEX_FILE_MAGIC        0x4b4c4252494d494dULL   // "MIMIRBLK"
+#define INDEX_TRAILER_MAGIC     0x58444952494d494dULL   // "MIMIRIDX"
+#define INDEX_FILE_VERSION      1
+
+#define INDEX_FLAG_CHECKSUM     0x1
+
+enum IndexTypeCode {
+    ITYPE_VOID = 0, ITYPE_STRING = 1,
+    ITYPE_INT8, ITYPE_UINT8, ITYPE_INT16, ITYPE_UINT16,
+    ITYPE_INT32, ITYPE_UINT32, ITYPE_INT64, ITYPE_UINT64,
+    ITYPE_FLOAT, ITYPE_DOUBLE,
+    ITYPE_BYTES = 99            // other fixed-size type, see the size field
+};
+
+struct IndexFileHeader {
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    flags;
+    uint32_t    keytype;
+    uint32_t    valtype;
+    uint32_t    keysize;        // bytes of one key element, 0 for strings
+    uint32_t    valsize;
+    uint32_t    keycount;
+    uint32_t    valcount;
+    uint64_t    blocksize;      // target block size of the writer
+    uint64_t    reserved[2];
+};
+
+struct IndexFileTrailer {
+    uint64_t    indexoff;
+    uint64_t    indexsize;
+    uint64_t    blockcount;
+    uint64_t    recordcount;
+    uint64_t    maxblocksize;
+    uint64_t    magic;
+};
+
+struct BlockInfo {
+    uint64_t    offset;
+    uint32_t    size;
+    uint32_t    records;
+    uint32_t    checksum;
+    uint32_t    keysize;        // bytes of the first key following this entry
+};
+
+template <typename Type>
+class IndexType {
+  public:
+    typedef typename std::remove_cv<typename std::remove_pointer<Type>::type>::type base;
+
+    static uint32_t code() {
+        if (std::is_void<Type>::value) return ITYPE_VOID;
+        if (std::is_pointer<Type>::value && std::is_same<base, char>::value)
+            return ITYPE_STRING;
+        if (std::is_same<Type, int8_t>::value || std::is_same<Type, char>::value)
+            return ITYPE_INT8;
+        if (std::is_same<Type, uint8_t>::value) return ITYPE_UINT8;
+        if (std::is_same<Type, int16_t>::value) return ITYPE_INT16;
+        if (std::is_same<Type, uint16_t>::value) return ITYPE_UINT16;
+        if (std::is_same<Type, int32_t>::value) return ITYPE_INT32;
+        if (std::is_same<Type, uint32_t>::value) return ITYPE_UINT32;
+        if (std::is_same<Type, int64_t>::value) return ITYPE_INT64;
+        if (std::is_same<Type, uint64_t>::value) return ITYPE_UINT64;
+        if (std::is_same<Type, float>::value) return ITYPE_FLOAT;
+        if (std::is_same<Type, double>::value) return ITYPE_DOUBLE;
+        return ITYPE_BYTES;
+    }
+
+    static uint32_t size() {
+        if (code() == ITYPE_VOID || code() == ITYPE_STRING) return 0;
+        return (uint32_t)sizeof(typename std::conditional<std::is_void<Type>::value,
+                                char, Type>::type);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#include <unistd.h>
+
+#include "log.h"
+#include "config.h"
+#include "globals.h"
+#include "inputcache.h"
+
+using namespace MIMIR_NS;
+
+InputCache* InputCache::cache = NULL;
+
+CacheEntry *InputCache::find(const std::string &key) {
+    auto iter = entries.find(key);
+    if (iter == entries.end()) return NULL;
+    return &(iter->second);
+}
+
+void InputCache::insert(const std::string &key, BaseObject *data,
+                        const std::string &filename,
+                        uint64_t input_records, uint64_t kv_records) {
+    CacheEntry entry;
+    entry.data = data;
+    entry.filename = filename;
+    entry.input_records = input_records;
+    entry.kv_records = kv_records;
+    BaseObject::addRef(data);
+
+    // Processes that missed the cache map again and insert the same key
+    auto iter = entries.find(key);
+    if (iter != entries.end()) {
+        BaseObject::subRef(iter->second.data);
+        if (iter->second.filename.size() > 0
+            && iter->second.filename != filename)
+            unlink(iter->second.filename.c_str());
+    }
+    entries[key] = entry;
+
+    LOG_PRINT(DBG_GEN, "Input cache: insert entry %ld (records=%ld, file=%s)\n",
+              entries.size(), kv_records, filename.c_str());
+}
+
+void InputCache::clear() {
+    for (auto iter : entries) {
+        BaseObject::subRef(iter.second.data);
+        if (iter.second.filename.size() > 0)
+            unlink(iter.second.filename.c_str());
+    }
+    entries.clear();
+}
+
+std::string InputCache::get_spill_file() {
+    char filename[1024];
+    int len = snprintf(filename, sizeof(filename), "%s/mimir-cache.%d.%d.%d",
+                       CACHE_DIR, mimir_world_rank, (int)getpid(), spill_count++);
+    if (len < 0 || len >= (int)sizeof(filename))
+        LOG_ERROR("Error: the cache directory %s is too long!\n", CACHE_DIR);
+    return std::string(filename);
+}
@@ -0,0 +1,75 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_INPUT_CACHE_H
+#define MIMIR_INPUT_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+#include "interface.h"
+
+namespace MIMIR_NS {
+
+enum InputCacheMode { CACHE_NONE = 0, CACHE_MEMORY = 1, CACHE_DISK = 2 };
+
+struct CacheEntry {
+    BaseObject *data;           // resident dataset (CACHE_MEMORY)
+    std::string filename;       // spill file on local disk (CACHE_DISK)
+    uint64_t    input_records;
+    uint64_t    kv_records;
+};
+
+// Datasets produced by map() from input files. An entry is keyed by the
+// input files and everything that decides the map output (map callback,
+// partitioner, combiner, types), so a later map() with the same key takes
+// the partitioned records without reading files or shuffling. Entries live
+// until Mimir is finalized.
+class InputCache {
+  public:
+    static InputCache* getInputCache() {
+        if (cache == NULL) {
+            cache = new InputCache();
+        }
+        return cache;
+    }
+
+    static void destroyInputCache() {
+        if (cache != NULL) {
+            delete cache;
+            cache = NULL;
+        }
+    }
+
+    static InputCache *cache;
+
+  public:
+    InputCache() {
+        spill_count = 0;
+    }
+
+    ~InputCache() {
+        clear();
+    }
+
+    CacheEntry *find(const std::string &key);
+    void insert(const std::string &key, BaseObject *data, const std::string &filename,
+                uint64_t input_records, uint64_t kv_records);
+    void clear();
+
+    // A new spill file in CACHE_DIR
+    std::string get_spill_file();
+
+  private:
+    std::map<std::string, CacheEntry> entries;
+    int spill_count;
+};
+
+}
+
+#endif
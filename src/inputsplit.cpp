@@ -7,6 +7,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
 
@@ -44,6 +45,7 @@ void InputSplit::get_file_list(const char* filepath, int recurse) {
         seg.startrank = mimir_world_rank;
         seg.endrank = mimir_world_rank;
         seg.readorder = -1;
+        seg.mtime = (int64_t)inpath_stat.st_mtime;
         filesegs.push_back(seg);
     }
     else if (S_ISDIR(inpath_stat.st_mode)) {
@@ -77,11 +79,87 @@ void InputSplit::get_file_list(const char* filepath, int recurse) {
                 seg.startrank = mimir_world_rank;
                 seg.endrank = mimir_world_rank;
                 seg.readorder = -1;
+                seg.mtime = (int64_t)inpath_stat.st_mtime;
                 filesegs.push_back(seg);
             }
             else if (S_ISDIR(inpath_stat.st_mode) && recurse) {
                 get_file_list(newstr, recurse);
             }
         }
+        closedir(dp);
     }
 }
+
+void InputSplit::pack_seg(std::string& buf, const FileSeg& seg) {
+    uint64_t u64[4] = {seg.filesize, seg.startpos, seg.segsize, seg.maxsegsize};
+    int i32[3] = {seg.startrank, seg.endrank, seg.readorder};
+    buf.append(seg.filename.c_str(), seg.filename.size() + 1);
+    buf.append((const char*)u64, sizeof(u64));
+    buf.append((const char*)i32, sizeof(i32));
+}
+
+int InputSplit::unpack_seg(const char *buf, FileSeg *seg) {
+    uint64_t u64[4];
+    int i32[3];
+    int off = (int)strlen(buf) + 1;
+    seg->filename = buf;
+    memcpy(u64, buf + off, sizeof(u64));
+    off += (int)sizeof(u64);
+    memcpy(i32, buf + off, sizeof(i32));
+    off += (int)sizeof(i32);
+    seg->filesize = u64[0];
+    seg->startpos = u64[1];
+    seg->segsize = u64[2];
+    seg->maxsegsize = u64[3];
+    seg->startrank = i32[0];
+    seg->endrank = i32[1];
+    seg->readorder = i32[2];
+    seg->mtime = 0;
+    return off;
+}
+
+void InputSplit::pack(std::string& buf) {
+    for (size_t i = 0; i < filesegs.size(); i++)
+        pack_seg(buf, filesegs[i]);
+}
+
+void InputSplit::unpack(const char *buf, int64_t size) {
+    int64_t off = 0;
+    while (off < size) {
+        FileSeg seg;
+        off += unpack_seg(buf + off, &seg);
+        filesegs.push_back(seg);
+    }
+    if (off != size) LOG_ERROR("Error: unpack file list!\n");
+}
+
+void InputSplit::get_entries(const char* filepath, std::vector<std::string>& entries) {
+    struct stat inpath_stat;
+    int err = stat(filepath, &inpath_stat);
+    if (err) LOG_ERROR("Error in get input files filepath=%s, err=%d\n", filepath, err);
+
+    if (!S_ISDIR(inpath_stat.st_mode)) {
+        entries.push_back(filepath);
+        return;
+    }
+
+    struct dirent *ep;
+    DIR *dp = opendir(filepath);
+    if (!dp) LOG_ERROR("Error in get input files\n");
+
+    while ((ep = readdir(dp)) != NULL) {
+#ifdef BGQ
+        if (ep->d_name[1] == '.') continue;
+#else
+        if (ep->d_name[0] == '.') continue;
+#endif
+        char newstr[MAXLINE];
+#ifdef BGQ
+        sprintf(newstr, "%s/%s", filepath, &(ep->d_name[1]));
+#else
+        sprintf(newstr, "%s/%s", filepath, ep->d_name);
+#endif
+        entries.push_back(newstr);
+    }
+    closedir(dp);
+}
@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,7 @@ struct FileSeg {
     int         startrank;
     int         endrank;
     int         readorder;   // if -1
+    int64_t     mtime;       // modification time, not packed
 };
 
 class InputSplit {
@@ -100,6 +102,16 @@ class InputSplit {
 
     void print();
 
+    // Serialize the segments, e.g. to send them to another rank
+    void pack(std::string& buf);
+    void unpack(const char *buf, int64_t size);
+    static void pack_seg(std::string& buf, const FileSeg& seg);
+    static int  unpack_seg(const char *buf, FileSeg *seg);
+
+    // Entries of a path without stat: the path itself if it is a file,
+    // or the (non-hidden) entries of a directory
+    static void get_entries(const char *filepath, std::vector<std::string>& entries);
+
   private:
     void get_file_list(const char*, int);
 
@@ -21,6 +21,8 @@ class BaseObject {
     BaseObject(bool inner = false) {
         ref = 0;
         this->inner = inner;
+        part_fn = NULL;
+        part_count = 0;
     }
     virtual ~BaseObject() {}
     virtual int open() = 0;
@@ -32,6 +34,17 @@ class BaseObject {
         return inner;
     }
 
+    // The records are placed by the partitioner over part_count processes
+    void set_partition(void *part_fn, int part_count) {
+        this->part_fn = part_fn;
+        this->part_count = part_count;
+    }
+
+    bool is_partitioned(void *part_fn, int part_count) {
+        return this->part_count != 0 && this->part_fn == part_fn
+            && this->part_count == part_count;
+    }
+
     uint64_t getRef() {
         return ref;
     }
@@ -62,6 +75,8 @@ class BaseObject {
   private:
     uint64_t    ref;
     bool        inner;
+    void       *part_fn;
+    int         part_count;
 };
 
 template <typename KeyType, typename ValType>
@@ -0,0 +1,99 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_KEY_COMPARATOR_H
+#define MIMIR_KEY_COMPARATOR_H
+
+#include <string.h>
+#include <type_traits>
+#include "log.h"
+#include "serializer.h"
+
+namespace MIMIR_NS {
+
+// Natural order of keys: arithmetic keys by value and string keys by
+// strcmp, element by element. Other keys need a compare callback.
+template <typename KeyType, bool arithmetic = std::is_arithmetic<KeyType>::value>
+class KeyOrder {
+  public:
+    static int compare(KeyType *key1, KeyType *key2, int keycount) {
+        LOG_ERROR("Please set compare callback for this key type!\n");
+        return 0;
+    }
+};
+
+template <typename KeyType>
+class KeyOrder<KeyType, true> {
+  public:
+    static int compare(KeyType *key1, KeyType *key2, int keycount) {
+        for (int i = 0; i < keycount; i++) {
+            if (key1[i] < key2[i]) return -1;
+            if (key2[i] < key1[i]) return 1;
+        }
+        return 0;
+    }
+};
+
+template <>
+class KeyOrder<char*, false> {
+  public:
+    static int compare(char **key1, char **key2, int keycount) {
+        for (int i = 0; i < keycount; i++) {
+            int ret = strcmp(key1[i], key2[i]);
+            if (ret != 0) return ret;
+        }
+        return 0;
+    }
+};
+
+template <>
+class KeyOrder<const char*, false> {
+  public:
+    static int compare(const char **key1, const char **key2, int keycount) {
+        for (int i = 0; i < keycount; i++) {
+            int ret = strcmp(key1[i], key2[i]);
+            if (ret != 0) return ret;
+        }
+        return 0;
+    }
+};
+
+// Compare keys with the user callback, or in their natural order
+template <typename KeyType>
+class KeyComparator {
+  public:
+    KeyComparator(int (*user_compare)(KeyType *key1, KeyType *key2), int keycount) {
+        this->user_compare = user_compare;
+        this->keycount = keycount;
+    }
+
+    int compare(KeyType *key1, KeyType *key2) {
+        if (user_compare != NULL) return user_compare(key1, key2);
+        return KeyOrder<KeyType>::compare(key1, key2, keycount);
+    }
+
+    // Compare serialized keys (records start with the key bytes)
+    int compare_bytes(char *buf1, char *buf2) {
+        typename SafeType<KeyType>::type key1[keycount], key2[keycount];
+        bytestream<KeyType>::from_bytes(key1, keycount, buf1);
+        bytestream<KeyType>::from_bytes(key2, keycount, buf2);
+        return compare(key1, key2);
+    }
+
+    // Order records by their keys
+    bool operator()(char *buf1, char *buf2) {
+        return compare_bytes(buf1, buf2) < 0;
+    }
+
+  private:
+    int (*user_compare)(KeyType *key1, KeyType *key2);
+    int keycount;
+};
+
+}
+
+#endif
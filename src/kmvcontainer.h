@@ -8,19 +8,93 @@
 #ifndef MIMIR_KMV_CONTAINER_H
 #define MIMIR_KMV_CONTAINER_H
 
+#include <vector>
+#include <algorithm>
 #include "config.h"
 #include "hashbucket.h"
 #include "container.h"
 #include "interface.h"
 #include "serializer.h"
+#include "keycomparator.h"
 
 namespace MIMIR_NS {
 
 template <typename KeyType, typename ValType>
 class KMVItem;
 
+// Sorts the serialized values of a group in place (secondary sort);
+// values that compare equal keep their order
 template <typename KeyType, typename ValType>
-class KMVContainer {
+class GroupValueSorter {
+  public:
+    GroupValueSorter(int (*user_compare)(ValType *val1, ValType *val2),
+                     int keycount, int valcount)
+        : cmp(user_compare, valcount) {
+        this->valcount = valcount;
+        ser = new Serializer<KeyType, ValType>(keycount, valcount);
+    }
+
+    ~GroupValueSorter() {
+        delete ser;
+    }
+
+    void sort(char *values_start, char *values_end) {
+        typename SafeType<ValType>::type val[valcount];
+        values.clear();
+        char *ptr = values_start;
+        while (ptr < values_end) {
+            values.push_back(ptr);
+            ptr += ser->val_from_bytes(val, ptr, (int)(values_end - ptr));
+        }
+        if (values.size() < 2) return;
+
+        std::stable_sort(values.begin(), values.end(), cmp);
+
+        buffer.resize(values_end - values_start);
+        int64_t off = 0;
+        for (size_t i = 0; i < values.size(); i++) {
+            int vsize = ser->val_from_bytes(val, values[i], (int)(values_end - values[i]));
+            memcpy(buffer.data() + off, values[i], vsize);
+            off += vsize;
+        }
+        memcpy(values_start, buffer.data(), off);
+    }
+
+  private:
+    KeyComparator<ValType>        cmp;
+    int                           valcount;
+    Serializer<KeyType, ValType> *ser;
+    std::vector<char*>            values;
+    std::vector<char>             buffer;
+};
+
+// Groups the records by key for reduce
+template <typename KeyType, typename ValType>
+class BaseKMVContainer {
+  public:
+    BaseKMVContainer() { val_sorter = NULL; }
+    virtual ~BaseKMVContainer() {
+        if (val_sorter != NULL) delete val_sorter;
+    }
+    virtual int open() = 0;
+    virtual void close() = 0;
+    virtual KMVItem<KeyType, ValType>* read() = 0;
+    virtual uint64_t get_record_count() = 0;
+    virtual void convert(Readable<KeyType,ValType> *kv) = 0;
+
+    // The values of each group are read in order; the container takes
+    // the sorter
+    void set_value_sorter(GroupValueSorter<KeyType,ValType> *sorter) {
+        val_sorter = sorter;
+    }
+
+  protected:
+    GroupValueSorter<KeyType,ValType> *val_sorter;
+};
+
+// Hash-based grouping
+template <typename KeyType, typename ValType>
+class KMVContainer : public BaseKMVContainer<KeyType, ValType> {
   public:
     KMVContainer(int keycount, int valcount, int hashscale) {
         this->keycount = keycount;
@@ -56,7 +130,8 @@ class KMVContainer {
     virtual KMVItem<KeyType, ValType>* read() {
         HashBucket<ReducerVal>::HashEntry *entry = h->next();
         if (entry != NULL) {
-            kmv->set_entry(entry);
+            kmv->set_group(entry->key, entry->keysize,
+                           entry->val.values_start, entry->val.values_end);
             return kmv;
         }
         return NULL;
@@ -64,7 +139,7 @@ class KMVContainer {
 
     virtual uint64_t get_record_count() { return kmvcount; }
 
-    void convert(Readable<KeyType,ValType> *kv) {
+    virtual void convert(Readable<KeyType,ValType> *kv) {
         int valbytes = 0;
         typename SafeType<KeyType>::type key[keycount];
         typename SafeType<ValType>::type val[valcount];
@@ -75,8 +150,8 @@ class KMVContainer {
         kv->open();
         while ((kv->read(key, val)) == true) {
             keybytes = ser->key_to_bytes(key, keyarray, MAX_RECORD_SIZE);
+            valbytes = ser->get_val_bytes(val);
             if ((rdc_val = h->findEntry(keyarray, keybytes)) == NULL) {
-                valbytes = ser->get_val_bytes(val);
                 ReducerVal tmpval;
                 tmpval.valbytes = valbytes;
                 h->insertEntry(keyarray, keybytes, &tmpval);
@@ -131,6 +206,14 @@ class KMVContainer {
         }
         kv->close();
 
+        if (this->val_sorter != NULL) {
+            h->open();
+            while ((entry = h->next()) != NULL) {
+                this->val_sorter->sort(entry->val.values_start, entry->val.values_end);
+            }
+            h->close();
+        }
+
         PROFILER_RECORD_COUNT(COUNTER_MAX_KMVS, (uint64_t)(h->get_nunique()), OPMAX);
         LOG_PRINT(DBG_GEN, "MapReduce: convert end (KMVs=%ld).\n", h->get_nunique());
     }
@@ -158,7 +241,10 @@ class KMVItem : public Readable<KeyType, ValType>   {
     KMVItem(int keycount, int valcount) {
         this->keycount = keycount;
         this->valcount = valcount;
-        this->entry = NULL;
+        this->key = NULL;
+        this->keysize = 0;
+        this->values_start = NULL;
+        this->values_end = NULL;
         this->valptr = NULL;
         ser = new Serializer<KeyType, ValType>(keycount, valcount);
     }
@@ -167,12 +253,16 @@ class KMVItem : public Readable<KeyType, ValType>   {
         delete ser;
     }
 
-    void set_entry(HashBucket<ReducerVal>::HashEntry* entry) {
-        this->entry = entry;
+    // The key bytes and the serialized values of one group
+    void set_group(char *key, int keysize, char *values_start, char *values_end) {
+        this->key = key;
+        this->keysize = keysize;
+        this->values_start = values_start;
+        this->values_end = values_end;
     }
 
     virtual int open() {
-        valptr = entry->val.values_start;
+        valptr = values_start;
         return true;
     }
 
@@ -182,21 +272,21 @@ class KMVItem : public Readable<KeyType, ValType>   {
 
     virtual int seek(DB_POS pos) {
         if (pos == DB_START) {
-            valptr = entry->val.values_start;
+            valptr = values_start;
         } else if (pos == DB_END) {
-            valptr = entry->val.values_end;
+            valptr = values_end;
         }
         return true;
     }
 
     virtual int read(KeyType *key, ValType *val) {
-        if (valptr == entry->val.values_end) {
-            valptr = entry->val.values_start;
+        if (valptr == values_end) {
+            valptr = values_start;
             return false;
         }
-        ser->key_from_bytes(key, entry->key, entry->keysize);
+        ser->key_from_bytes(key, this->key, keysize);
         int vsize = ser->val_from_bytes(val, valptr, 
-                                        (int)(entry->val.values_end - valptr));
+                                        (int)(values_end - valptr));
         valptr += vsize;
         return true;
     }
@@ -206,7 +296,9 @@ class KMVItem : public Readable<KeyType, ValType>   {
     }
 
   private:
-    HashBucket<ReducerVal>::HashEntry* entry;
+    char *key;
+    int keysize;
+    char *values_start, *values_end;
     char *valptr;
     int keycount, valcount;
     Serializer<KeyType, ValType> *ser;
@@ -11,10 +11,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <set>
+#include <vector>
+#include <algorithm>
 #include "container.h"
 #include "containeriter.h"
 #include "interface.h"
 #include "serializer.h"
+#include "keycomparator.h"
 #include "stat.h"
 
 namespace MIMIR_NS {
@@ -164,6 +167,83 @@ public:
 
     virtual uint64_t get_record_count() { return kvcount; }
 
+    // Save the pages to a file, which load() reads back
+    void dump(const char *filename) {
+        FILE *fp = fopen(filename, "wb");
+        if (fp == NULL) LOG_ERROR("Open file %s error!\n", filename);
+        uint64_t npages = pages.size();
+        if (fwrite(&kvcount, sizeof(uint64_t), 1, fp) != 1
+            || fwrite(&kvmem, sizeof(uint64_t), 1, fp) != 1
+            || fwrite(&npages, sizeof(uint64_t), 1, fp) != 1)
+            LOG_ERROR("Write file %s error!\n", filename);
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (fwrite(&(pages[i].datasize), sizeof(int64_t), 1, fp) != 1
+                || fwrite(pages[i].buffer, 1, pages[i].datasize, fp)
+                   != (size_t)pages[i].datasize)
+                LOG_ERROR("Write file %s error!\n", filename);
+        }
+        fclose(fp);
+    }
+
+    void load(const char *filename) {
+        uint64_t npages = 0;
+        FILE *fp = fopen(filename, "rb");
+        if (fp == NULL) LOG_ERROR("Open file %s error!\n", filename);
+        if (fread(&kvcount, sizeof(uint64_t), 1, fp) != 1
+            || fread(&kvmem, sizeof(uint64_t), 1, fp) != 1
+            || fread(&npages, sizeof(uint64_t), 1, fp) != 1)
+            LOG_ERROR("Read file %s error!\n", filename);
+        for (uint64_t i = 0; i < npages; i++) {
+            size_t id = add_page();
+            if (fread(&(pages[id].datasize), sizeof(int64_t), 1, fp) != 1
+                || pages[id].datasize > pagesize
+                || fread(pages[id].buffer, 1, pages[id].datasize, fp)
+                   != (size_t)pages[id].datasize)
+                LOG_ERROR("Read file %s error!\n", filename);
+        }
+        fclose(fp);
+    }
+
+    // Sort the records by key; they are copied into new pages in order
+    void sort(KeyComparator<KeyType> *cmp) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+        std::vector<char*> records;
+        std::vector<Page> old_pages;
+
+        garbage_collection();
+
+        records.reserve(kvcount);
+        for (size_t i = 0; i < pages.size(); i++) {
+            int64_t off = 0;
+            while (off < pages[i].datasize) {
+                records.push_back(pages[i].buffer + off);
+                off += this->ser->kv_from_bytes(&key, &val, pages[i].buffer + off,
+                                                (int)(pages[i].datasize - off));
+            }
+        }
+        std::sort(records.begin(), records.end(), *cmp);
+
+        old_pages.swap(pages);
+        pageid = 0;
+        for (size_t i = 0; i < records.size(); i++) {
+            int recsize = this->ser->kv_from_bytes(&key, &val, records[i], MAX_RECORD_SIZE);
+            if (pages.size() == 0 || pages[pageid].datasize + recsize > pagesize)
+                pageid = add_page();
+            memcpy(pages[pageid].buffer + pages[pageid].datasize, records[i], recsize);
+            pages[pageid].datasize += recsize;
+        }
+        for (size_t i = 0; i < old_pages.size(); i++) {
+            mem_aligned_free(old_pages[i].buffer);
+            BaseDatabase<KeyType, ValType>::mem_bytes -= pagesize;
+        }
+
+        pageid = 0;
+        pageoff = 0;
+        ptr = NULL;
+        kvsize = 0;
+    }
+
     void print(int rank, int size) {
         size_t count = 0;
         for (unsigned i = 0; i < slices.bucket_count(); ++i) {
@@ -44,6 +44,7 @@ void mimir_finalize()
     }
     else mimir_stat("Mimir");
     //}
+    MIMIR_NS::InputCache::destroyInputCache();
     UNINIT_STAT;
     //MPI_Comm_free(&mimir_world_comm);
     //printf("%d[%d] Mimir Finalize.\n",
@@ -169,6 +170,26 @@ void get_default_values()
         }
     }
 
+    // block size of indexed output files
+    env = getenv("MIMIR_BLOCK_SIZE");
+    if (env) {
+        OUTPUT_BLOCK_SIZE = convert_to_int64(env);
+        // The index keeps the size of a block in 32 bits
+        if (OUTPUT_BLOCK_SIZE <= 0 || OUTPUT_BLOCK_SIZE > (int64_t)UINT32_MAX)
+            LOG_ERROR
+                ("Error: set block size error, please set MIMIR_BLOCK_SIZE (%s) correctly!\n",
+                 env);
+    }
+    // stripe size of the aggregated writer
+    env = getenv("MIMIR_WRITE_STRIPE");
+    if (env) {
+        WRITE_STRIPE_SIZE = convert_to_int64(env);
+        if (WRITE_STRIPE_SIZE <= 0)
+            LOG_ERROR
+                ("Error: set write stripe error, please set MIMIR_WRITE_STRIPE (%s) correctly!\n",
+                 env);
+    }
+
     /// Settings
     // shuffle type
     env = getenv("MIMIR_SHUFFLE_TYPE");
@@ -206,6 +227,12 @@ void get_default_values()
 	else if (strcmp(env, "mpiio") == 0) {
             READ_TYPE = 1;
         }
+        else if (strcmp(env, "mmap") == 0) {
+            READ_TYPE = 2;
+        }
+        else if (strcmp(env, "uring") == 0) {
+            READ_TYPE = 3;
+        }
     }
     // write type
     env = getenv("MIMIR_WRITE_TYPE");
@@ -216,6 +243,9 @@ void get_default_values()
 	else if (strcmp(env, "mpiio") == 0) {
             WRITE_TYPE = 1;
         }
+        else if (strcmp(env, "aggr") == 0) {
+            WRITE_TYPE = 2;
+        }
     }
     // direct read
     env = getenv("MIMIR_DIRECT_READ");
@@ -227,6 +257,53 @@ void get_default_values()
     if (env) {
         DIRECT_WRITE = atoi(env);
     }
+    // number of input chunks prefetched ahead of the map
+    env = getenv("MIMIR_READ_PREFETCH");
+    if (env) {
+        READ_PREFETCH = atoi(env);
+        if (READ_PREFETCH < 0)
+            LOG_ERROR("Error: set read prefetch error, please set MIMIR_READ_PREFETCH (%s) correctly!\n",
+                      env);
+    }
+    // number of output buffers written in the background
+    env = getenv("MIMIR_WRITE_BEHIND");
+    if (env) {
+        WRITE_BEHIND = atoi(env);
+        if (WRITE_BEHIND < 0)
+            LOG_ERROR("Error: set write behind error, please set MIMIR_WRITE_BEHIND (%s) correctly!\n",
+                      env);
+    }
+    // number of aggregators per node of the aggregated writer
+    env = getenv("MIMIR_WRITE_AGGREGATORS");
+    if (env) {
+        WRITE_AGGREGATORS = atoi(env);
+        if (WRITE_AGGREGATORS <= 0)
+            LOG_ERROR("Error: set write aggregators error, please set MIMIR_WRITE_AGGREGATORS (%s) correctly!\n",
+                      env);
+    }
+    // checksum blocks of indexed output files
+    env = getenv("MIMIR_BLOCK_CHECKSUM");
+    if (env) {
+        BLOCK_CHECKSUM = atoi(env);
+    }
+    // group the records of reduce by hash or by sort
+    env = getenv("MIMIR_GROUP_TYPE");
+    if (env) {
+        if (strcmp(env, "hash") == 0) {
+            GROUP_TYPE = 0;
+        } else if (strcmp(env, "sort") == 0) {
+            GROUP_TYPE = 1;
+        }
+    }
+    // max bytes of a sorted run of sort grouping
+    env = getenv("MIMIR_GROUP_RUN_SIZE");
+    if (env) {
+        GROUP_RUN_SIZE = convert_to_int64(env);
+        if (GROUP_RUN_SIZE <= 0)
+            LOG_ERROR
+                ("Error: set group run size error, please set MIMIR_GROUP_RUN_SIZE (%s) correctly!\n",
+                 env);
+    }
 
     /// Features
     // work steal or not
@@ -239,6 +316,14 @@ void get_default_values()
     if (env) {
         MAKE_PROGRESS = atoi(env);
     }
+    // chunks taken by one steal
+    env = getenv("MIMIR_STEAL_BATCH");
+    if (env) {
+        STEAL_BATCH = atoi(env);
+        if (STEAL_BATCH <= 0) {
+            LOG_ERROR("Error: the steal batch (%d) should be larger than 0!\n", STEAL_BATCH);
+        }
+    }
     // balance load
     //env = getenv("MIMIR_CONTAINER_TYPE");
     //if (env) {
@@ -283,12 +368,69 @@ void get_default_values()
     if (env) {
         BALANCE_FREQ = atoi(env);
     }
+    // move groups among processes before reduce
+    env = getenv("MIMIR_REDUCE_BALANCE");
+    if (env) {
+        int flag = atoi(env);
+        if (flag == 0) {
+            REDUCE_BALANCE = 0;
+        } else {
+            REDUCE_BALANCE = 1;
+        }
+    }
+    // bypass the combiner of the shuffle below this hit ratio
+    env = getenv("MIMIR_COMBINE_BYPASS");
+    if (env) {
+        COMBINE_BYPASS = atof(env);
+        if (COMBINE_BYPASS < 0.0 || COMBINE_BYPASS > 1.0) {
+            LOG_ERROR("Error: the combine bypass ratio (%s) should be in [0, 1]!\n", env);
+        }
+    }
 
     // balance memory among nodes
     env = getenv("MIMIR_USE_MCDRAM");
     if (env) {
         USE_MCDRAM = atoi(env);
     }
+    // cache the map output of input files
+    env = getenv("MIMIR_INPUT_CACHE");
+    if (env) {
+        INPUT_CACHE = atoi(env);
+        if (INPUT_CACHE < 0 || INPUT_CACHE > 2) {
+            LOG_ERROR("Error: the input cache mode (%d) should be 0, 1 or 2!\n", INPUT_CACHE);
+        }
+    }
+    // local directory of spilled cache entries
+    env = getenv("MIMIR_CACHE_DIR");
+    if (env) {
+        CACHE_DIR = env;
+    }
+    // max size of a dataset broadcast by join
+    env = getenv("MIMIR_JOIN_BCAST_SIZE");
+    if (env) {
+        JOIN_BCAST_SIZE = convert_to_int64(env);
+    }
+    // split join keys with more records than this share of one process
+    env = getenv("MIMIR_JOIN_SPLIT_RATIO");
+    if (env) {
+        JOIN_SPLIT_RATIO = atof(env);
+    }
+    // bits per key of the join Bloom filter
+    env = getenv("MIMIR_JOIN_BLOOM_BITS");
+    if (env) {
+        JOIN_BLOOM_BITS = atoi(env);
+        if (JOIN_BLOOM_BITS < 0) {
+            LOG_ERROR("Error: the bits per key of join filter (%d) should be >= 0!\n", JOIN_BLOOM_BITS);
+        }
+    }
+    // sampled keys per process of sort
+    env = getenv("MIMIR_SORT_SAMPLES");
+    if (env) {
+        SORT_SAMPLES = atoi(env);
+        if (SORT_SAMPLES <= 0) {
+            LOG_ERROR("Error: the sort samples (%d) should be > 0!\n", SORT_SAMPLES);
+        }
+    }
 
     /// Profile & Debug
     // output stat file
@@ -413,20 +555,33 @@ Library configuration:\n\
 \thash bucket size: %d\n\
 \tmax record size: %d\n\
 \tshuffle type: %d (0 - MPI_Alltoallv; 1 - MPI_Ialltoallv [%d,%d])\n\
-\treader type: %d (0 - POSIX; 1 - MPIIO) direct read=%d\n\
-\twriter type: %d (0 - POSIX; 1 - MPIIO) direct write=%d\n\
-\twork stealing: %d (make progress=%d)\n\
-\tload balance: balance=%d, factor=%.2lf, bin=%d, freq=%d\n\
+\treader type: %d (0 - POSIX; 1 - MPIIO; 2 - MMAP; 3 - URING) direct read=%d prefetch=%d\n\
+\twriter type: %d (0 - POSIX; 1 - MPIIO; 2 - AGGR [%d,%ld]) direct write=%d write behind=%d\n\
+\tindexed file: block size=%ld, checksum=%d\n\
+\tgroup type: %d (0 - hash; 1 - sort [run=%ld])\n\
+\twork stealing: %d (make progress=%d, steal batch=%d)\n\
+\tload balance: balance=%d, factor=%.2lf, bin=%d, freq=%d, reduce=%d\n\
+\tcombiner: bypass ratio=%.2lf\n\
 \tMCDRAM: use_mcdram=%d\n\
+\tinput cache: %d (0 - off; 1 - memory; 2 - disk) dir=%s\n\
+\tjoin: broadcast size=%ld, split ratio=%.2lf, bloom bits=%d\n\
+\tsort: samples=%d\n\
 \tstat & debug: output profile=%d, output trace=%d, stat file=%s, debug level=%x\n\
 ***********************************************************************\n",
         COMM_BUF_SIZE, DATA_PAGE_SIZE, INPUT_BUF_SIZE, BUCKET_COUNT, MAX_RECORD_SIZE,
         SHUFFLE_TYPE, MIN_SBUF_COUNT, MAX_SBUF_COUNT,
-        READ_TYPE, DIRECT_READ, WRITE_TYPE, DIRECT_WRITE,
-        WORK_STEAL, MAKE_PROGRESS,
+        READ_TYPE, DIRECT_READ, READ_PREFETCH, WRITE_TYPE, WRITE_AGGREGATORS, WRITE_STRIPE_SIZE,
+        DIRECT_WRITE, WRITE_BEHIND,
+        OUTPUT_BLOCK_SIZE, BLOCK_CHECKSUM,
+        GROUP_TYPE, GROUP_RUN_SIZE,
+        WORK_STEAL, MAKE_PROGRESS, STEAL_BATCH,
         //CONTAINER_TYPE,
-        BALANCE_LOAD, BALANCE_FACTOR, BIN_COUNT, BALANCE_FREQ,
+        BALANCE_LOAD, BALANCE_FACTOR, BIN_COUNT, BALANCE_FREQ, REDUCE_BALANCE,
+        COMBINE_BYPASS,
         USE_MCDRAM,
+        INPUT_CACHE, CACHE_DIR,
+        JOIN_BCAST_SIZE, JOIN_SPLIT_RATIO, JOIN_BLOOM_BITS,
+        SORT_SAMPLES,
         OUTPUT_STAT, OUTPUT_TRACE, STAT_FILE, DBG_LEVEL);
         fflush(stdout);
     }
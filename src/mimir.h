@@ -15,6 +15,7 @@
 #include "filereader.h"
 #include "filewriter.h"
 #include "kvcontainer.h"
+#include "inputcache.h"
 #include "mimircontext.h"
 #include "tools.h"
 
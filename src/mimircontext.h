@@ -24,8 +24,10 @@
 #include "kvcontainer.h"
 #include "combinekvcontainer.h"
 #include "bincontainer.h"
-#include "combinebincontainer.h"
 #include "kmvcontainer.h"
+#include "sortkmvcontainer.h"
+#include "topk.h"
+#include "splitkeyrouter.h"
 #include "uniteddataset.h"
 #include "collectiveshuffler.h"
 #include "nbcollectiveshuffler.h"
@@ -34,9 +36,18 @@
 #include "filereader.h"
 #include "filewriter.h"
 #include "hashbucket.h"
+#include "inputcache.h"
+#include "streammapper.h"
+#include "hashjoin.h"
+#include "keycomparator.h"
+#include "rangepartitioner.h"
 
 #include <vector>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <queue>
+#include <functional>
 
 namespace MIMIR_NS {
 
@@ -83,6 +94,55 @@ class MimirContext {
         if (this->user_database == NULL) LOG_ERROR("Cannot convert user database\n");
     }
 
+    // Set input file format ("text", "binary" or "indexed"); binary and
+    // indexed files are the output of FileWriter with the same format
+    void set_input_format(const char *format = "text") {
+        if (strcmp(format, "text") == 0) {
+            input_format = TextFileFormat;
+        } else if (strcmp(format, "binary") == 0) {
+            input_format = BinaryFileFormat;
+        } else if (strcmp(format, "indexed") == 0) {
+            input_format = IndexedFileFormat;
+        } else {
+            LOG_ERROR("Wrong input format (%s)!\n", format);
+        }
+    }
+
+    // Skip blocks of indexed input files; the filter gets the first key of
+    // a block and of the next block (NULL for the last one)
+    void set_block_filter(bool (*filter_fn)(InKeyType *first, InKeyType *next, void *ptr),
+                          void *ptr = NULL) {
+        this->user_block_filter = filter_fn;
+        this->user_block_ptr = ptr;
+    }
+
+    // Cache the map output of the input files (see InputCacheMode)
+    void set_input_cache(int mode) {
+        if (mode < CACHE_NONE || mode > CACHE_DISK)
+            LOG_ERROR("Wrong input cache mode (%d)!\n", mode);
+        this->cache_mode = mode;
+    }
+
+    // Secondary sort: reduce reads the values of each key in order, by the
+    // compare callback or by their natural order (arithmetic and string
+    // values)
+    void set_secondary_sort(bool enable,
+                            int (*compare_fn)(ValType *val1, ValType *val2) = NULL) {
+        this->secondary_sort = enable;
+        this->user_val_compare = compare_fn;
+    }
+
+    // Merge the split keys of map(split_hint): reduce gives partial
+    // results for them, which are shuffled to one process and reduced
+    // again there. The reduce callback must accept its own output, as a
+    // combiner does, so the output types must be the input types.
+    void set_split_merge(bool enable) {
+        if (enable && !(std::is_same<KeyType,OutKeyType>::value
+                        && std::is_same<ValType,OutValType>::value))
+            LOG_ERROR("The split keys can only be merged when reduce outputs its input types!\n");
+        this->merge_split = enable;
+    }
+
     // Get data handle
     BaseObject *get_data_handle() {
         return database;
@@ -96,6 +156,30 @@ class MimirContext {
         in_databases.push_back(ptr);
     }
 
+    // Mark the data of this context as partitioned by key, so contexts
+    // with the same partitioner can attach it without moving it. It fails
+    // when the data was not placed by the partitioner alone (reduce output,
+    // load balancing or split keys).
+    bool persist() {
+        if (database == NULL || !db_partitioned) {
+            LOG_WARNING("The data is not partitioned by key and cannot be persisted!\n");
+            return false;
+        }
+        database->set_partition((void*)user_partition, mimir_ctx_size);
+        return true;
+    }
+
+    // Attach a persistent dataset. It is not mapped or shuffled; the next
+    // reduce groups it with the data of this context.
+    void attach_data_handle(BaseObject *handle) {
+        if (dynamic_cast<Readable<KeyType,ValType>*>(handle) == NULL)
+            LOG_ERROR("The handle attached is not valid!\n");
+        if (!handle->is_partitioned((void*)user_partition, mimir_ctx_size))
+            LOG_ERROR("The handle attached is not partitioned as this context!\n");
+        BaseObject::addRef(handle);
+        attached_databases.push_back(handle);
+    }
+
     // Map
     uint64_t map(void (*user_map)(Readable<InKeyType,InValType> *input, 
                                   Writable<KeyType,ValType> *output, void *ptr),
@@ -110,7 +194,7 @@ class MimirContext {
         std::vector<Readable<InKeyType,InValType>*> inputs;
         UnitedDataset<InKeyType,InValType> *united_input = NULL;
         Writable<KeyType,ValType> *output = NULL;
-        FileReader<TextFileFormat,KeyType,ValType,InKeyType,InValType> *reader = NULL;
+        BaseFileReader<KeyType,ValType,InKeyType,InValType> *reader = NULL;
         FileWriter<KeyType,ValType> *writer = NULL;
         ChunkManager<KeyType,ValType> *chunk_mgr = NULL;
 
@@ -121,6 +205,26 @@ class MimirContext {
 
         LOG_PRINT(DBG_GEN, "MapReduce: map start\n");
 
+        // Only the output of input files into this context is cached
+        std::string cache_key;
+        if (cache_mode != CACHE_NONE && input_dir.size() > 0
+            && in_databases.size() == 0 && database == NULL
+            && user_database == NULL && !output_file && !split_hint) {
+            cache_key = get_cache_key((void*)user_map, ptr, do_shuffle);
+            if (map_from_cache(cache_key)) {
+                uint64_t total_records = 0;
+                PROFILER_RECORD_TIME_START;
+                MPI_Allreduce(&kv_records, &total_records, 1,
+                              MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+                PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+                db_partitioned = do_shuffle && is_hash_partitioned(false);
+                db_split = false;
+                TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+                LOG_PRINT(DBG_GEN, "MapReduce: map done from cache (KVs=%ld)\n", kv_records);
+                return total_records;
+            }
+        }
+
         /////////////// get input objects ////////////////////
         // Input from outside
         if (in_databases.size() != 0) {
@@ -138,7 +242,34 @@ class MimirContext {
             inputs.push_back(input);
         }
         // Input from files
-        if (input_dir.size() > 0) {
+        if (input_dir.size() > 0 && input_format == BinaryFileFormat) {
+            // Binary files are read whole by one process
+            chunk_mgr = new ChunkManager<KeyType,ValType>(mimir_ctx_comm, input_dir, BYNAME);
+            reader = FileReader<BinaryFileFormat,KeyType,ValType,InKeyType,InValType>::getReader(mimir_ctx_comm,
+                                                                                                 chunk_mgr, user_padding,
+                                                                                                 keycount, valcount,
+                                                                                                 inkeycount, invalcount);
+            Readable<InKeyType,InValType>* input = dynamic_cast<Readable<InKeyType,InValType>*>(reader);
+            inputs.push_back(input);
+        }
+        else if (input_dir.size() > 0 && input_format == IndexedFileFormat) {
+            // Blocks never cross chunks, so the chunks can be stolen
+            if (WORK_STEAL) {
+                chunk_mgr = new StealChunkManager<KeyType,ValType>(mimir_ctx_comm, input_dir, BYSIZE);
+            } else {
+                chunk_mgr = new ChunkManager<KeyType,ValType>(mimir_ctx_comm, input_dir, BYSIZE);
+            }
+            IndexedFileReader<KeyType,ValType,InKeyType,InValType> *idx_reader
+                = new IndexedFileReader<KeyType,ValType,InKeyType,InValType>(mimir_ctx_comm, chunk_mgr,
+                                                                             keycount, valcount,
+                                                                             inkeycount, invalcount);
+            if (user_block_filter != NULL)
+                idx_reader->set_block_filter(user_block_filter, user_block_ptr);
+            reader = idx_reader;
+            Readable<InKeyType,InValType>* input = dynamic_cast<Readable<InKeyType,InValType>*>(reader);
+            inputs.push_back(input);
+        }
+        else if (input_dir.size() > 0) {
             if (user_padding != NULL) {
                 if (WORK_STEAL) {
                     chunk_mgr = new StealChunkManager<KeyType,ValType>(mimir_ctx_comm, input_dir, BYSIZE);
@@ -164,21 +295,7 @@ class MimirContext {
         }
         // Output to this context
         else if (!output_file) {
-            if (BALANCE_LOAD) {
-                //if (!user_combine) kv = new BinContainer<KeyType,ValType>(bincount, keycount, valcount);
-                //else kv = new CombineBinContainer<KeyType,ValType>(user_combine, ptr, bincount, keycount, valcount);
-                if (!user_combine) kv = new KVContainer<KeyType,ValType>(keycount, valcount);
-                else kv = new CombineKVContainer<KeyType,ValType>(user_combine, ptr, keycount, valcount, mimir_ctx_size);
-            } else {
-                //if (CONTAINER_TYPE == 0) {
-                if (!user_combine) kv = new KVContainer<KeyType,ValType>(keycount, valcount);
-                else kv = new CombineKVContainer<KeyType,ValType>(user_combine, ptr, keycount, valcount, mimir_ctx_size);
-                //}
-                //else if (CONTAINER_TYPE == 1) {
-                //    if (!user_combine) kv = new BinContainer<KeyType,ValType>(bincount, keycount, valcount);
-                //    else kv = new CombineBinContainer<KeyType,ValType>(user_combine, ptr, bincount, keycount, valcount);
-                //}
-            }
+            kv = create_container(ptr);
             output = kv;
         }
         // Output to files
@@ -190,57 +307,7 @@ class MimirContext {
 
         // Map with shuffle
         if (do_shuffle) {
-            // Map with combiner
-            if (!user_combine) {
-                if (split_hint) {
-                    if (h != NULL) delete h;
-                    h = new HashBucket<>(1, true);
-                }
-                // MPI_Alltoallv shuffler
-                if (SHUFFLE_TYPE == 0)
-                    c = new CollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
-                                                                output,
-                                                                user_partition,
-                                                                keycount,
-                                                                valcount,
-                                                                split_hint,
-                                                                h);
-                // MPI_Ialltoallv shuffler
-                else if (SHUFFLE_TYPE == 1)
-                    c = new NBCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
-                                                                  output,
-                                                                  user_partition,
-                                                                  keycount,
-                                                                  valcount,
-                                                                  split_hint,
-                                                                  h);
-                else LOG_ERROR("Shuffle type %d error!\n", SHUFFLE_TYPE);
-            // Map without combiner
-            } else {
-                // MPI_Alltoallv shuffler
-                if (SHUFFLE_TYPE == 0)
-                    c = new CombineCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
-                                                                       user_combine,
-                                                                       ptr,
-                                                                       output,
-                                                                       user_partition,
-                                                                       keycount,
-                                                                       valcount,
-                                                                       split_hint,
-                                                                       h);
-                // MPI_Ialltoallv shuffler
-                else if (SHUFFLE_TYPE == 1)
-                    c = new NBCombineCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
-                                                                         user_combine,
-                                                                         ptr,
-                                                                         output,
-                                                                         user_partition,
-                                                                         keycount,
-                                                                         valcount,
-                                                                         split_hint,
-                                                                         h);
-                else LOG_ERROR("Shuffle type %d error!\n", SHUFFLE_TYPE);
-            }
+            c = create_shuffler(output, ptr, split_hint);
             if (output) {
                 if (writer != NULL) {
                     writer->set_shuffler(c);
@@ -333,9 +400,28 @@ class MimirContext {
             database = NULL;
             delete writer;
         }
+        db_partitioned = (kv != NULL && do_shuffle && is_hash_partitioned(split_hint));
+        // The split keys were gathered in h when the shuffler was deleted
+        db_split = (kv != NULL && do_shuffle && split_hint
+                    && h != NULL && h->get_nunique() > 0);
 
         if (chunk_mgr != NULL) delete chunk_mgr;
 
+        if (cache_key.size() > 0 && kv != NULL) {
+            InputCache *cache = InputCache::getInputCache();
+            if (cache_mode == CACHE_MEMORY) {
+                cache->insert(cache_key, kv, "", input_records, kv_records);
+            } else {
+                KVContainer<KeyType,ValType> *kvc = dynamic_cast<KVContainer<KeyType,ValType>*>(kv);
+                BinContainer<KeyType,ValType> *bc = dynamic_cast<BinContainer<KeyType,ValType>*>(kv);
+                if (kvc == NULL && bc == NULL) LOG_ERROR("Cannot spill the map output!\n");
+                std::string filename = cache->get_spill_file();
+                if (kvc != NULL) kvc->dump(filename.c_str());
+                else bc->dump(filename.c_str());
+                cache->insert(cache_key, NULL, filename, input_records, kv_records);
+            }
+        }
+
         TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
 
         uint64_t total_records = 0;
@@ -358,22 +444,19 @@ class MimirContext {
                     std::string outfile_format = "binary") {
 
         KVContainer<OutKeyType,OutValType> *kv = NULL;
-        KMVContainer<KeyType,ValType> *kmv = NULL;
+        BaseKMVContainer<KeyType,ValType> *kmv = NULL;
         FileWriter<OutKeyType,OutValType> *writer = NULL;
-        Readable<KeyType,ValType> *input = NULL;
         Writable<OutKeyType,OutValType> *output = NULL;
 
         if (user_reduce == NULL) {
             LOG_ERROR("Please set reduce callback!\n");
         }
-        if (database == NULL) {
+        if (database == NULL && attached_databases.size() == 0) {
             LOG_ERROR("No data to reduce!\n");
         }
 
         LOG_PRINT(DBG_GEN, "MapReduce: reduce start, %ld\n", Container::mem_bytes);
 
-        input = dynamic_cast<Readable<KeyType,ValType>*>(database);
-        if (input == NULL) LOG_ERROR("Error to convert database to input!\n");
         // output to user database
         if (user_database != NULL) {
             output = dynamic_cast<Writable<OutKeyType,OutValType>*>(user_database);
@@ -389,26 +472,12 @@ class MimirContext {
             output = writer;
         }
 
-        kmv = new KMVContainer<KeyType,ValType>(keycount, valcount, mimir_ctx_size);
-        kmv->convert(input);
-        BaseObject::subRef(database);
-        database = NULL;
-
-        kmv_records = kmv->get_record_count();
-
-        TRACKER_RECORD_EVENT(EVENT_COMPUTE_CVT);
+        bool merge = merge_split && db_split;
+        kmv = convert_database();
 
-        kmv->open();
         output->open();
-        KMVItem<KeyType,ValType>* item = NULL;
-        while ((item = kmv->read()) != NULL) {
-            item->open();
-            user_reduce(item, output, ptr);
-            item->close();
-        }
+        reduce_groups(kmv, user_reduce, ptr, output, merge);
         output->close();
-        kmv->close();
-        delete kmv;
 
         if (output) {
             output_records = output->get_record_count();
@@ -426,6 +495,8 @@ class MimirContext {
             delete writer;
             database = NULL;
         }
+        db_partitioned = false;
+        db_split = false;
 
         TRACKER_RECORD_EVENT(EVENT_COMPUTE_RDC);
 
@@ -440,6 +511,476 @@ class MimirContext {
         return total_records;
     }
 
+    // Join the data of this context with another dataset on the key;
+    // user_join gets every pair of values with the same key. The smaller
+    // side is broadcast when it fits MIMIR_JOIN_BCAST_SIZE and costs less
+    // than shuffling. Otherwise both sides are shuffled by key, except the
+    // ones persisted with the partitioner of this context, which must then
+    // place records by key only. Keys with too many records on the larger
+    // side are split: their records stay in place and the records of the
+    // smaller side with these keys are broadcast.
+    template <typename Val2Type>
+    uint64_t join(BaseObject *handle,
+                  void (*user_join)(KeyType *key, ValType *val1, Val2Type *val2,
+                                    Writable<OutKeyType,OutValType> *output, void *ptr),
+                  void *ptr = NULL,
+                  int val2count = 1,
+                  bool output_file = false,
+                  std::string outfile_format = "binary") {
+
+        KVContainer<OutKeyType,OutValType> *kv = NULL;
+        FileWriter<OutKeyType,OutValType> *writer = NULL;
+        Writable<OutKeyType,OutValType> *output = NULL;
+        std::vector<Readable<KeyType,ValType>*> inputs1;
+        std::vector<Readable<KeyType,Val2Type>*> inputs2;
+        std::vector<bool> placed1, placed2;
+
+        if (user_join == NULL) {
+            LOG_ERROR("Please set join callback!\n");
+        }
+        if (database == NULL && attached_databases.size() == 0) {
+            LOG_ERROR("No data to join!\n");
+        }
+        Readable<KeyType,Val2Type> *input2 = dynamic_cast<Readable<KeyType,Val2Type>*>(handle);
+        if (input2 == NULL) LOG_ERROR("The handle joined is not valid!\n");
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join start\n");
+
+        if (database != NULL) {
+            Readable<KeyType,ValType> *input = dynamic_cast<Readable<KeyType,ValType>*>(database);
+            if (input == NULL) LOG_ERROR("Error to convert database to input!\n");
+            inputs1.push_back(input);
+            placed1.push_back(db_partitioned);
+        }
+        for (auto iter : attached_databases) {
+            inputs1.push_back(dynamic_cast<Readable<KeyType,ValType>*>(iter));
+            placed1.push_back(true);
+        }
+        inputs2.push_back(input2);
+        placed2.push_back(handle->is_partitioned((void*)user_partition, mimir_ctx_size));
+
+        // records, bytes and bytes to shuffle of both sides
+        uint64_t sizes[6] = {0, 0, 0, 0, 0, 0}, total_sizes[6];
+        measure_join_inputs(inputs1, placed1, valcount, sizes);
+        measure_join_inputs(inputs2, placed2, val2count, sizes + 3);
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(sizes, total_sizes, 6, MPI_UINT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        bool build_first = (total_sizes[1] <= total_sizes[4]);
+        uint64_t small_bytes = build_first ? total_sizes[1] : total_sizes[4];
+        uint64_t shuffle_bytes = total_sizes[2] + total_sizes[5];
+        bool bcast = (small_bytes <= (uint64_t)JOIN_BCAST_SIZE
+                      && small_bytes * (uint64_t)(mimir_ctx_size - 1) <= shuffle_bytes);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join %s (bytes=%ld,%ld, shuffle bytes=%ld)\n",
+                  bcast ? "broadcast" : "partitioned",
+                  total_sizes[1], total_sizes[4], shuffle_bytes);
+
+        if (user_database != NULL) {
+            output = dynamic_cast<Writable<OutKeyType,OutValType>*>(user_database);
+            if (output == NULL) LOG_ERROR("Error to convert database to output!\n");
+        } else if (!output_file) {
+            kv = new KVContainer<OutKeyType,OutValType>(outkeycount, outvalcount);
+            output = kv;
+        } else {
+            writer = FileWriter<OutKeyType,OutValType>::getWriter(mimir_ctx_comm, output_dir.c_str(), outkeycount, outvalcount);
+            writer->set_file_format(outfile_format.c_str());
+            output = writer;
+        }
+
+        output->open();
+        if (build_first) {
+            run_join<ValType,Val2Type,true>(inputs1, placed1, valcount,
+                                            inputs2, placed2, val2count,
+                                            bcast, total_sizes + 3,
+                                            user_join, ptr, output);
+        } else {
+            run_join<Val2Type,ValType,false>(inputs2, placed2, val2count,
+                                             inputs1, placed1, valcount,
+                                             bcast, total_sizes,
+                                             user_join, ptr, output);
+        }
+        output->close();
+        output_records = output->get_record_count();
+
+        BaseObject::subRef(database);
+        database = NULL;
+        for (auto iter : attached_databases) {
+            BaseObject::subRef(iter);
+        }
+        attached_databases.clear();
+
+        if (user_database != NULL) {
+            database = user_database;
+            BaseObject::addRef(database);
+            user_database = NULL;
+        } else if (!output_file) {
+            BaseObject::addRef(kv);
+            database = dynamic_cast<BaseObject*>(kv);
+        } else {
+            delete writer;
+            database = NULL;
+        }
+        db_partitioned = false;
+        db_split = false;
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_RDC);
+
+        uint64_t total_records = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&output_records, &total_records, 1,
+                      MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join done\n");
+
+        return total_records;
+    }
+
+    // Sort the data of this context by key over all processes. Keys are
+    // sampled, the splitters are picked together and the records are
+    // shuffled by range and sorted locally, so the output of rank i comes
+    // before the output of rank i+1. Map without shuffle first, so the
+    // records cross the network once.
+    uint64_t sort(int (*user_compare)(KeyType *key1, KeyType *key2) = NULL,
+                  bool output_file = false,
+                  std::string outfile_format = "binary") {
+
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+        std::vector<Readable<KeyType,ValType>*> inputs;
+
+        if (database == NULL && attached_databases.size() == 0) {
+            LOG_ERROR("No data to sort!\n");
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: sort start\n");
+
+        if (database != NULL) {
+            Readable<KeyType,ValType> *input = dynamic_cast<Readable<KeyType,ValType>*>(database);
+            if (input == NULL) LOG_ERROR("Error to convert database to input!\n");
+            inputs.push_back(input);
+        }
+        for (auto iter : attached_databases) {
+            inputs.push_back(dynamic_cast<Readable<KeyType,ValType>*>(iter));
+        }
+
+        uint64_t local_records = 0, total_records = 0;
+        for (auto iter : inputs) {
+            local_records += iter->get_record_count();
+        }
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&local_records, &total_records, 1,
+                      MPI_UINT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        // Sample every step-th record, about SORT_SAMPLES per process
+        KeyComparator<KeyType> cmp(user_compare, keycount);
+        RangePartitioner<KeyType> range(mimir_ctx_comm, &cmp, keycount);
+        uint64_t nsamples = (uint64_t)SORT_SAMPLES * mimir_ctx_size;
+        uint64_t step = (total_records + nsamples - 1) / nsamples;
+        if (step == 0) step = 1;
+        uint64_t idx = 0;
+        for (auto iter : inputs) {
+            iter->open();
+            while (iter->read(key, val) == true) {
+                if (idx % step == 0) range.add_sample(key);
+                idx++;
+            }
+            iter->close();
+        }
+        range.compute_splitters();
+
+        KVContainer<KeyType,ValType> *kv = new KVContainer<KeyType,ValType>(keycount, valcount);
+        BaseShuffler<KeyType,ValType> *c = create_plain_shuffler(kv, valcount);
+        c->set_range_partitioner(&range);
+        kv->open();
+        c->open();
+        for (auto iter : inputs) {
+            iter->open();
+            while (iter->read(key, val) == true) {
+                c->write(key, val);
+            }
+            iter->close();
+        }
+        c->close();
+        kv->close();
+        delete c;
+
+        BaseObject::subRef(database);
+        database = NULL;
+        for (auto iter : attached_databases) {
+            BaseObject::subRef(iter);
+        }
+        attached_databases.clear();
+
+        kv->sort(&cmp);
+        kv_records = kv->get_record_count();
+
+        if (output_file) {
+            FileWriter<KeyType,ValType> *writer
+                = FileWriter<KeyType,ValType>::getWriter(mimir_ctx_comm, output_dir.c_str(),
+                                                         keycount, valcount);
+            writer->set_file_format(outfile_format.c_str());
+            writer->open();
+            kv->open();
+            while (kv->read(key, val) == true) {
+                writer->write(key, val);
+            }
+            kv->close();
+            writer->close();
+            delete writer;
+            delete kv;
+        } else {
+            database = kv;
+            BaseObject::addRef(database);
+        }
+        db_partitioned = false;
+        db_split = false;
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+
+        total_records = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&kv_records, &total_records, 1,
+                      MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: sort done (KVs=%ld)\n", kv_records);
+
+        return total_records;
+    }
+
+    // Keep the k records with the largest values (by the compare callback,
+    // or the natural order of arithmetic and string values). Each process
+    // keeps a bounded heap and the heaps are merged with a tree reduction,
+    // so only the top records are moved; they end on the first process.
+    uint64_t topk(int k,
+                  int (*user_compare)(ValType *val1, ValType *val2) = NULL,
+                  bool output_file = false,
+                  std::string outfile_format = "binary") {
+
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+        std::vector<Readable<KeyType,ValType>*> inputs;
+
+        if (database == NULL && attached_databases.size() == 0) {
+            LOG_ERROR("No data to select!\n");
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: topk start (k=%d)\n", k);
+
+        if (database != NULL) {
+            Readable<KeyType,ValType> *input = dynamic_cast<Readable<KeyType,ValType>*>(database);
+            if (input == NULL) LOG_ERROR("Error to convert database to input!\n");
+            inputs.push_back(input);
+        }
+        for (auto iter : attached_databases) {
+            inputs.push_back(dynamic_cast<Readable<KeyType,ValType>*>(iter));
+        }
+
+        TopKCollector<KeyType,ValType> collector(k, user_compare, keycount, valcount);
+        for (auto iter : inputs) {
+            iter->open();
+            while (iter->read(key, val) == true) {
+                collector.write(key, val);
+            }
+            iter->close();
+        }
+
+        BaseObject::subRef(database);
+        database = NULL;
+        for (auto iter : attached_databases) {
+            BaseObject::subRef(iter);
+        }
+        attached_databases.clear();
+
+        kv_records = finish_topk(&collector, keycount, valcount,
+                                 output_file, outfile_format);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: topk done (KVs=%ld)\n", kv_records);
+
+        return kv_records;
+    }
+
+    // Reduce into a bounded heap: only the k reduce outputs with the
+    // largest values are kept (see topk())
+    uint64_t reduce_topk(void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                             Writable<OutKeyType,OutValType> *output, void *ptr),
+                         int k,
+                         int (*user_compare)(OutValType *val1, OutValType *val2) = NULL,
+                         void *ptr = NULL,
+                         bool output_file = false,
+                         std::string outfile_format = "binary") {
+
+        BaseKMVContainer<KeyType,ValType> *kmv = NULL;
+
+        if (user_reduce == NULL) {
+            LOG_ERROR("Please set reduce callback!\n");
+        }
+        if (database == NULL && attached_databases.size() == 0) {
+            LOG_ERROR("No data to reduce!\n");
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: reduce topk start (k=%d)\n", k);
+
+        TopKCollector<OutKeyType,OutValType> collector(k, user_compare,
+                                                       outkeycount, outvalcount);
+        bool merge = merge_split && db_split;
+        kmv = convert_database();
+        reduce_groups(kmv, user_reduce, ptr, &collector, merge);
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_RDC);
+
+        output_records = finish_topk(&collector, outkeycount, outvalcount,
+                                     output_file, outfile_format);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: reduce topk done (KVs=%ld)\n", output_records);
+
+        return output_records;
+    }
+
+    // Reduce into the next stage of a pipeline: the reduce output goes
+    // through next_map (copied when it is NULL) into the shuffler of the
+    // next context, so no dataset is built for it. next can be this context.
+    template <typename NextKeyType, typename NextValType,
+              typename NextOutKeyType, typename NextOutValType>
+    uint64_t reduce_into(MimirContext<NextKeyType,NextValType,OutKeyType,OutValType,
+                                      NextOutKeyType,NextOutValType> *next,
+                         void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                             Writable<OutKeyType,OutValType> *output, void *ptr),
+                         void *ptr = NULL,
+                         void (*next_map)(Readable<OutKeyType,OutValType> *input,
+                                          Writable<NextKeyType,NextValType> *output, void *ptr) = NULL,
+                         void *next_ptr = NULL) {
+
+        BaseKMVContainer<KeyType,ValType> *kmv = NULL;
+
+        if (user_reduce == NULL) {
+            LOG_ERROR("Please set reduce callback!\n");
+        }
+        if (database == NULL && attached_databases.size() == 0) {
+            LOG_ERROR("No data to reduce!\n");
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: reduce into next stage start\n");
+
+        // The input is released first, as next may be this context
+        bool merge = merge_split && db_split;
+        kmv = convert_database();
+        db_partitioned = false;
+        db_split = false;
+
+        Writable<OutKeyType,OutValType> *output = next->open_stream(next_map, next_ptr);
+        uint64_t start_records = output->get_record_count();
+        reduce_groups(kmv, user_reduce, ptr, output, merge);
+        output_records = output->get_record_count() - start_records;
+        next->close_stream();
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_RDC);
+
+        uint64_t total_records = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&output_records, &total_records, 1,
+                      MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: reduce into next stage done\n");
+
+        return total_records;
+    }
+
+    // Open this context as the next stage of a pipeline. The records
+    // written to the handle are mapped by user_map (copied when it is
+    // NULL) and shuffled into this context; the data handles of the
+    // context are mapped as well. close_stream() ends the stage.
+    Writable<InKeyType,InValType> *open_stream(void (*user_map)(Readable<InKeyType,InValType> *input,
+                                                                Writable<KeyType,ValType> *output,
+                                                                void *ptr) = NULL,
+                                               void *ptr = NULL) {
+        std::vector<Readable<InKeyType,InValType>*> inputs;
+
+        if (stream != NULL) LOG_ERROR("The stream has been opened!\n");
+
+        LOG_PRINT(DBG_GEN, "MapReduce: stream open\n");
+
+        stream_kv = create_container(ptr);
+        stream_shuffler = create_shuffler(stream_kv, ptr, false);
+        stream = new StreamMapper<InKeyType,InValType,KeyType,ValType>(user_map, ptr,
+                                                                       stream_shuffler,
+                                                                       inkeycount, invalcount);
+        stream_kv->open();
+        stream_shuffler->open();
+        stream->open();
+
+        for (auto iter : in_databases) {
+            Readable<InKeyType,InValType> *input = dynamic_cast<Readable<InKeyType,InValType>*>(iter);
+            if (input == NULL) LOG_ERROR("Object convert error!\n");
+            inputs.push_back(input);
+        }
+        if (database != NULL) {
+            Readable<InKeyType,InValType>* input = dynamic_cast<Readable<InKeyType,InValType>*>(database);
+            if (input == NULL) LOG_ERROR("Cannot convert database into input format!\n");
+            inputs.push_back(input);
+        }
+        if (inputs.size() != 0) {
+            typename SafeType<InKeyType>::type key[inkeycount];
+            typename SafeType<InValType>::type val[invalcount];
+            UnitedDataset<InKeyType,InValType> united_input(inputs);
+            united_input.open();
+            while (united_input.read(key, val) == true) {
+                stream->write(key, val);
+            }
+            united_input.close();
+        }
+        for (auto iter : in_databases) {
+            BaseObject::subRef(iter);
+        }
+        in_databases.clear();
+        if (database != NULL) {
+            BaseObject::subRef(database);
+            database = NULL;
+        }
+
+        return stream;
+    }
+
+    uint64_t close_stream() {
+
+        if (stream == NULL) LOG_ERROR("The stream is not opened!\n");
+
+        stream->close();
+        stream_shuffler->close();
+        stream_kv->close();
+        input_records = stream->get_record_count();
+        kv_records = stream_kv->get_record_count();
+        delete stream_shuffler;
+        delete stream;
+        stream_shuffler = NULL;
+        stream = NULL;
+
+        database = stream_kv;
+        BaseObject::addRef(database);
+        stream_kv = NULL;
+        db_partitioned = is_hash_partitioned(false);
+        db_split = false;
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_MAP);
+
+        uint64_t total_records = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&kv_records, &total_records, 1,
+                      MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        PROFILER_RECORD_COUNT(COUNTER_MAX_KVS, kv_records, OPMAX);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: stream close (KVs=%ld)\n", kv_records);
+
+        return total_records;
+    }
+
     uint64_t output(std::string outfile_format = "binary") {
 
         typename SafeType<OutKeyType>::type key[keycount];
@@ -563,6 +1104,737 @@ class MimirContext {
     }
 
   private:
+    // Records are placed by the partitioner only, not moved by the load
+    // balancer or spread for split keys
+    bool is_hash_partitioned(bool split_hint) {
+        return !split_hint && (user_partition != NULL || !BALANCE_LOAD);
+    }
+
+    // Count records, bytes and bytes not placed by key of join inputs
+    template <typename V>
+    void measure_join_inputs(std::vector<Readable<KeyType,V>*> &inputs,
+                             std::vector<bool> &placed, int vcount, uint64_t *sizes) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<V>::type val[vcount];
+        Serializer<KeyType,V> kvser(keycount, vcount);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            inputs[i]->open();
+            while (inputs[i]->read(key, val) == true) {
+                uint64_t kvsize = kvser.get_kv_bytes(key, val);
+                sizes[0] += 1;
+                sizes[1] += kvsize;
+                if (!placed[i]) sizes[2] += kvsize;
+            }
+            inputs[i]->close();
+        }
+    }
+
+    // Shuffler without combiner for join and sort. Their outputs are not
+    // migrated by the load balancer (join writes to hash tables, sort
+    // places by range), so records stay where the partitioner puts them.
+    template <typename V>
+    BaseShuffler<KeyType,V> *create_plain_shuffler(Writable<KeyType,V> *output, int vcount) {
+        int (*partition)(KeyType*, V*, int) = (int (*)(KeyType*, V*, int))user_partition;
+        BaseShuffler<KeyType,V> *c = NULL;
+        if (SHUFFLE_TYPE == 0)
+            c = new CollectiveShuffler<KeyType,V>(mimir_ctx_comm, output, partition,
+                                                  keycount, vcount, false, NULL);
+        else if (SHUFFLE_TYPE == 1)
+            c = new NBCollectiveShuffler<KeyType,V>(mimir_ctx_comm, output, partition,
+                                                    keycount, vcount, false, NULL);
+        else LOG_ERROR("Shuffle type %d error!\n", SHUFFLE_TYPE);
+        return c;
+    }
+
+    void allgather_join_records(std::vector<char> &sendbuf, std::vector<char> &recvbuf) {
+        int recvcounts[mimir_ctx_size], displs[mimir_ctx_size];
+        if (sendbuf.size() > (size_t)INT32_MAX)
+            LOG_ERROR("The records to broadcast are too large (%ld)!\n", sendbuf.size());
+        int sendcount = (int)sendbuf.size();
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Allgather(&sendcount, 1, MPI_INT, recvcounts, 1, MPI_INT, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_ALLGATHER);
+
+        int64_t recvcount = 0;
+        for (int i = 0; i < mimir_ctx_size; i++) {
+            displs[i] = (int)recvcount;
+            recvcount += recvcounts[i];
+            if (recvcount > INT32_MAX)
+                LOG_ERROR("The records to broadcast are too large (%ld)!\n", recvcount);
+        }
+        recvbuf.resize(recvcount);
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Allgatherv(sendbuf.data(), sendcount, MPI_BYTE,
+                       recvbuf.data(), recvcounts, displs, MPI_BYTE, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_ALLGATHERV);
+    }
+
+    // Keys with more records than JOIN_SPLIT_RATIO of the share of one
+    // process. Each process reports its largest keys that may reach the
+    // threshold, so every process gets the same set.
+    template <typename V>
+    HashBucket<> *find_split_keys(std::vector<Readable<KeyType,V>*> &inputs,
+                                  std::vector<bool> &placed, int vcount,
+                                  uint64_t total_records) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<V>::type val[vcount];
+        Serializer<KeyType,V> kvser(keycount, vcount);
+        std::vector<char> sendbuf, recvbuf;
+
+        bool shuffled = false;
+        for (size_t i = 0; i < placed.size(); i++) {
+            if (!placed[i]) shuffled = true;
+        }
+        if (!shuffled || JOIN_SPLIT_RATIO <= 0.0 || mimir_ctx_size == 1) return NULL;
+
+        double threshold = JOIN_SPLIT_RATIO * (double)total_records / mimir_ctx_size;
+
+        HashBucket<uint64_t> *counts = new HashBucket<uint64_t>(1, true);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            inputs[i]->open();
+            while (inputs[i]->read(key, val) == true) {
+                char *keyptr = kvser.get_key_ptr(key);
+                int keysize = kvser.get_key_bytes(key);
+                uint64_t *count = counts->findEntry(keyptr, keysize);
+                if (count != NULL) {
+                    *count += 1;
+                } else {
+                    uint64_t one = 1;
+                    counts->insertEntry(keyptr, keysize, &one);
+                }
+            }
+            inputs[i]->close();
+        }
+
+        std::vector<std::pair<uint64_t,typename HashBucket<uint64_t>::HashEntry*> > candidates;
+        typename HashBucket<uint64_t>::HashEntry *entry = NULL;
+        counts->open();
+        while ((entry = counts->next()) != NULL) {
+            if ((double)entry->val * mimir_ctx_size > threshold)
+                candidates.push_back(std::make_pair(entry->val, entry));
+        }
+        counts->close();
+        if (candidates.size() > JOIN_MAX_SPLIT_KEYS) {
+            std::partial_sort(candidates.begin(),
+                              candidates.begin() + JOIN_MAX_SPLIT_KEYS,
+                              candidates.end(),
+                              std::greater<std::pair<uint64_t,typename HashBucket<uint64_t>::HashEntry*> >());
+            candidates.resize(JOIN_MAX_SPLIT_KEYS);
+        }
+        for (auto iter : candidates) {
+            int keysize = iter.second->keysize;
+            sendbuf.insert(sendbuf.end(), (char*)&keysize, (char*)&keysize + sizeof(int));
+            sendbuf.insert(sendbuf.end(), iter.second->key, iter.second->key + keysize);
+            sendbuf.insert(sendbuf.end(), (char*)&iter.first, (char*)&iter.first + sizeof(uint64_t));
+        }
+        delete counts;
+
+        allgather_join_records(sendbuf, recvbuf);
+
+        counts = new HashBucket<uint64_t>(1, true);
+        size_t off = 0;
+        while (off < recvbuf.size()) {
+            int keysize = *(int*)(recvbuf.data() + off);
+            char *keyptr = recvbuf.data() + off + sizeof(int);
+            uint64_t local_count = *(uint64_t*)(keyptr + keysize);
+            uint64_t *count = counts->findEntry(keyptr, keysize);
+            if (count != NULL) *count += local_count;
+            else counts->insertEntry(keyptr, keysize, &local_count);
+            off += sizeof(int) + keysize + sizeof(uint64_t);
+        }
+
+        HashBucket<> *split = new HashBucket<>(1, true);
+        uint64_t nsplit = 0;
+        counts->open();
+        while ((entry = counts->next()) != NULL) {
+            if ((double)entry->val > threshold) {
+                EmptyVal v;
+                split->insertEntry(entry->key, entry->keysize, &v);
+                nsplit += 1;
+            }
+        }
+        counts->close();
+        delete counts;
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join split keys=%ld (threshold=%.1lf)\n",
+                  nsplit, threshold);
+
+        if (nsplit == 0) {
+            delete split;
+            split = NULL;
+        }
+        return split;
+    }
+
+    // Bloom filter of the keys in the hash tables of all processes. It is
+    // only built when it is much smaller than the data it may save.
+    template <typename V>
+    BloomFilter *create_join_filter(HashJoiner<KeyType,V> *joiner, uint64_t shuffle_bytes) {
+        if (JOIN_BLOOM_BITS == 0 || shuffle_bytes == 0) return NULL;
+
+        uint64_t nkeys = joiner->get_key_count(), total_keys = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&nkeys, &total_keys, 1, MPI_UINT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        uint64_t filter_bytes = BloomFilter::get_word_count(total_keys, JOIN_BLOOM_BITS)
+                              * sizeof(uint64_t);
+        if (2 * filter_bytes >= shuffle_bytes / mimir_ctx_size) return NULL;
+
+        BloomFilter *filter = new BloomFilter(total_keys, JOIN_BLOOM_BITS);
+        joiner->add_keys(filter);
+        PROFILER_RECORD_TIME_START;
+        filter->merge(mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join filter keys=%ld, bytes=%ld\n",
+                  total_keys, filter->get_bytes());
+
+        return filter;
+    }
+
+    // Send join inputs to the hash table or the prober. Records of split
+    // keys are broadcast when bcastbuf is set and kept in place otherwise;
+    // with bcast_all every record is broadcast. The shuffler drops records
+    // whose key is not in the filter.
+    template <typename V>
+    void distribute_join_inputs(std::vector<Readable<KeyType,V>*> &inputs,
+                                std::vector<bool> &placed, int vcount,
+                                HashBucket<> *split, Writable<KeyType,V> *output,
+                                std::vector<char> *bcastbuf, bool bcast_all = false,
+                                BloomFilter *filter = NULL) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<V>::type val[vcount];
+        Serializer<KeyType,V> kvser(keycount, vcount);
+        BaseShuffler<KeyType,V> *c = NULL;
+
+        for (size_t i = 0; i < placed.size(); i++) {
+            if (!placed[i] && !bcast_all && c == NULL) {
+                c = create_plain_shuffler(output, vcount);
+                c->set_key_filter(filter);
+                c->open();
+            }
+        }
+
+        for (size_t i = 0; i < inputs.size(); i++) {
+            inputs[i]->open();
+            while (inputs[i]->read(key, val) == true) {
+                bool is_split = bcast_all;
+                if (!is_split && split != NULL)
+                    is_split = (split->findEntry(kvser.get_key_ptr(key),
+                                                 kvser.get_key_bytes(key)) != NULL);
+                if (is_split && bcastbuf != NULL) {
+                    size_t off = bcastbuf->size();
+                    int kvsize = kvser.get_kv_bytes(key, val);
+                    bcastbuf->resize(off + kvsize);
+                    kvser.kv_to_bytes(key, val, bcastbuf->data() + off, kvsize);
+                } else if (is_split || placed[i]) {
+                    output->write(key, val);
+                } else {
+                    c->write(key, val);
+                }
+            }
+            inputs[i]->close();
+        }
+
+        if (c != NULL) {
+            c->close();
+            delete c;
+        }
+    }
+
+    template <typename BuildValType, typename ProbeValType, bool build_first, typename Fn>
+    void run_join(std::vector<Readable<KeyType,BuildValType>*> &build_inputs,
+                  std::vector<bool> &build_placed, int buildvalcount,
+                  std::vector<Readable<KeyType,ProbeValType>*> &probe_inputs,
+                  std::vector<bool> &probe_placed, int probevalcount,
+                  bool bcast, uint64_t *probe_sizes,
+                  Fn user_join, void *ptr, Writable<OutKeyType,OutValType> *output) {
+        HashJoiner<KeyType,BuildValType> joiner(keycount, buildvalcount);
+        JoinProber<KeyType,BuildValType,ProbeValType,OutKeyType,OutValType,build_first,Fn>
+            prober(&joiner, user_join, ptr, output, keycount, buildvalcount);
+        std::vector<char> sendbuf, recvbuf;
+
+        if (bcast) {
+            std::vector<bool> local(probe_inputs.size(), true);
+            distribute_join_inputs(build_inputs, build_placed, buildvalcount,
+                                   NULL, &joiner, &sendbuf, true);
+            allgather_join_records(sendbuf, recvbuf);
+            joiner.add(recvbuf.data(), (int64_t)recvbuf.size());
+            std::vector<char>().swap(recvbuf);
+            distribute_join_inputs(probe_inputs, local, probevalcount,
+                                   NULL, &prober, NULL);
+        } else {
+            HashBucket<> *split = find_split_keys(probe_inputs, probe_placed,
+                                                  probevalcount, probe_sizes[0]);
+            distribute_join_inputs(build_inputs, build_placed, buildvalcount,
+                                   split, &joiner, &sendbuf);
+            allgather_join_records(sendbuf, recvbuf);
+            joiner.add(recvbuf.data(), (int64_t)recvbuf.size());
+            std::vector<char>().swap(recvbuf);
+            BloomFilter *filter = create_join_filter(&joiner, probe_sizes[2]);
+            distribute_join_inputs(probe_inputs, probe_placed, probevalcount,
+                                   split, &prober, NULL, false, filter);
+            if (filter != NULL) delete filter;
+            if (split != NULL) delete split;
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: join build records=%ld, probe records=%ld\n",
+                  joiner.get_record_count(), prober.get_record_count());
+    }
+
+    // Merge the heaps of a top-k selection and output the result of the
+    // first process; returns the number of selected records
+    template <typename K, typename V>
+    uint64_t finish_topk(TopKCollector<K,V> *collector, int kcount, int vcount,
+                         bool output_file, std::string outfile_format) {
+        Writable<K,V> *output = NULL;
+        KVContainer<K,V> *kv = NULL;
+        FileWriter<K,V> *writer = NULL;
+
+        collector->merge(mimir_ctx_comm);
+
+        if (output_file) {
+            writer = FileWriter<K,V>::getWriter(mimir_ctx_comm, output_dir.c_str(),
+                                                kcount, vcount);
+            writer->set_file_format(outfile_format.c_str());
+            output = writer;
+        } else {
+            kv = new KVContainer<K,V>(kcount, vcount);
+            output = kv;
+        }
+        output->open();
+        if (mimir_ctx_rank == 0) collector->output(output);
+        output->close();
+
+        if (writer != NULL) {
+            delete writer;
+        } else {
+            database = kv;
+            BaseObject::addRef(database);
+        }
+        db_partitioned = false;
+        db_split = false;
+
+        uint64_t local_records = collector->get_top_count(), total_records = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&local_records, &total_records, 1,
+                      MPI_UINT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+
+        return total_records;
+    }
+
+    // Move whole bins of keys from the processes holding the most bytes
+    // to those holding the fewest, so the groups built next are spread
+    // evenly. A bin holds all records of its keys here, except split keys.
+    void balance_groups() {
+        int movable = (database != NULL && database->getRef() == 1
+                       && attached_databases.size() == 0
+                       && dynamic_cast<BaseDatabase<KeyType,ValType>*>(database) != NULL);
+        int all_movable = 0;
+        MPI_Allreduce(&movable, &all_movable, 1, MPI_INT, MPI_MIN, mimir_ctx_comm);
+        if (!all_movable) return;
+
+        PROFILER_RECORD_TIME_START;
+
+        BaseDatabase<KeyType,ValType> *db = dynamic_cast<BaseDatabase<KeyType,ValType>*>(database);
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+        Serializer<KeyType,ValType> kvser(keycount, valcount);
+        uint32_t nbins = (uint32_t)(mimir_ctx_size * BIN_COUNT);
+
+        std::vector<uint64_t> bin_bytes(nbins, 0);
+        uint64_t local_bytes = 0;
+        db->open();
+        while (db->read(key, val) == true) {
+            uint64_t kvsize = kvser.get_kv_bytes(key, val);
+            bin_bytes[kvser.get_hash_code(key) % nbins] += kvsize;
+            local_bytes += kvsize;
+        }
+        db->close();
+
+        std::vector<uint64_t> loads(mimir_ctx_size);
+        MPI_Allgather(&local_bytes, 1, MPI_UINT64_T,
+                      &loads[0], 1, MPI_UINT64_T, mimir_ctx_comm);
+        uint64_t total_bytes = 0, max_bytes = 0;
+        for (int i = 0; i < mimir_ctx_size; i++) {
+            total_bytes += loads[i];
+            if (loads[i] > max_bytes) max_bytes = loads[i];
+        }
+        double avg_bytes = (double)total_bytes / mimir_ctx_size;
+        if ((double)max_bytes <= BALANCE_FACTOR * avg_bytes) {
+            PROFILER_RECORD_TIME_END(TIMER_LB_GROUP);
+            return;
+        }
+
+        // Processes above the average offer their largest bins that
+        // still fit in the excess, as (bin, bytes) pairs
+        std::vector<uint64_t> offers;
+        if ((double)local_bytes > avg_bytes) {
+            std::vector<uint32_t> bids;
+            for (uint32_t i = 0; i < nbins; i++) {
+                if (bin_bytes[i] > 0) bids.push_back(i);
+            }
+            std::sort(bids.begin(), bids.end(), [&](uint32_t a, uint32_t b) {
+                return bin_bytes[a] > bin_bytes[b]
+                    || (bin_bytes[a] == bin_bytes[b] && a < b);
+            });
+            double excess = (double)local_bytes - avg_bytes;
+            for (auto bid : bids) {
+                if ((double)bin_bytes[bid] <= excess) {
+                    offers.push_back(bid);
+                    offers.push_back(bin_bytes[bid]);
+                    excess -= (double)bin_bytes[bid];
+                }
+            }
+        }
+
+        int sendcount = (int)offers.size(), recvcount = 0;
+        int recvcounts[mimir_ctx_size], displs[mimir_ctx_size];
+        MPI_Allgather(&sendcount, 1, MPI_INT, recvcounts, 1, MPI_INT, mimir_ctx_comm);
+        for (int i = 0; i < mimir_ctx_size; i++) {
+            displs[i] = recvcount;
+            recvcount += recvcounts[i];
+        }
+        if (recvcount == 0) {
+            PROFILER_RECORD_TIME_END(TIMER_LB_GROUP);
+            return;
+        }
+        std::vector<uint64_t> all_offers(recvcount);
+        MPI_Allgatherv(offers.data(), sendcount, MPI_UINT64_T,
+                       &all_offers[0], recvcounts, displs, MPI_UINT64_T, mimir_ctx_comm);
+
+        // Every process assigns the offers the same way: the largest bin
+        // goes to the least loaded process that stays under the average
+        std::vector<std::pair<uint64_t,std::pair<int,uint32_t>>> bins;
+        for (int i = 0; i < mimir_ctx_size; i++) {
+            for (int j = displs[i]; j < displs[i] + recvcounts[i]; j += 2) {
+                bins.push_back(std::make_pair(all_offers[j + 1],
+                    std::make_pair(i, (uint32_t)all_offers[j])));
+            }
+        }
+        std::sort(bins.begin(), bins.end(),
+                  [](const std::pair<uint64_t,std::pair<int,uint32_t>> &a,
+                     const std::pair<uint64_t,std::pair<int,uint32_t>> &b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+        std::priority_queue<std::pair<uint64_t,int>,
+                            std::vector<std::pair<uint64_t,int>>,
+                            std::greater<std::pair<uint64_t,int>>> receivers;
+        for (int i = 0; i < mimir_ctx_size; i++) {
+            if ((double)loads[i] < avg_bytes) receivers.push(std::make_pair(loads[i], i));
+        }
+        std::vector<int> targets(nbins, -1);
+        uint64_t moved_bins = 0, moved_bytes = 0;
+        for (auto &bin : bins) {
+            if (receivers.empty()) break;
+            std::pair<uint64_t,int> r = receivers.top();
+            if ((double)(r.first + bin.first) > avg_bytes) continue;
+            receivers.pop();
+            r.first += bin.first;
+            receivers.push(r);
+            moved_bins++;
+            if (bin.second.first == mimir_ctx_rank) {
+                targets[bin.second.second] = r.second;
+                moved_bytes += bin.first;
+            }
+        }
+        LOG_PRINT(DBG_GEN, "MapReduce: move %ld bins before reduce (max=%ld, avg=%.0lf, local moved=%ld)\n",
+                  moved_bins, max_bytes, avg_bytes, moved_bytes);
+        if (moved_bins == 0) {
+            PROFILER_RECORD_TIME_END(TIMER_LB_GROUP);
+            return;
+        }
+        PROFILER_RECORD_COUNT(COUNTER_MOVED_BYTES, moved_bytes, OPSUM);
+
+        // Ship the bins given away and append the ones received
+        KVContainer<KeyType,ValType> *recv_kv = new KVContainer<KeyType,ValType>(keycount, valcount);
+        BaseShuffler<KeyType,ValType> *c = create_plain_shuffler(recv_kv, valcount);
+        c->set_target_table(&targets);
+        recv_kv->open();
+        c->open();
+        db->open();
+        while (db->read(key, val) == true) {
+            if (targets[kvser.get_hash_code(key) % nbins] != -1) {
+                c->write(key, val);
+                db->remove();
+            }
+        }
+        c->close();
+        delete c;
+        db->close();
+        recv_kv->close();
+
+        if (recv_kv->get_record_count() > 0) {
+            db->open();
+            recv_kv->open();
+            while (recv_kv->read(key, val) == true) {
+                db->write(key, val);
+            }
+            recv_kv->close();
+            db->close();
+        }
+        delete recv_kv;
+
+        PROFILER_RECORD_TIME_END(TIMER_LB_GROUP);
+    }
+
+    // The grouping of MIMIR_GROUP_TYPE, with the values sorted when
+    // secondary sort is on
+    BaseKMVContainer<KeyType,ValType> *create_kmv_container() {
+        BaseKMVContainer<KeyType,ValType> *kmv = NULL;
+        if (GROUP_TYPE == 0)
+            kmv = new KMVContainer<KeyType,ValType>(keycount, valcount, mimir_ctx_size);
+        else if (GROUP_TYPE == 1)
+            kmv = new SortKMVContainer<KeyType,ValType>(keycount, valcount);
+        else LOG_ERROR("Group type %d error!\n", GROUP_TYPE);
+        if (secondary_sort) {
+            kmv->set_value_sorter(new GroupValueSorter<KeyType,ValType>(
+                user_val_compare, keycount, valcount));
+        }
+        return kmv;
+    }
+
+    // Group the data and the attached datasets by key and release them
+    BaseKMVContainer<KeyType,ValType> *convert_database() {
+        std::vector<Readable<KeyType,ValType>*> inputs;
+        if (REDUCE_BALANCE && mimir_ctx_size > 1) balance_groups();
+        if (database != NULL) {
+            Readable<KeyType,ValType> *input = dynamic_cast<Readable<KeyType,ValType>*>(database);
+            if (input == NULL) LOG_ERROR("Error to convert database to input!\n");
+            inputs.push_back(input);
+        }
+        for (auto iter : attached_databases) {
+            inputs.push_back(dynamic_cast<Readable<KeyType,ValType>*>(iter));
+        }
+        UnitedDataset<KeyType,ValType> united_input(inputs);
+
+        BaseKMVContainer<KeyType,ValType> *kmv = create_kmv_container();
+        kmv->convert(&united_input);
+        BaseObject::subRef(database);
+        database = NULL;
+        for (auto iter : attached_databases) {
+            BaseObject::subRef(iter);
+        }
+        attached_databases.clear();
+
+        kmv_records = kmv->get_record_count();
+
+        TRACKER_RECORD_EVENT(EVENT_COMPUTE_CVT);
+
+        return kmv;
+    }
+
+    void reduce_groups(BaseKMVContainer<KeyType,ValType> *kmv,
+                       void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                           Writable<OutKeyType,OutValType> *output, void *ptr),
+                       void *ptr, Writable<OutKeyType,OutValType> *output, bool merge) {
+        if (!merge) run_reduce(kmv, user_reduce, ptr, output);
+        else merge_split_keys(kmv, user_reduce, ptr, output,
+                              std::integral_constant<bool,
+                                  std::is_same<KeyType,OutKeyType>::value
+                                  && std::is_same<ValType,OutValType>::value>());
+    }
+
+    // Reduce the partial groups, then shuffle the results of the split
+    // keys by the partitioner and reduce them again into the output
+    void merge_split_keys(BaseKMVContainer<KeyType,ValType> *kmv,
+                          void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                              Writable<OutKeyType,OutValType> *output, void *ptr),
+                          void *ptr, Writable<OutKeyType,OutValType> *output,
+                          std::true_type) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+
+        KVContainer<KeyType,ValType> *partial = new KVContainer<KeyType,ValType>(keycount, valcount);
+        SplitKeyRouter<KeyType,ValType> router(h, output, partial, keycount, valcount);
+        partial->open();
+        run_reduce(kmv, user_reduce, ptr, &router);
+        partial->close();
+
+        KVContainer<KeyType,ValType> *merged = new KVContainer<KeyType,ValType>(keycount, valcount);
+        BaseShuffler<KeyType,ValType> *c = create_plain_shuffler(merged, valcount);
+        merged->open();
+        c->open();
+        partial->open();
+        while (partial->read(key, val) == true) {
+            c->write(key, val);
+        }
+        partial->close();
+        c->close();
+        merged->close();
+        delete c;
+        delete partial;
+
+        uint64_t count = merged->get_record_count(), total = 0;
+        PROFILER_RECORD_TIME_START;
+        MPI_Allreduce(&count, &total, 1, MPI_INT64_T, MPI_SUM, mimir_ctx_comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+        LOG_PRINT(DBG_GEN, "MapReduce: merge split keys (split keys=%ld, partial results=%ld, total=%ld)\n",
+                  h->get_nunique(), count, total);
+
+        BaseKMVContainer<KeyType,ValType> *kmv2 = create_kmv_container();
+        kmv2->convert(merged);
+        delete merged;
+        run_reduce(kmv2, user_reduce, ptr, output);
+    }
+
+    void merge_split_keys(BaseKMVContainer<KeyType,ValType> *kmv,
+                          void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                              Writable<OutKeyType,OutValType> *output, void *ptr),
+                          void *ptr, Writable<OutKeyType,OutValType> *output,
+                          std::false_type) {
+        // set_split_merge() refuses these types, the partial results of
+        // the split keys are the output
+        run_reduce(kmv, user_reduce, ptr, output);
+    }
+
+    void run_reduce(BaseKMVContainer<KeyType,ValType> *kmv,
+                    void (*user_reduce)(Readable<KeyType,ValType> *input,
+                                        Writable<OutKeyType,OutValType> *output, void *ptr),
+                    void *ptr, Writable<OutKeyType,OutValType> *output) {
+        kmv->open();
+        KMVItem<KeyType,ValType>* item = NULL;
+        while ((item = kmv->read()) != NULL) {
+            item->open();
+            user_reduce(item, output, ptr);
+            item->close();
+        }
+        kmv->close();
+        delete kmv;
+    }
+
+    BaseDatabase<KeyType,ValType> *create_container(void *ptr) {
+        BaseDatabase<KeyType,ValType> *kv = NULL;
+        if (BALANCE_LOAD) {
+            // Bins of the output are shipped whole when they are redirected
+            if (!user_combine) kv = new BinContainer<KeyType,ValType>(
+                (uint32_t)(mimir_ctx_size * BIN_COUNT), keycount, valcount);
+            else kv = new CombineKVContainer<KeyType,ValType>(user_combine, ptr, keycount, valcount, mimir_ctx_size);
+        } else {
+            //if (CONTAINER_TYPE == 0) {
+            if (!user_combine) kv = new KVContainer<KeyType,ValType>(keycount, valcount);
+            else kv = new CombineKVContainer<KeyType,ValType>(user_combine, ptr, keycount, valcount, mimir_ctx_size);
+            //}
+        }
+        return kv;
+    }
+
+    BaseShuffler<KeyType,ValType> *create_shuffler(Writable<KeyType,ValType> *output,
+                                                   void *ptr, bool split_hint) {
+        BaseShuffler<KeyType,ValType> *c = NULL;
+        // Map with combiner
+        if (!user_combine) {
+            if (split_hint) {
+                if (h != NULL) delete h;
+                h = new HashBucket<>(1, true);
+            }
+            // MPI_Alltoallv shuffler
+            if (SHUFFLE_TYPE == 0)
+                c = new CollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
+                                                            output,
+                                                            user_partition,
+                                                            keycount,
+                                                            valcount,
+                                                            split_hint,
+                                                            h);
+            // MPI_Ialltoallv shuffler
+            else if (SHUFFLE_TYPE == 1)
+                c = new NBCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
+                                                              output,
+                                                              user_partition,
+                                                              keycount,
+                                                              valcount,
+                                                              split_hint,
+                                                              h);
+            else LOG_ERROR("Shuffle type %d error!\n", SHUFFLE_TYPE);
+        // Map without combiner
+        } else {
+            // MPI_Alltoallv shuffler
+            if (SHUFFLE_TYPE == 0)
+                c = new CombineCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
+                                                                   user_combine,
+                                                                   ptr,
+                                                                   output,
+                                                                   user_partition,
+                                                                   keycount,
+                                                                   valcount,
+                                                                   split_hint,
+                                                                   h);
+            // MPI_Ialltoallv shuffler
+            else if (SHUFFLE_TYPE == 1)
+                c = new NBCombineCollectiveShuffler<KeyType,ValType>(mimir_ctx_comm,
+                                                                     user_combine,
+                                                                     ptr,
+                                                                     output,
+                                                                     user_partition,
+                                                                     keycount,
+                                                                     valcount,
+                                                                     split_hint,
+                                                                     h);
+            else LOG_ERROR("Shuffle type %d error!\n", SHUFFLE_TYPE);
+        }
+        return c;
+    }
+
+    // The key covers what decides the map output of the input files,
+    // including their sizes and modification times
+    std::string get_cache_key(void *user_map, void *ptr, bool do_shuffle) {
+        std::ostringstream key;
+        for (size_t i = 0; i < input_dir.size(); i++)
+            key << input_dir[i] << '\0';
+        // Only the first process stats the input files
+        std::string files;
+        if (mimir_ctx_rank == 0) {
+            InputSplit split;
+            std::ostringstream fkey;
+            for (size_t i = 0; i < input_dir.size(); i++)
+                split.add(input_dir[i].c_str());
+            for (auto &seg : split.get_file_segs())
+                fkey << seg.filename << ';' << seg.filesize << ';' << seg.mtime << '\0';
+            files = fkey.str();
+            if (files.size() > (size_t)INT_MAX)
+                LOG_ERROR("Error: the input file list is too large!\n");
+        }
+        int len = (int)files.size();
+        MPI_Bcast(&len, 1, MPI_INT, 0, mimir_ctx_comm);
+        files.resize(len);
+        MPI_Bcast(&files[0], len, MPI_BYTE, 0, mimir_ctx_comm);
+        key << files;
+        key << input_format << ';' << user_map << ';' << ptr << ';' << do_shuffle
+            << ';' << (void*)user_partition << ';' << (void*)user_combine
+            << ';' << (void*)user_padding
+            << ';' << typeid(KeyType).name() << ';' << typeid(ValType).name()
+            << ';' << typeid(InKeyType).name() << ';' << typeid(InValType).name()
+            << ';' << keycount << ';' << valcount << ';' << inkeycount << ';' << invalcount
+            << ';' << mimir_ctx_size;
+        return key.str();
+    }
+
+    // All processes must take the cached output, or none does
+    bool map_from_cache(const std::string &key) {
+        CacheEntry *entry = InputCache::getInputCache()->find(key);
+        int hit = (entry != NULL), all_hit = 0;
+        MPI_Allreduce(&hit, &all_hit, 1, MPI_INT, MPI_MIN, mimir_ctx_comm);
+        if (!all_hit) return false;
+
+        if (entry->data != NULL) {
+            database = entry->data;
+        } else {
+            KVContainer<KeyType,ValType> *kv = new KVContainer<KeyType,ValType>(keycount, valcount);
+            kv->load(entry->filename.c_str());
+            database = kv;
+        }
+        BaseObject::addRef(database);
+        input_records = entry->input_records;
+        kv_records = entry->kv_records;
+
+        return true;
+    }
+
     void _init(std::vector<std::string> &input_dir,
                std::string &output_dir,
                MPI_Comm ctx_comm,
@@ -593,9 +1865,18 @@ class MimirContext {
         this->user_padding = padding_fn;
         this->input_dir = input_dir;
         this->output_dir = output_dir;
+        this->input_format = TextFileFormat;
+        this->user_block_filter = NULL;
+        this->user_block_ptr = NULL;
+        this->secondary_sort = false;
+        this->user_val_compare = NULL;
+        this->merge_split = false;
 
         database = user_database = NULL;
         in_databases.clear();
+        attached_databases.clear();
+        db_partitioned = false;
+        db_split = false;
 
         input_records = output_records = 0;
         kv_records = kmv_records = 0;
@@ -607,10 +1888,15 @@ class MimirContext {
 
         // BIN_COUNT may be changed by mimir_init function
         this->bincount = mimir_ctx_size * BIN_COUNT;
+        this->cache_mode = INPUT_CACHE;
 
         h = NULL;
         ser = new Serializer<KeyType, ValType>(keycount, valcount);
 
+        stream = NULL;
+        stream_shuffler = NULL;
+        stream_kv = NULL;
+
         //isoutkv = false;
     }
 
@@ -628,6 +1914,10 @@ class MimirContext {
             }
             in_databases.clear();
 	}
+        for (auto iter : attached_databases) {
+            BaseObject::subRef(iter);
+        }
+        attached_databases.clear();
         if (h != NULL) {
             delete h;
         }
@@ -643,10 +1933,17 @@ class MimirContext {
                          KeyType* key, ValType* val1, ValType* val2, ValType *val3, void *ptr);
     int (*user_partition)(KeyType* key, ValType *val, int npartition);
     int (*user_padding)(const char* buf, int buflen, bool islast);
+    bool (*user_block_filter)(InKeyType *first, InKeyType *next, void *ptr);
+    void *user_block_ptr;
+    bool secondary_sort;
+    int (*user_val_compare)(ValType *val1, ValType *val2);
+    bool merge_split;
 
     // Configurations
     std::vector<std::string> input_dir;    // Input files
     std::string              output_dir;   // Output files
+    InputFileFormat          input_format; // Format of input files
+    int                      cache_mode;   // Cache of map output
 
     // Count for <Key,Value>
     int         keycount, valcount;
@@ -658,9 +1955,17 @@ class MimirContext {
     BaseObject              *database;
     BaseObject              *user_database;
     std::vector<BaseObject*> in_databases;
+    std::vector<BaseObject*> attached_databases;
+    bool                     db_partitioned;
+    bool                     db_split;
 
     HashBucket<> *h;
 
+    // Stream from the previous stage of a pipeline
+    StreamMapper<InKeyType,InValType,KeyType,ValType> *stream;
+    BaseShuffler<KeyType,ValType>                     *stream_shuffler;
+    BaseDatabase<KeyType,ValType>                     *stream_kv;
+
     uint64_t    input_records;
     uint64_t    kv_records;
     uint64_t    kmv_records;
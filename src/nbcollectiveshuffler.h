@@ -133,6 +133,8 @@ public:
 
     virtual int write(KeyType *key, ValType *val)
     {
+        if (this->is_filtered(key)) return true;
+
         //int target = get_target_rank(((KVRecord*)record)->get_key(), 
         //                             ((KVRecord*)record)->get_key_size());
 
@@ -60,6 +60,8 @@ public:
 
    virtual int write(KeyType *key, ValType *val)
    {
+       if (this->is_filtered(key)) return true;
+
        int target = this->get_target_rank(key, val);
 
        if (target == this->shuffle_rank) {
@@ -0,0 +1,118 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_RANGE_PARTITIONER_H
+#define MIMIR_RANGE_PARTITIONER_H
+
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+#include "log.h"
+#include "stat.h"
+#include "serializer.h"
+#include "keycomparator.h"
+
+namespace MIMIR_NS {
+
+// Place keys by range: process i gets the keys between splitter i-1 and
+// splitter i. The splitters are picked from the keys sampled by all
+// processes, so every process computes the same ones.
+template <typename KeyType>
+class RangePartitioner {
+  public:
+    RangePartitioner(MPI_Comm comm, KeyComparator<KeyType> *cmp, int keycount) {
+        this->comm = comm;
+        this->cmp = cmp;
+        this->keycount = keycount;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        ser = new Serializer<KeyType, void>(keycount, 0);
+    }
+
+    ~RangePartitioner() {
+        delete ser;
+    }
+
+    void add_sample(KeyType *key) {
+        size_t off = samples.size();
+        int keysize = ser->get_key_bytes(key);
+        samples.resize(off + keysize);
+        ser->key_to_bytes(key, samples.data() + off, keysize);
+    }
+
+    void compute_splitters() {
+        int recvcounts[size], displs[size];
+        if (samples.size() > (size_t)INT32_MAX)
+            LOG_ERROR("Too many samples (%ld)!\n", samples.size());
+        int sendcount = (int)samples.size();
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Allgather(&sendcount, 1, MPI_INT, recvcounts, 1, MPI_INT, comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_ALLGATHER);
+
+        int64_t recvcount = 0;
+        for (int i = 0; i < size; i++) {
+            displs[i] = (int)recvcount;
+            recvcount += recvcounts[i];
+            if (recvcount > INT32_MAX)
+                LOG_ERROR("Too many samples (%ld)!\n", recvcount);
+        }
+        all_samples.resize(recvcount);
+
+        PROFILER_RECORD_TIME_START;
+        MPI_Allgatherv(samples.data(), sendcount, MPI_BYTE,
+                       all_samples.data(), recvcounts, displs, MPI_BYTE, comm);
+        PROFILER_RECORD_TIME_END(TIMER_COMM_ALLGATHERV);
+        std::vector<char>().swap(samples);
+
+        typename SafeType<KeyType>::type key[keycount];
+        std::vector<char*> keys;
+        int64_t off = 0;
+        while (off < recvcount) {
+            keys.push_back(all_samples.data() + off);
+            off += ser->key_from_bytes(key, all_samples.data() + off,
+                                       (int)(recvcount - off));
+        }
+        std::sort(keys.begin(), keys.end(), *cmp);
+
+        splitters.clear();
+        if (keys.size() == 0) return;
+        for (int i = 1; i < size; i++) {
+            splitters.push_back(keys[(size_t)i * keys.size() / size]);
+        }
+
+        LOG_PRINT(DBG_GEN, "RangePartitioner: samples=%ld, splitters=%ld\n",
+                  keys.size(), splitters.size());
+    }
+
+    // Number of splitters not greater than the key
+    int get_target(KeyType *key) {
+        typename SafeType<KeyType>::type splitter[keycount];
+        int low = 0, high = (int)splitters.size();
+        while (low < high) {
+            int mid = (low + high) / 2;
+            bytestream<KeyType>::from_bytes(splitter, keycount, splitters[mid]);
+            if (cmp->compare(splitter, key) <= 0) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+  private:
+    MPI_Comm                  comm;
+    int                       rank, size;
+    int                       keycount;
+    KeyComparator<KeyType>   *cmp;
+    Serializer<KeyType, void> *ser;
+    std::vector<char>         samples;
+    std::vector<char>         all_samples;
+    std::vector<char*>        splitters;
+};
+
+}
+
+#endif
@@ -54,6 +54,16 @@ class bytestream {
         return bytesize;
     }
 
+    static int from_line (Type* obj, char *buf, int len) {
+        return from_bytes(obj, 1, buf);
+    }
+
+    static int get_bytes (char *buf, int count, int bufsize) {
+        int bytesize = (int)sizeof(Type) * count;
+        if (bufsize < bytesize) return -1;
+        return bytesize;
+    }
+
     static char* get_ptr (Type *obj, int count) {
         return reinterpret_cast<char*>(obj);
     }
@@ -107,6 +117,23 @@ class bytestream<const char*> {
         return bytesize;
     }
 
+    // The line length is known from the parser, skip strlen
+    static int from_line (const char** obj, char *buf, int len) {
+        obj[0] = buf;
+        return len + 1;
+    }
+
+    // Size of count strings at buf, -1 if the last one is not complete
+    static int get_bytes (char *buf, int count, int bufsize) {
+        int bytesize = 0;
+        for (int i = 0; i < count; i++) {
+            char *end = (char*)memchr(buf + bytesize, '\0', bufsize - bytesize);
+            if (end == NULL) return -1;
+            bytesize = (int)(end - buf) + 1;
+        }
+        return bytesize;
+    }
+
     static char* get_ptr (const char** obj, int count) {
         return (char*)(*obj);
     }
@@ -171,6 +198,23 @@ class bytestream<char*> {
         return bytesize;
     }
 
+    // The line length is known from the parser, skip strlen
+    static int from_line (char** obj, char *buf, int len) {
+        obj[0] = buf;
+        return len + 1;
+    }
+
+    // Size of count strings at buf, -1 if the last one is not complete
+    static int get_bytes (char *buf, int count, int bufsize) {
+        int bytesize = 0;
+        for (int i = 0; i < count; i++) {
+            char *end = (char*)memchr(buf + bytesize, '\0', bufsize - bytesize);
+            if (end == NULL) return -1;
+            bytesize = (int)(end - buf) + 1;
+        }
+        return bytesize;
+    }
+
     static char* get_ptr (char** obj, int count) {
         return reinterpret_cast<char*>(*obj);
     }
@@ -218,6 +262,16 @@ class bytestream<void> {
         return 0;
     }
 
+    static int from_line (void* obj, char *buf, int len) {
+
+        return 0;
+    }
+
+    static int get_bytes (char *buf, int count, int bufsize) {
+
+        return 0;
+    }
+
     static char* get_ptr (void *obj, int count) {
         return NULL;
     }
@@ -328,6 +382,8 @@ class Serializer {
         if (std::is_pointer<KeyType>::value) {
             if (keycount > 1)
                 tmpkey = (char*)mem_aligned_malloc(MEMPAGE_SIZE, MAX_RECORD_SIZE);
+            else
+                tmpkey = NULL;
             int pkeysize = bytestream<KeyType>::psize(keycount);
             bufkey = (KeyType*)mem_aligned_malloc(MEMPAGE_SIZE, pkeysize);
         } else {
@@ -396,6 +452,15 @@ class Serializer {
 
     }
 
+    // buffer holds a null-terminated line of linelen bytes
+    int key_from_line (KeyType *key, char* buffer, int linelen) {
+
+        if (keycount != 1)
+            return bytestream<KeyType>::from_bytes(key, keycount, buffer);
+        return bytestream<KeyType>::from_line(key, buffer, linelen);
+
+    }
+
     int val_from_bytes (ValType *val, char* buffer, int bufsize) {
 
         return bytestream<ValType>::from_bytes(val, valcount, buffer);
@@ -442,6 +507,21 @@ class Serializer {
         return keybytes + valbytes;
     }
 
+    // Size of the serialized record at buffer, -1 if it is not complete
+    int get_record_bytes (char *buffer, int bufsize) {
+
+        int keybytes = 0, valbytes = 0;
+
+        keybytes = bytestream<KeyType>::get_bytes(buffer, keycount, bufsize);
+        if (keybytes == -1) return -1;
+
+        valbytes = bytestream<ValType>::get_bytes(buffer + keybytes, valcount,
+                                                  bufsize - keybytes);
+        if (valbytes == -1) return -1;
+
+        return keybytes + valbytes;
+    }
+
     int get_key_bytes (KeyType *key) {
 
         return bytestream<KeyType>::size(key, keycount);
@@ -0,0 +1,352 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_SORT_KMV_CONTAINER_H
+#define MIMIR_SORT_KMV_CONTAINER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include "log.h"
+#include "config.h"
+#include "globals.h"
+#include "memory.h"
+#include "hash.h"
+#include "interface.h"
+#include "serializer.h"
+#include "kmvcontainer.h"
+#include "stat.h"
+
+namespace MIMIR_NS {
+
+struct GroupRecord {
+    uint32_t hash;             // hash of the key bytes
+    int      keysize;
+    int      recsize;
+    char    *record;           // the key bytes lead the record
+};
+
+// Records are ordered by the hash of their key, then by the key bytes,
+// so the records of one key are adjacent
+inline bool group_record_less(const GroupRecord &r1, const GroupRecord &r2) {
+    if (r1.hash != r2.hash) return r1.hash < r2.hash;
+    if (r1.keysize != r2.keysize) return r1.keysize < r2.keysize;
+    return memcmp(r1.record, r2.record, r1.keysize) < 0;
+}
+
+inline bool group_record_equal(const GroupRecord &r1, const GroupRecord &r2) {
+    return r1.hash == r2.hash && r1.keysize == r2.keysize
+        && memcmp(r1.record, r2.record, r1.keysize) == 0;
+}
+
+// Sorted run spilled to a file, read back through a buffer
+struct GroupRun {
+    FILE        *fp;
+    std::string  filename;
+    char        *buffer;
+    int64_t      bufsize, datasize, off;
+    GroupRecord  cur;
+};
+
+// Sort-based grouping. The records are copied into runs of at most
+// GROUP_RUN_SIZE bytes and radix sorted by the hash of their key. A
+// single run is grouped in memory; otherwise the sorted runs are
+// spilled to CACHE_DIR and merged, one group at a time.
+template <typename KeyType, typename ValType>
+class SortKMVContainer : public BaseKMVContainer<KeyType, ValType> {
+  public:
+    SortKMVContainer(int keycount, int valcount) {
+        this->keycount = keycount;
+        this->valcount = valcount;
+        ser = new Serializer<KeyType, ValType>(keycount, valcount);
+        kmv = NULL;
+        kmvcount = 0;
+        pagesize = DATA_PAGE_SIZE;
+        pageoff = pagesize;
+        runbytes = 0;
+        recidx = 0;
+        mem_bytes = 0;
+    }
+
+    virtual ~SortKMVContainer() {
+        free_pages();
+        for (size_t i = 0; i < runs.size(); i++) {
+            if (runs[i]->fp != NULL) fclose(runs[i]->fp);
+            unlink(runs[i]->filename.c_str());
+            if (runs[i]->buffer != NULL) mem_aligned_free(runs[i]->buffer);
+            delete runs[i];
+        }
+        delete ser;
+        PROFILER_RECORD_COUNT(COUNTER_MAX_KMVS, kmvcount, OPMAX);
+        PROFILER_RECORD_COUNT(COUNTER_MAX_KMV_PAGES, this->mem_bytes, OPMAX);
+    }
+
+    virtual int open() {
+        kmv = new KMVItem<KeyType, ValType>(keycount, valcount);
+        return 0;
+    }
+
+    virtual void close() {
+        delete kmv;
+        kmv = NULL;
+    }
+
+    virtual KMVItem<KeyType, ValType>* read() {
+        if (runs.size() == 0) {
+            if (recidx >= records.size()) return NULL;
+            begin_group(records[recidx]);
+            recidx++;
+            while (recidx < records.size()
+                   && group_record_equal(records[recidx], records[recidx - 1])) {
+                add_value(records[recidx]);
+                recidx++;
+            }
+        } else {
+            if (heap.empty()) return NULL;
+            size_t run = heap.top();
+            heap.pop();
+            begin_group(runs[run]->cur);
+            advance(run);
+            while (!heap.empty()
+                   && group_record_equal(runs[heap.top()]->cur, group)) {
+                run = heap.top();
+                heap.pop();
+                add_value(runs[run]->cur);
+                advance(run);
+            }
+        }
+        if (this->val_sorter != NULL) {
+            this->val_sorter->sort(valbuf.data(), valbuf.data() + valbuf.size());
+        }
+        kmv->set_group(keybuf.data(), group.keysize,
+                       valbuf.data(), valbuf.data() + valbuf.size());
+        kmvcount++;
+        return kmv;
+    }
+
+    virtual uint64_t get_record_count() { return kmvcount; }
+
+    virtual void convert(Readable<KeyType,ValType> *kv) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+
+        LOG_PRINT(DBG_GEN, "MapReduce: sort convert start.\n");
+
+        kv->open();
+        while ((kv->read(key, val)) == true) {
+            GroupRecord rec;
+            rec.recsize = ser->get_kv_bytes(key, val);
+            if (runbytes + rec.recsize > GROUP_RUN_SIZE && records.size() > 0) {
+                sort_run();
+                spill_run();
+            }
+            rec.record = get_space(rec.recsize);
+            ser->kv_to_bytes(key, val, rec.record, rec.recsize);
+            rec.keysize = ser->get_key_bytes(key);
+            rec.hash = hashlittle(rec.record, rec.keysize, 0);
+            records.push_back(rec);
+            runbytes += rec.recsize;
+        }
+        kv->close();
+
+        sort_run();
+        if (runs.size() > 0) {
+            spill_run();
+            start_merge();
+        }
+
+        LOG_PRINT(DBG_GEN, "MapReduce: sort convert end (runs=%ld).\n",
+                  runs.size() > 0 ? runs.size() : (size_t)1);
+    }
+
+  private:
+    char *get_space(int recsize) {
+        if (recsize > pagesize)
+            LOG_ERROR("Error: KV size (%d) is larger than one page (%ld)\n",
+                      recsize, pagesize);
+        if (pageoff + recsize > pagesize) {
+            pages.push_back((char*)mem_aligned_malloc(MEMPAGE_SIZE, pagesize));
+            pageoff = 0;
+            mem_bytes += pagesize;
+            PROFILER_RECORD_COUNT(COUNTER_MAX_KMV_PAGES, this->mem_bytes, OPMAX);
+        }
+        char *ptr = pages.back() + pageoff;
+        pageoff += recsize;
+        return ptr;
+    }
+
+    void free_pages() {
+        for (size_t i = 0; i < pages.size(); i++) {
+            mem_aligned_free(pages[i]);
+            mem_bytes -= pagesize;
+        }
+        pages.clear();
+        pageoff = pagesize;
+    }
+
+    // LSD radix sort on the hash, then order the keys sharing a hash
+    void sort_run() {
+        std::vector<GroupRecord> tmp(records.size());
+        for (int shift = 0; shift < 32; shift += 8) {
+            size_t count[257] = {0};
+            for (size_t i = 0; i < records.size(); i++) {
+                count[((records[i].hash >> shift) & 0xff) + 1]++;
+            }
+            for (int i = 0; i < 256; i++) {
+                count[i + 1] += count[i];
+            }
+            for (size_t i = 0; i < records.size(); i++) {
+                tmp[count[(records[i].hash >> shift) & 0xff]++] = records[i];
+            }
+            records.swap(tmp);
+        }
+
+        size_t start = 0;
+        while (start < records.size()) {
+            size_t end = start + 1;
+            bool same_key = true;
+            while (end < records.size() && records[end].hash == records[start].hash) {
+                if (same_key && !group_record_equal(records[end], records[start]))
+                    same_key = false;
+                end++;
+            }
+            if (!same_key) {
+                std::stable_sort(records.begin() + start, records.begin() + end,
+                                 group_record_less);
+            }
+            start = end;
+        }
+    }
+
+    void spill_run() {
+        char buf[1024];
+        int len = snprintf(buf, sizeof(buf), "%s/mimir-group.%d.%d.%p.%ld",
+                           CACHE_DIR, mimir_world_rank, (int)getpid(), (void*)this, runs.size());
+        if (len < 0 || len >= (int)sizeof(buf))
+            LOG_ERROR("Error: the cache directory %s is too long!\n", CACHE_DIR);
+        std::string filename(buf);
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL) LOG_ERROR("Open file %s error!\n", filename.c_str());
+        for (size_t i = 0; i < records.size(); i++) {
+            if (fwrite(records[i].record, 1, records[i].recsize, fp)
+                != (size_t)records[i].recsize)
+                LOG_ERROR("Write file %s error!\n", filename.c_str());
+        }
+        fclose(fp);
+
+        GroupRun *run = new GroupRun();
+        run->fp = NULL;
+        run->filename = filename;
+        run->buffer = NULL;
+        run->bufsize = run->datasize = run->off = 0;
+        runs.push_back(run);
+
+        LOG_PRINT(DBG_GEN, "MapReduce: spill sorted run %ld (records=%ld, bytes=%ld)\n",
+                  runs.size() - 1, records.size(), runbytes);
+
+        std::vector<GroupRecord> empty;
+        records.swap(empty);
+        free_pages();
+        runbytes = 0;
+    }
+
+    struct RunGreater {
+        std::vector<GroupRun*> *runs;
+        bool operator()(size_t r1, size_t r2) const {
+            return group_record_less((*runs)[r2]->cur, (*runs)[r1]->cur);
+        }
+    };
+
+    void start_merge() {
+        int64_t bufsize = INPUT_BUF_SIZE / (int64_t)runs.size();
+        if (bufsize < 2 * (int64_t)MAX_RECORD_SIZE)
+            bufsize = 2 * (int64_t)MAX_RECORD_SIZE;
+        RunGreater greater;
+        greater.runs = &runs;
+        heap = std::priority_queue<size_t, std::vector<size_t>, RunGreater>(greater);
+        for (size_t i = 0; i < runs.size(); i++) {
+            GroupRun *run = runs[i];
+            run->fp = fopen(run->filename.c_str(), "rb");
+            if (run->fp == NULL) LOG_ERROR("Open file %s error!\n", run->filename.c_str());
+            run->buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, bufsize);
+            run->bufsize = bufsize;
+            mem_bytes += bufsize;
+            if (next_record(run)) heap.push(i);
+        }
+    }
+
+    // Parse the next record of a run, refilling the buffer so that a
+    // whole record is available
+    bool next_record(GroupRun *run) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+
+        if (run->fp != NULL && run->datasize - run->off < MAX_RECORD_SIZE) {
+            int64_t remain = run->datasize - run->off;
+            memmove(run->buffer, run->buffer + run->off, remain);
+            size_t bytes = fread(run->buffer + remain, 1, run->bufsize - remain, run->fp);
+            run->datasize = remain + bytes;
+            run->off = 0;
+            if (bytes == 0) {
+                fclose(run->fp);
+                run->fp = NULL;
+            }
+        }
+        if (run->off >= run->datasize) return false;
+
+        GroupRecord &rec = run->cur;
+        rec.record = run->buffer + run->off;
+        rec.recsize = ser->kv_from_bytes(&key, &val, rec.record,
+                                         (int)(run->datasize - run->off));
+        rec.keysize = ser->get_key_bytes(key);
+        rec.hash = hashlittle(rec.record, rec.keysize, 0);
+        run->off += rec.recsize;
+        return true;
+    }
+
+    void advance(size_t run) {
+        if (next_record(runs[run])) heap.push(run);
+    }
+
+    void begin_group(const GroupRecord &rec) {
+        keybuf.assign(rec.record, rec.record + rec.keysize);
+        group = rec;
+        group.record = keybuf.data();
+        valbuf.clear();
+        add_value(rec);
+    }
+
+    void add_value(const GroupRecord &rec) {
+        valbuf.insert(valbuf.end(), rec.record + rec.keysize, rec.record + rec.recsize);
+    }
+
+    int keycount, valcount;
+    Serializer<KeyType, ValType> *ser;
+    KMVItem<KeyType, ValType> *kmv;
+    uint64_t kmvcount;
+
+    std::vector<char*>       pages;
+    int64_t                  pagesize, pageoff;
+    std::vector<GroupRecord> records;
+    int64_t                  runbytes;
+    size_t                   recidx;
+
+    std::vector<GroupRun*>   runs;
+    std::priority_queue<size_t, std::vector<size_t>, RunGreater> heap;
+
+    GroupRecord              group;
+    std::vector<char>        keybuf, valbuf;
+
+    uint64_t                 mem_bytes;
+};
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_SPACE_SAVING_H
+#define MIMIR_SPACE_SAVING_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+namespace MIMIR_NS {
+
+// Space-Saving sketch of the most frequent items of a stream. It keeps
+// capacity counters in a min-heap; an untracked item takes over the
+// smallest counter. Any item seen more than N/capacity times out of N
+// is tracked, and count - error never exceeds its true count.
+class SpaceSaving {
+  public:
+    struct Counter {
+        uint32_t item;
+        uint64_t count;
+        uint64_t error;
+    };
+
+    SpaceSaving(int capacity) {
+        this->capacity = capacity;
+        total = 0;
+    }
+
+    void add(uint32_t item) {
+        total += 1;
+        auto iter = pos.find(item);
+        if (iter != pos.end()) {
+            heap[iter->second].count += 1;
+            sift_down(iter->second);
+        } else if ((int)heap.size() < capacity) {
+            Counter c = {item, 1, 0};
+            heap.push_back(c);
+            pos[item] = (int)heap.size() - 1;
+            sift_up((int)heap.size() - 1);
+        } else {
+            pos.erase(heap[0].item);
+            uint64_t min = heap[0].count;
+            heap[0].item = item;
+            heap[0].count = min + 1;
+            heap[0].error = min;
+            pos[item] = 0;
+            sift_down(0);
+        }
+    }
+
+    // Drop the counters of the items matching fn
+    template <typename Fn>
+    void remove_if(Fn fn) {
+        std::vector<Counter> kept;
+        for (size_t i = 0; i < heap.size(); i++) {
+            if (!fn(heap[i].item)) kept.push_back(heap[i]);
+        }
+        heap.swap(kept);
+        pos.clear();
+        for (size_t i = 0; i < heap.size(); i++) {
+            pos[heap[i].item] = (int)i;
+        }
+        for (int i = (int)heap.size() / 2 - 1; i >= 0; i--) {
+            sift_down(i);
+        }
+    }
+
+    const std::vector<Counter> &get_counters() { return heap; }
+    uint64_t get_total() { return total; }
+
+  private:
+    void swap_counters(int i, int j) {
+        Counter tmp = heap[i];
+        heap[i] = heap[j];
+        heap[j] = tmp;
+        pos[heap[i].item] = i;
+        pos[heap[j].item] = j;
+    }
+
+    void sift_up(int i) {
+        while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+            swap_counters(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(int i) {
+        int n = (int)heap.size();
+        while (true) {
+            int min = i, l = 2 * i + 1, r = 2 * i + 2;
+            if (l < n && heap[l].count < heap[min].count) min = l;
+            if (r < n && heap[r].count < heap[min].count) min = r;
+            if (min == i) break;
+            swap_counters(i, min);
+            i = min;
+        }
+    }
+
+    int                               capacity;
+    uint64_t                          total;
+    std::vector<Counter>              heap;
+    std::unordered_map<uint32_t, int> pos;
+};
+
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_SPLIT_KEY_ROUTER_H
+#define MIMIR_SPLIT_KEY_ROUTER_H
+
+#include "interface.h"
+#include "serializer.h"
+#include "hashbucket.h"
+
+namespace MIMIR_NS {
+
+// Passes the reduce output of the split keys to the partial results,
+// which are merged later, and the rest to the output
+template <typename KeyType, typename ValType>
+class SplitKeyRouter : public Writable<KeyType,ValType> {
+  public:
+    SplitKeyRouter(HashBucket<> *split_keys,
+                   Writable<KeyType,ValType> *out,
+                   Writable<KeyType,ValType> *partial,
+                   int keycount, int valcount) {
+        this->split_keys = split_keys;
+        this->out = out;
+        this->partial = partial;
+        ser = new Serializer<KeyType, ValType>(keycount, valcount);
+        record_count = 0;
+    }
+
+    virtual ~SplitKeyRouter() {
+        delete ser;
+    }
+
+    virtual int open() { return true; }
+    virtual void close() {}
+    virtual int seek(DB_POS pos) { return true; }
+    virtual uint64_t get_record_count() { return record_count; }
+
+    virtual int write(KeyType *key, ValType *val) {
+        record_count += 1;
+        if (split_keys->findEntry(ser->get_key_ptr(key), ser->get_key_bytes(key)) != NULL)
+            return partial->write(key, val);
+        return out->write(key, val);
+    }
+
+  private:
+    HashBucket<>                 *split_keys;
+    Writable<KeyType,ValType>    *out;
+    Writable<KeyType,ValType>    *partial;
+    Serializer<KeyType, ValType> *ser;
+    uint64_t                      record_count;
+};
+
+}
+
+#endif
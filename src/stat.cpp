@@ -30,7 +30,10 @@ const char *timer_str[TIMER_NUM] = {
     "lb_check_time",
     "lb_rp_time",
     "lb_migrate_time",
-    "lb_split_time"
+    "lb_split_time",
+    "pfs_prefetch_time",
+    "pfs_writebehind_time",
+    "lb_group_time"
 };
 
 const char *counter_str[COUNTER_NUM] = {
@@ -55,6 +58,15 @@ const char *counter_str[COUNTER_NUM] = {
     "max_kmv_pages",
     "hash_bucket",
     "peakmem_use",
+    "skip_blocks",
+    "steal_tries",
+    "steal_local",
+    "steal_remote",
+    "steal_chunks",
+    "filtered_kvs",
+    "moved_bytes",
+    "combine_switches",
+    "bypass_kvs",
 };
 
 Tracker_info tracker_info;
@@ -61,7 +61,10 @@ extern char timestr[];
 #define TIMER_LB_RP               12    // repartition
 #define TIMER_LB_MIGRATE          13    // migrate
 #define TIMER_LB_SPLIT            14    // split
-#define TIMER_NUM                 15
+#define TIMER_PFS_PREFETCH        15    // PFS input time in background
+#define TIMER_PFS_WRITEBEHIND     16    // PFS output time in background
+#define TIMER_LB_GROUP            17    // move groups before reduce
+#define TIMER_NUM                 18
 
 
 // Counters
@@ -86,7 +89,16 @@ extern char timestr[];
 #define COUNTER_MAX_KMV_PAGES      18   // max kmv pages
 #define COUNTER_HASH_BUCKET        19   // max reduce bucket
 #define COUNTER_PEAKMEM_USE        20   // peak memory usage
-#define COUNTER_NUM                21
+#define COUNTER_SKIP_BLOCKS        21   // skipped blocks of indexed files
+#define COUNTER_STEAL_TRIES        22   // steal attempts
+#define COUNTER_STEAL_LOCAL        23   // successful steals in the node
+#define COUNTER_STEAL_REMOTE       24   // successful steals from other nodes
+#define COUNTER_STEAL_CHUNKS       25   // stolen chunks
+#define COUNTER_FILTERED_KVS       26   // KVs dropped by key filters
+#define COUNTER_MOVED_BYTES        27   // bytes of groups moved before reduce
+#define COUNTER_COMBINE_SWITCHES   28   // combiner bypass switches
+#define COUNTER_BYPASS_KVS         29   // KVs sent without combining
+#define COUNTER_NUM                30
 
 /// Events
 #define EVENT_COMPUTE_APP          "event_compute_app"          // application computation
@@ -112,6 +124,7 @@ extern char timestr[];
 #define EVENT_COMM_IRECV           "event_comm_irecv"           // MPI_Irecv
 #define EVENT_COMM_ALLGATHER       "event_comm_allgather"       // MPI_Allgather
 #define EVENT_COMM_ALLGATHERV      "event_comm_allgatherv"      // MPI_Allgatherv
+#define EVENT_COMM_GATHERV         "event_comm_gatherv"         // MPI_Gatherv
 
 // Disk IO
 #define EVENT_DISK_FOPEN           "event_disk_open"            // posix open
@@ -121,6 +134,7 @@ extern char timestr[];
 #define EVENT_DISK_MPIOPEN         "event_disk_mpiopen"         // MPI_File_open
 #define EVENT_DISK_MPIREADATALL    "event_disk_mpireadatall"    // MPI_File_read_at_all
 #define EVENT_DISK_MPIWRITEATALL   "event_disk_mpiwriteatall"   // MPI_File_write_at_all
+#define EVENT_DISK_MPIIWRITEAT     "event_disk_mpiiwriteat"     // MPI_File_iwrite_at
 #define EVENT_DISK_MPICLOSE        "event_disk_mpiclose"        // MPI_File_close
 
 #define INIT_STAT()                                                            \
@@ -157,6 +171,7 @@ extern char timestr[];
 #define PROFILER_END
 #define PROFILER_RECORD_TIME_START
 #define PROFILER_RECORD_TIME_END(timer_type)
+#define PROFILER_RECORD_TIME(timer_type, t)
 #define PROFILER_RECORD_COUNT(counter_type, count, op)
 #define PROFILER_PRINT(filename)
 
@@ -183,6 +198,9 @@ extern char timestr[];
     profiler_timer[timer_type] +=                                              \
         (MR_GET_WTIME() - profiler_info.prev_wtime);
 
+#define PROFILER_RECORD_TIME(timer_type, t)                                    \
+    profiler_timer[timer_type] += (t);
+
 #define PROFILER_RECORD_COUNT(counter_type, count, op)                         \
 {                                                                              \
     if (op == OPSUM) {                                                         \
@@ -0,0 +1,132 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_STREAM_MAPPER_H
+#define MIMIR_STREAM_MAPPER_H
+
+#include "log.h"
+#include "config.h"
+#include "memory.h"
+#include "interface.h"
+#include "serializer.h"
+
+namespace MIMIR_NS {
+
+// Copy a record when the stages have the same types
+template <typename InKeyType, typename InValType, typename KeyType, typename ValType>
+class StreamCopy {
+  public:
+    static int write(Writable<KeyType,ValType> *out, InKeyType *key, InValType *val) {
+        LOG_ERROR("A stream without map callback needs the same types!\n");
+        return false;
+    }
+};
+
+template <typename KeyType, typename ValType>
+class StreamCopy<KeyType,ValType,KeyType,ValType> {
+  public:
+    static int write(Writable<KeyType,ValType> *out, KeyType *key, ValType *val) {
+        return out->write(key, val);
+    }
+};
+
+// Feeds the records written by a previous stage to a map callback. The
+// records are kept in one page; the callback is run on the page when it
+// is full and when the stream is closed, so it must not assume that it
+// sees all records at once.
+template <typename InKeyType, typename InValType, typename KeyType, typename ValType>
+class StreamMapper : public Readable<InKeyType,InValType>,
+                     public Writable<InKeyType,InValType> {
+  public:
+    StreamMapper(void (*user_map)(Readable<InKeyType,InValType> *input,
+                                  Writable<KeyType,ValType> *output, void *ptr),
+                 void *ptr, Writable<KeyType,ValType> *out,
+                 int keycount, int valcount) {
+        this->user_map = user_map;
+        this->ptr = ptr;
+        this->out = out;
+        pagesize = DATA_PAGE_SIZE;
+        buffer = NULL;
+        datasize = bufoff = 0;
+        record_count = 0;
+        ser = new Serializer<InKeyType,InValType>(keycount, valcount);
+    }
+
+    virtual ~StreamMapper() {
+        if (buffer != NULL) mem_aligned_free(buffer);
+        delete ser;
+    }
+
+    virtual int open() {
+        if (user_map != NULL && buffer == NULL)
+            buffer = (char*)mem_aligned_malloc(MEMPAGE_SIZE, pagesize);
+        datasize = bufoff = 0;
+        return true;
+    }
+
+    virtual void close() {
+        flush();
+    }
+
+    virtual int seek(DB_POS pos) {
+        if (pos == DB_START) bufoff = 0;
+        else if (pos == DB_END) bufoff = datasize;
+        return true;
+    }
+
+    virtual uint64_t get_record_count() { return record_count; }
+
+    virtual int read(InKeyType *key, InValType *val) {
+        if (bufoff >= datasize) return false;
+        int kvsize = ser->kv_from_bytes(key, val, buffer + bufoff,
+                                        (int)(datasize - bufoff));
+        bufoff += kvsize;
+        return true;
+    }
+
+    virtual int write(InKeyType *key, InValType *val) {
+        record_count += 1;
+        if (user_map == NULL)
+            return StreamCopy<InKeyType,InValType,KeyType,ValType>::write(out, key, val);
+
+        int kvsize = ser->kv_to_bytes(key, val, buffer + datasize,
+                                      (int)(pagesize - datasize));
+        if (kvsize == -1) {
+            flush();
+            kvsize = ser->kv_to_bytes(key, val, buffer, (int)pagesize);
+            if (kvsize == -1)
+                LOG_ERROR("Error: KV size is larger than one page (%ld)\n", pagesize);
+        }
+        datasize += kvsize;
+        return true;
+    }
+
+  private:
+    void flush() {
+        if (datasize == 0) return;
+        bufoff = 0;
+        user_map(this, out, ptr);
+        datasize = bufoff = 0;
+    }
+
+    void (*user_map)(Readable<InKeyType,InValType> *input,
+                     Writable<KeyType,ValType> *output, void *ptr);
+    void                       *ptr;
+    Writable<KeyType,ValType>  *out;
+
+    int64_t     pagesize;
+    char       *buffer;
+    int64_t     datasize;
+    int64_t     bufoff;
+    uint64_t    record_count;
+
+    Serializer<InKeyType,InValType> *ser;
+};
+
+}
+
+#endif
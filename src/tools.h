@@ -9,6 +9,7 @@
 #include <memory>
 #include <string>
 #include <cstdlib>
+#include <string.h>
 
 #include "interface.h"
 
@@ -17,19 +18,10 @@ uint64_t decode_varint(char *buf);
 
 inline int text_file_repartition (const char* buffer, int bufsize, bool islast)
 {
-    int idx = 0;
-    for (idx = 0; idx < bufsize; idx ++) {
-        if (buffer[idx] == '\n') {
-            idx = idx + 1;
-            break;
-        }
-    }
-
-    if (idx == bufsize && islast) {
-        return bufsize;
-    }
+    const char *end = (const char*)memchr(buffer, '\n', bufsize);
+    if (end != NULL) return (int)(end - buffer) + 1;
 
-    return idx;
+    return bufsize;
 }
 
 
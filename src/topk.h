@@ -0,0 +1,185 @@
+/*
+ * (c) 2016 by University of Delaware, Argonne National Laboratory, San Diego 
+ *     Supercomputer Center, National University of Defense Technology, 
+ *     National Supercomputer Center in Guangzhou, and Sun Yat-sen University.
+ *
+ *     See COPYRIGHT in top-level directory.
+ */
+#ifndef MIMIR_TOPK_H
+#define MIMIR_TOPK_H
+
+#include <mpi.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "log.h"
+#include "config.h"
+#include "globals.h"
+#include "stat.h"
+#include "interface.h"
+#include "serializer.h"
+#include "keycomparator.h"
+
+namespace MIMIR_NS {
+
+// Keeps the k records with the largest values written to it in a
+// bounded min-heap. merge() combines the heaps of all processes with a
+// tree reduction; the result ends on the first process.
+template <typename KeyType, typename ValType>
+class TopKCollector : public Writable<KeyType,ValType> {
+  public:
+    TopKCollector(int k, int (*user_compare)(ValType *val1, ValType *val2),
+                  int keycount, int valcount)
+        : cmp(user_compare, valcount), greater(this) {
+        this->k = k;
+        this->keycount = keycount;
+        this->valcount = valcount;
+        ser = new Serializer<KeyType, ValType>(keycount, valcount);
+        record_count = 0;
+    }
+
+    virtual ~TopKCollector() {
+        delete ser;
+    }
+
+    virtual int open() { return true; }
+    virtual void close() {}
+    virtual int seek(DB_POS pos) { return true; }
+    virtual uint64_t get_record_count() { return record_count; }
+
+    virtual int write(KeyType *key, ValType *val) {
+        record_count += 1;
+        if (k <= 0) return true;
+        if ((int)heap.size() == k) {
+            typename SafeType<ValType>::type minval[valcount];
+            get_val(heap.front(), minval);
+            if (cmp.compare(val, minval) <= 0) return true;
+        }
+        int kvsize = ser->get_kv_bytes(key, val);
+        std::vector<char> record(kvsize);
+        ser->kv_to_bytes(key, val, record.data(), kvsize);
+        insert(record);
+        return true;
+    }
+
+    // Add records serialized back to back
+    void add(const char *buf, int64_t bufsize) {
+        typename SafeType<KeyType>::ptrtype key = NULL;
+        typename SafeType<ValType>::ptrtype val = NULL;
+        int64_t off = 0;
+        while (off < bufsize) {
+            int kvsize = ser->kv_from_bytes(&key, &val, (char*)buf + off,
+                                            (int)(bufsize - off));
+            write(key, val);
+            off += kvsize;
+        }
+    }
+
+    // Tree reduction over the processes of comm
+    void merge(MPI_Comm comm) {
+        int rank, size;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+
+        for (int step = 1; step < size; step *= 2) {
+            if (rank % (2 * step) == step) {
+                std::vector<char> buf;
+                for (size_t i = 0; i < heap.size(); i++) {
+                    buf.insert(buf.end(), records[heap[i]].begin(),
+                               records[heap[i]].end());
+                }
+                int64_t bufsize = (int64_t)buf.size();
+                PROFILER_RECORD_TIME_START;
+                MPI_Send(&bufsize, 1, MPI_INT64_T, rank - step,
+                         TOPK_MERGE_TAG, comm);
+                MPI_Send(buf.data(), (int)bufsize, MPI_BYTE, rank - step,
+                         TOPK_MERGE_TAG, comm);
+                PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+                clear();
+                break;
+            } else if (rank % (2 * step) == 0 && rank + step < size) {
+                int64_t bufsize = 0;
+                MPI_Status st;
+                PROFILER_RECORD_TIME_START;
+                MPI_Recv(&bufsize, 1, MPI_INT64_T, rank + step,
+                         TOPK_MERGE_TAG, comm, &st);
+                std::vector<char> buf(bufsize);
+                MPI_Recv(buf.data(), (int)bufsize, MPI_BYTE, rank + step,
+                         TOPK_MERGE_TAG, comm, &st);
+                PROFILER_RECORD_TIME_END(TIMER_COMM_RDC);
+                uint64_t count = record_count;
+                add(buf.data(), bufsize);
+                record_count = count;
+            }
+        }
+    }
+
+    // Write the kept records, the largest value first
+    void output(Writable<KeyType,ValType> *out) {
+        typename SafeType<KeyType>::type key[keycount];
+        typename SafeType<ValType>::type val[valcount];
+        std::vector<int> order(heap);
+        std::sort(order.begin(), order.end(), greater);
+        for (size_t i = 0; i < order.size(); i++) {
+            ser->kv_from_bytes(key, val, records[order[i]].data(),
+                               (int)records[order[i]].size());
+            out->write(key, val);
+        }
+    }
+
+    uint64_t get_top_count() { return heap.size(); }
+
+  private:
+    // Orders records by value, the larger first
+    struct RecordGreater {
+        TopKCollector *topk;
+        RecordGreater(TopKCollector *topk) : topk(topk) {}
+        bool operator()(int r1, int r2) const {
+            return topk->compare_records(r1, r2) > 0;
+        }
+    };
+
+    int compare_records(int r1, int r2) {
+        typename SafeType<ValType>::type val1[valcount], val2[valcount];
+        get_val(r1, val1);
+        get_val(r2, val2);
+        return cmp.compare(val1, val2);
+    }
+
+    void get_val(int idx, ValType *val) {
+        typename SafeType<KeyType>::type key[keycount];
+        ser->kv_from_bytes(key, val, records[idx].data(), (int)records[idx].size());
+    }
+
+    // The heap keeps the smallest value on its front
+    void insert(std::vector<char> &record) {
+        if ((int)heap.size() < k) {
+            records.push_back(std::vector<char>());
+            records.back().swap(record);
+            heap.push_back((int)records.size() - 1);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            records[heap.back()].swap(record);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+    }
+
+    void clear() {
+        heap.clear();
+        records.clear();
+    }
+
+    int                             k;
+    int                             keycount, valcount;
+    KeyComparator<ValType>          cmp;
+    RecordGreater                   greater;
+    Serializer<KeyType, ValType>   *ser;
+    std::vector<std::vector<char> > records;
+    std::vector<int>                heap;
+    uint64_t                        record_count;
+};
+
+}
+
+#endif